@@ -1,19 +1,33 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome import pins
-from esphome.components import climate, uart, sensor, binary_sensor, text_sensor, switch
+from esphome import automation, pins
+from esphome.components import climate, uart, sensor, binary_sensor, text_sensor, switch, spi
+from esphome.components import time as time_
 from esphome.const import (
+    CONF_HOUR,
     CONF_ID,
+    CONF_MINUTE,
+    CONF_PLATFORM,
+    CONF_TIME_ID,
+    CONF_UPDATE_INTERVAL,
+    DEVICE_CLASS_DURATION,
+    DEVICE_CLASS_ENERGY,
     DEVICE_CLASS_TEMPERATURE,
     STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
     UNIT_CELSIUS,
+    UNIT_KILOWATT_HOURS,
+    UNIT_MILLISECOND,
+    UNIT_MINUTE,
 )
+from esphome.core import CORE
 
 DEPENDENCIES = ["uart"]
 AUTO_LOAD = ["climate", "sensor", "binary_sensor", "text_sensor"]
 
 bestway_spa_ns = cg.esphome_ns.namespace("bestway_spa")
 BestwaySpa = bestway_spa_ns.class_("BestwaySpa", climate.Climate, uart.UARTDevice, cg.Component)
+SpiTransport = bestway_spa_ns.class_("SpiTransport", spi.SPIDevice)
 
 # Protocol types
 ProtocolType = bestway_spa_ns.enum("ProtocolType")
@@ -27,6 +41,19 @@ PROTOCOL_TYPES = {
     "6WIRE_TYPE2": ProtocolType.PROTOCOL_6WIRE_T2,
 }
 
+# Build flag enabling each protocol's code paths
+PROTOCOL_BUILD_FLAGS = {
+    "4WIRE": "USE_BESTWAY_SPA_4WIRE",
+    "6WIRE_T1": "USE_BESTWAY_SPA_6WIRE_T1",
+    "6WIRE_T2": "USE_BESTWAY_SPA_6WIRE_T2",
+    "6WIRE": "USE_BESTWAY_SPA_6WIRE_T1",
+    "6WIRE_TYPE1": "USE_BESTWAY_SPA_6WIRE_T1",
+    "6WIRE_TYPE2": "USE_BESTWAY_SPA_6WIRE_T2",
+}
+
+# Listen at boot and pick the protocol from the traffic
+PROTOCOL_AUTO = "AUTO"
+
 # Spa models
 SpaModel = bestway_spa_ns.enum("SpaModel")
 SPA_MODELS = {
@@ -48,6 +75,52 @@ SPA_MODELS = {
     "NO54173": SpaModel.MODEL_54173,
 }
 
+# Protocol each non-4-wire model speaks; the start point while detecting
+MODEL_PROTOCOLS = {
+    "PRE2021": "6WIRE_T1",
+    "MODEL_PRE2021": "6WIRE_T1",
+    "P05504": "6WIRE_T1",
+    "54149E": "6WIRE_T2",
+    "MODEL_54149E": "6WIRE_T2",
+}
+
+# Profiled loop stages
+ProfileStage = bestway_spa_ns.enum("ProfileStage")
+PROFILE_STAGES = {
+    "loop_time": ProfileStage.PROFILE_LOOP,
+    "protocol_time": ProfileStage.PROFILE_PROTOCOL,
+    "button_queue_time": ProfileStage.PROFILE_BUTTONS,
+    "toggles_time": ProfileStage.PROFILE_TOGGLES,
+    "climate_time": ProfileStage.PROFILE_CLIMATE,
+    "sensors_time": ProfileStage.PROFILE_SENSORS,
+}
+
+# Link-quality counters and their sensor options
+LinkCounter = bestway_spa_ns.enum("LinkCounter")
+LINK_COUNTERS = {
+    "frames_received": LinkCounter.LINK_FRAMES_RX,
+    "frames_sent": LinkCounter.LINK_FRAMES_TX,
+    "checksum_errors": LinkCounter.LINK_CHECKSUM_ERRORS,
+    "bytes_discarded": LinkCounter.LINK_BYTES_DISCARDED,
+    "timeouts": LinkCounter.LINK_TIMEOUTS,
+    "bad_reads": LinkCounter.LINK_BAD_READS,
+}
+
+# Metered loads: (load, power option, default power, energy sensor option)
+EnergyLoad = bestway_spa_ns.enum("EnergyLoad")
+ENERGY_LOADS = [
+    (EnergyLoad.ENERGY_HEATER, "heater_power", "2000W", "heater_energy"),
+    (EnergyLoad.ENERGY_PUMP, "pump_power", "60W", "pump_energy"),
+    (EnergyLoad.ENERGY_BUBBLES, "bubbles_power", "800W", "bubbles_energy"),
+    (EnergyLoad.ENERGY_JETS, "jets_power", "600W", "jets_energy"),
+]
+
+# Actions
+DumpCaptureAction = bestway_spa_ns.class_("DumpCaptureAction", automation.Action)
+ApplyStateAction = bestway_spa_ns.class_("ApplyStateAction", automation.Action)
+StartHeatingPlanAction = bestway_spa_ns.class_("StartHeatingPlanAction", automation.Action)
+CancelHeatingPlanAction = bestway_spa_ns.class_("CancelHeatingPlanAction", automation.Action)
+
 # Switch classes
 BestwaySpaHeaterSwitch = bestway_spa_ns.class_("BestwaySpaHeaterSwitch", switch.Switch, cg.Component)
 BestwaySpaFilterSwitch = bestway_spa_ns.class_("BestwaySpaFilterSwitch", switch.Switch, cg.Component)
@@ -64,8 +137,33 @@ CONF_CLK_PIN = "clk_pin"
 CONF_DATA_PIN = "data_pin"
 CONF_CS_PIN = "cs_pin"
 CONF_AUDIO_PIN = "audio_pin"
+CONF_SPI = "spi"
+CONF_PASSIVE_MODE = "passive_mode"
+CONF_DETECT_TIMEOUT = "detect_timeout"
+CONF_SAVE_DETECTED = "save_detected"
+CONF_BUS_TASK = "bus_task"
+CONF_TEMPERATURE_DEADBAND = "temperature_deadband"
+CONF_TEMPERATURE_FILTER = "temperature_filter"
+CONF_WINDOW = "window"
+CONF_SMOOTHING = "smoothing"
+CONF_MAX_JUMP = "max_jump"
+CONF_HYSTERESIS = "hysteresis"
+CONF_HEARTBEAT_INTERVAL = "heartbeat_interval"
+CONF_RESTORE_STATE = "restore_state"
+CONF_RESTORE_TIMEOUT = "restore_timeout"
+CONF_PROFILING = "profiling"
+CONF_LINK_QUALITY = "link_quality"
+CONF_FRAME_PERIOD = "frame_period"
+CONF_CAPTURE_SIZE = "capture_size"
+CONF_ENERGY = "energy"
+CONF_SAVE_INTERVAL = "save_interval"
+CONF_TOTAL_ENERGY = "total_energy"
 CONF_CURRENT_TEMPERATURE = "current_temperature"
 CONF_TARGET_TEMPERATURE = "target_temperature"
+CONF_TIME_TO_TARGET = "time_to_target"
+CONF_HEATING_RATE = "heating_rate"
+CONF_COOLING_RATE = "cooling_rate"
+CONF_REPLY_LATENCY = "reply_latency"
 CONF_HEATING = "heating"
 CONF_FILTER = "filter"
 CONF_BUBBLES = "bubbles"
@@ -75,35 +173,209 @@ CONF_POWER = "power"
 CONF_ERROR = "error"
 CONF_ERROR_TEXT = "error_text"
 CONF_DISPLAY_TEXT = "display_text"
+CONF_HEATER = "heater"
+CONF_CELSIUS = "celsius"
+CONF_HEATING_PLAN = "heating_plan"
+CONF_DEFAULT_PRICE = "default_price"
+CONF_DEFAULT_HEATING_RATE = "default_heating_rate"
+CONF_PRICE_WINDOWS = "price_windows"
+CONF_START = "start"
+CONF_END = "end"
+CONF_PRICE = "price"
+CONF_DEADLINE = "deadline"
+
+PRICE_WINDOW_MAX = 8  # PRICE_WINDOW_MAX in bestway_codec.h
+
+# apply_state action fields and their setters
+APPLY_STATE_FIELDS = {
+    CONF_POWER: ("set_power", cv.boolean, cg.bool_),
+    CONF_HEATER: ("set_heater", cv.boolean, cg.bool_),
+    CONF_FILTER: ("set_filter", cv.boolean, cg.bool_),
+    CONF_BUBBLES: ("set_bubbles", cv.boolean, cg.bool_),
+    CONF_JETS: ("set_jets", cv.boolean, cg.bool_),
+    CONF_LOCKED: ("set_locked", cv.boolean, cg.bool_),
+    CONF_CELSIUS: ("set_celsius", cv.boolean, cg.bool_),
+    CONF_TARGET_TEMPERATURE: ("set_target_temperature", cv.float_, cg.float_),
+}
 
 
 def validate_6wire_pins(config):
     """Validate that 6-wire protocols have required pins configured."""
     protocol = config.get(CONF_PROTOCOL_TYPE, "4WIRE")
-    if protocol in ["6WIRE", "6WIRE_T1", "6WIRE_T2", "6WIRE_TYPE1", "6WIRE_TYPE2"]:
-        if CONF_CLK_PIN not in config:
+    if protocol == PROTOCOL_AUTO:
+        # Pins are optional; without them only 4-wire can be detected
+        if CONF_SPI in config:
+            raise cv.Invalid("spi cannot be combined with protocol_type AUTO")
+        if config.get(CONF_PASSIVE_MODE, False) and not all(
+            k in config for k in (CONF_CLK_PIN, CONF_DATA_PIN, CONF_CS_PIN)
+        ):
+            raise cv.Invalid("passive_mode with protocol_type AUTO needs clk_pin, data_pin and cs_pin")
+    elif protocol in ["6WIRE", "6WIRE_T1", "6WIRE_T2", "6WIRE_TYPE1", "6WIRE_TYPE2"]:
+        if CONF_SPI in config:
+            if config.get(CONF_PASSIVE_MODE, False):
+                raise cv.Invalid("spi cannot be combined with passive_mode")
+        elif CONF_CLK_PIN not in config:
             raise cv.Invalid("clk_pin is required for 6-wire protocols")
-        if CONF_DATA_PIN not in config:
+        elif CONF_DATA_PIN not in config:
             raise cv.Invalid("data_pin is required for 6-wire protocols")
-        if CONF_CS_PIN not in config:
+        elif CONF_CS_PIN not in config:
             raise cv.Invalid("cs_pin is required for 6-wire protocols")
+    elif config.get(CONF_PASSIVE_MODE, False):
+        raise cv.Invalid("passive_mode is only supported for 6-wire protocols")
+    elif CONF_SPI in config:
+        raise cv.Invalid("spi is only supported for 6-wire protocols")
+    if protocol not in ("4WIRE", PROTOCOL_AUTO) and CONF_REPLY_LATENCY in config:
+        raise cv.Invalid("reply_latency is only supported for the 4-wire protocol")
+    if config.get(CONF_BUS_TASK, False) and not CORE.is_esp32:
+        raise cv.Invalid("bus_task is only supported on ESP32")
     return config
 
 
+PROFILING_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+        **{
+            cv.Optional(key): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                device_class=DEVICE_CLASS_DURATION,
+                state_class=STATE_CLASS_MEASUREMENT,
+                accuracy_decimals=2,
+            )
+            for key in PROFILE_STAGES
+        },
+    }
+)
+
+
+LINK_QUALITY_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
+        **{
+            cv.Optional(key): sensor.sensor_schema(
+                state_class=STATE_CLASS_TOTAL_INCREASING,
+                accuracy_decimals=0,
+            )
+            for key in LINK_COUNTERS
+        },
+        cv.Optional(CONF_FRAME_PERIOD): sensor.sensor_schema(
+            unit_of_measurement=UNIT_MILLISECOND,
+            device_class=DEVICE_CLASS_DURATION,
+            state_class=STATE_CLASS_MEASUREMENT,
+            accuracy_decimals=1,
+        ),
+    }
+)
+
+
+ENERGY_SENSOR_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_KILOWATT_HOURS,
+    device_class=DEVICE_CLASS_ENERGY,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    accuracy_decimals=3,
+)
+
+ENERGY_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_SAVE_INTERVAL, default="15min"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_TOTAL_ENERGY): ENERGY_SENSOR_SCHEMA,
+        **{
+            cv.Optional(power_key, default=default): cv.power
+            for _, power_key, default, _ in ENERGY_LOADS
+        },
+        **{
+            cv.Optional(energy_key): ENERGY_SENSOR_SCHEMA
+            for _, _, _, energy_key in ENERGY_LOADS
+        },
+    }
+)
+
+
+# EMA weights the filter supports, as the shift used on the device
+TEMPERATURE_SMOOTHING = {1: 0, 2: 1, 4: 2, 8: 3, 16: 4}
+
+TEMPERATURE_FILTER_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_WINDOW, default=5): cv.int_range(min=1, max=7),
+        cv.Optional(CONF_SMOOTHING, default=4): cv.one_of(*TEMPERATURE_SMOOTHING, int=True),
+        cv.Optional(CONF_MAX_JUMP, default=3): cv.int_range(min=0, max=255),
+        cv.Optional(CONF_HYSTERESIS, default=0.1): cv.float_range(min=0.0, max=2.0),
+    }
+)
+
+
+def minute_of_day(value):
+    return value[CONF_HOUR] * 60 + value[CONF_MINUTE]
+
+
+HEATING_PLAN_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(CONF_TIME_ID): cv.use_id(time_.RealTimeClock),
+        cv.Optional(CONF_DEFAULT_PRICE, default=1.0): cv.positive_float,
+        # °C/h to plan with until a heating rate has been learned
+        cv.Optional(CONF_DEFAULT_HEATING_RATE, default=1.0): cv.float_range(min=0.1, max=10.0),
+        cv.Optional(CONF_PRICE_WINDOWS, default=[]): cv.All(
+            cv.ensure_list(
+                cv.Schema(
+                    {
+                        cv.Required(CONF_START): cv.time_of_day,
+                        cv.Required(CONF_END): cv.time_of_day,
+                        cv.Required(CONF_PRICE): cv.positive_float,
+                    }
+                )
+            ),
+            cv.Length(max=PRICE_WINDOW_MAX),
+        ),
+    }
+)
+
+
 CONFIG_SCHEMA = cv.All(
     climate.CLIMATE_SCHEMA.extend(
         {
             cv.GenerateID(): cv.declare_id(BestwaySpa),
 
             # Protocol configuration
-            cv.Optional(CONF_PROTOCOL_TYPE, default="4WIRE"): cv.enum(PROTOCOL_TYPES, upper=True),
+            cv.Optional(CONF_PROTOCOL_TYPE, default="4WIRE"): cv.Any(
+                cv.one_of(PROTOCOL_AUTO, upper=True), cv.enum(PROTOCOL_TYPES, upper=True)
+            ),
             cv.Optional(CONF_MODEL, default="54154"): cv.enum(SPA_MODELS, upper=True),
+            # protocol_type AUTO: how long to listen, and whether to keep the result
+            cv.Optional(CONF_DETECT_TIMEOUT, default="15s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_SAVE_DETECTED, default=True): cv.boolean,
 
             # 6-wire pin configuration
             cv.Optional(CONF_CLK_PIN): pins.gpio_output_pin_schema,
             cv.Optional(CONF_DATA_PIN): pins.internal_gpio_pin_schema,
             cv.Optional(CONF_CS_PIN): pins.gpio_output_pin_schema,
             cv.Optional(CONF_AUDIO_PIN): pins.gpio_output_pin_schema,
+            cv.Optional(CONF_PASSIVE_MODE, default=False): cv.boolean,
+
+            # Hardware SPI instead of bit-banging the 6-wire pins
+            cv.Optional(CONF_SPI): cv.Schema(
+                {cv.GenerateID(): cv.declare_id(SpiTransport)}
+            ).extend(spi.spi_device_schema(cs_pin_required=True)),
+
+            # Run the bus protocol in its own task on the other core (ESP32)
+            cv.Optional(CONF_BUS_TASK, default=False): cv.boolean,
+
+            # Publishing
+            cv.Optional(CONF_TEMPERATURE_DEADBAND, default=0.5): cv.positive_float,
+            cv.Optional(CONF_TEMPERATURE_FILTER, default={}): TEMPERATURE_FILTER_SCHEMA,
+            cv.Optional(CONF_HEARTBEAT_INTERVAL, default="5min"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_RESTORE_STATE, default=True): cv.boolean,
+            cv.Optional(CONF_RESTORE_TIMEOUT, default="30s"): cv.positive_time_period_milliseconds,
+
+            # Raw frame capture ring, compiled in only when configured
+            cv.Optional(CONF_CAPTURE_SIZE): cv.int_range(min=8, max=1024),
+
+            # Energy accounting, compiled in only when configured
+            cv.Optional(CONF_ENERGY): ENERGY_SCHEMA,
+
+            # Tariff-aware heating planner, compiled in only when configured
+            cv.Optional(CONF_HEATING_PLAN): HEATING_PLAN_SCHEMA,
+
+            # Loop profiling, compiled in only when configured
+            cv.Optional(CONF_PROFILING): PROFILING_SCHEMA,
 
             # Temperature sensors
             cv.Optional(CONF_CURRENT_TEMPERATURE): sensor.sensor_schema(
@@ -117,6 +389,36 @@ CONFIG_SCHEMA = cv.All(
                 accuracy_decimals=1,
             ),
 
+
+            # Learned heating model
+            cv.Optional(CONF_TIME_TO_TARGET): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MINUTE,
+                device_class=DEVICE_CLASS_DURATION,
+                state_class=STATE_CLASS_MEASUREMENT,
+                accuracy_decimals=0,
+            ),
+            cv.Optional(CONF_HEATING_RATE): sensor.sensor_schema(
+                unit_of_measurement="°C/h",
+                state_class=STATE_CLASS_MEASUREMENT,
+                accuracy_decimals=2,
+            ),
+            cv.Optional(CONF_COOLING_RATE): sensor.sensor_schema(
+                unit_of_measurement="°C/h",
+                state_class=STATE_CLASS_MEASUREMENT,
+                accuracy_decimals=2,
+            ),
+
+            # 4-wire link timing
+            cv.Optional(CONF_REPLY_LATENCY): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                device_class=DEVICE_CLASS_DURATION,
+                state_class=STATE_CLASS_MEASUREMENT,
+                accuracy_decimals=1,
+            ),
+
+            # Bus link-quality counters; always counted, sensors are optional
+            cv.Optional(CONF_LINK_QUALITY): LINK_QUALITY_SCHEMA,
+
             # Binary sensors
             cv.Optional(CONF_HEATING): binary_sensor.binary_sensor_schema(),
             cv.Optional(CONF_FILTER): binary_sensor.binary_sensor_schema(),
@@ -137,14 +439,52 @@ CONFIG_SCHEMA = cv.All(
 )
 
 
+def add_specialization_flags(config):
+    """Compile in only the protocols in use; pin protocol and model when every spa shares them."""
+    if config[CONF_PROTOCOL_TYPE] == PROTOCOL_AUTO:
+        # Any protocol may turn up, so all of them are compiled in
+        for flag in sorted(set(PROTOCOL_BUILD_FLAGS.values())):
+            cg.add_build_flag(f"-D{flag}")
+        cg.add_build_flag("-DUSE_BESTWAY_SPA_DETECT")
+    else:
+        cg.add_build_flag(f"-D{PROTOCOL_BUILD_FLAGS[config[CONF_PROTOCOL_TYPE]]}")
+
+    spas = [c for c in CORE.config.get("climate", []) if c.get(CONF_PLATFORM) == "bestway_spa"]
+    if any(c[CONF_PROTOCOL_TYPE] == PROTOCOL_AUTO for c in spas):
+        # Protocol and model are only known at run time
+        protocols = models = set()
+    else:
+        protocols = {str(PROTOCOL_TYPES[c[CONF_PROTOCOL_TYPE]]) for c in spas}
+        models = {str(SPA_MODELS[c[CONF_MODEL]]) for c in spas}
+    if len(protocols) == 1:
+        cg.add_build_flag(f"-DBESTWAY_SPA_FIXED_PROTOCOL={protocols.pop()}")
+    if len(models) == 1:
+        cg.add_build_flag(f"-DBESTWAY_SPA_FIXED_MODEL={models.pop()}")
+
+    # The capture ring size is a compile-time constant; the largest request wins
+    capture_sizes = [c[CONF_CAPTURE_SIZE] for c in spas if CONF_CAPTURE_SIZE in c]
+    if capture_sizes:
+        cg.add_build_flag("-DUSE_BESTWAY_SPA_CAPTURE")
+        cg.add_build_flag(f"-DBESTWAY_SPA_CAPTURE_SIZE={max(capture_sizes)}")
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
     await climate.register_climate(var, config)
     await uart.register_uart_device(var, config)
 
-    # Set protocol type
-    cg.add(var.set_protocol_type(config[CONF_PROTOCOL_TYPE]))
+    add_specialization_flags(config)
+
+    # Set protocol type; with AUTO the model's protocol is the fallback
+    protocol = config[CONF_PROTOCOL_TYPE]
+    if protocol == PROTOCOL_AUTO:
+        cg.add(var.set_protocol_type(PROTOCOL_TYPES[MODEL_PROTOCOLS.get(config[CONF_MODEL], "4WIRE")]))
+        cg.add(var.set_detect(True))
+        cg.add(var.set_detect_timeout(config[CONF_DETECT_TIMEOUT].total_milliseconds))
+        cg.add(var.set_save_detected(config[CONF_SAVE_DETECTED]))
+    else:
+        cg.add(var.set_protocol_type(PROTOCOL_TYPES[protocol]))
 
     # Set model
     cg.add(var.set_model(config[CONF_MODEL]))
@@ -166,6 +506,72 @@ async def to_code(config):
         pin = await cg.gpio_pin_expression(config[CONF_AUDIO_PIN])
         cg.add(var.set_audio_pin(pin))
 
+    if CONF_SPI in config:
+        cg.add_build_flag("-DUSE_BESTWAY_SPA_SPI")
+        transport = cg.new_Pvariable(config[CONF_SPI][CONF_ID])
+        await spi.register_spi_device(transport, config[CONF_SPI])
+        cg.add(var.set_transport(transport))
+
+    cg.add(var.set_passive_mode(config[CONF_PASSIVE_MODE]))
+
+    if config[CONF_BUS_TASK]:
+        cg.add_build_flag("-DUSE_BESTWAY_SPA_BUS_TASK")
+        cg.add(var.set_bus_task(True))
+
+    # Publishing
+    cg.add(var.set_temperature_deadband(config[CONF_TEMPERATURE_DEADBAND]))
+    temp_filter = config[CONF_TEMPERATURE_FILTER]
+    cg.add(
+        var.set_temperature_filter(
+            temp_filter[CONF_WINDOW],
+            TEMPERATURE_SMOOTHING[temp_filter[CONF_SMOOTHING]],
+            temp_filter[CONF_MAX_JUMP],
+            int(round(temp_filter[CONF_HYSTERESIS] * 256)),
+        )
+    )
+    cg.add(var.set_heartbeat_interval(config[CONF_HEARTBEAT_INTERVAL].total_milliseconds))
+    cg.add(var.set_restore_state(config[CONF_RESTORE_STATE]))
+    cg.add(var.set_restore_timeout(config[CONF_RESTORE_TIMEOUT].total_milliseconds))
+
+    # Energy accounting
+    if CONF_ENERGY in config:
+        energy = config[CONF_ENERGY]
+        cg.add_build_flag("-DUSE_BESTWAY_SPA_ENERGY")
+        cg.add(var.set_energy_save_interval(energy[CONF_SAVE_INTERVAL].total_milliseconds))
+        for load, power_key, _, energy_key in ENERGY_LOADS:
+            cg.add(var.set_load_power(load, int(round(energy[power_key]))))
+            if energy_key in energy:
+                sens = await sensor.new_sensor(energy[energy_key])
+                cg.add(var.set_energy_sensor(load, sens))
+        if CONF_TOTAL_ENERGY in energy:
+            sens = await sensor.new_sensor(energy[CONF_TOTAL_ENERGY])
+            cg.add(var.set_total_energy_sensor(sens))
+
+    # Heating planner
+    if CONF_HEATING_PLAN in config:
+        plan = config[CONF_HEATING_PLAN]
+        cg.add_build_flag("-DUSE_BESTWAY_SPA_PLANNER")
+        time_var = await cg.get_variable(plan[CONF_TIME_ID])
+        cg.add(var.set_time(time_var))
+        cg.add(var.set_default_price(plan[CONF_DEFAULT_PRICE]))
+        cg.add(var.set_default_heating_rate(plan[CONF_DEFAULT_HEATING_RATE]))
+        for window in plan[CONF_PRICE_WINDOWS]:
+            cg.add(
+                var.add_price_window(
+                    minute_of_day(window[CONF_START]), minute_of_day(window[CONF_END]), window[CONF_PRICE]
+                )
+            )
+
+    # Loop profiling
+    if CONF_PROFILING in config:
+        profiling = config[CONF_PROFILING]
+        cg.add_build_flag("-DUSE_BESTWAY_SPA_PROFILING")
+        cg.add(var.set_profile_interval(profiling[CONF_UPDATE_INTERVAL].total_milliseconds))
+        for key, stage in PROFILE_STAGES.items():
+            if key in profiling:
+                sens = await sensor.new_sensor(profiling[key])
+                cg.add(var.set_profile_sensor(stage, sens))
+
     # Register temperature sensors
     if CONF_CURRENT_TEMPERATURE in config:
         sens = await sensor.new_sensor(config[CONF_CURRENT_TEMPERATURE])
@@ -175,6 +581,33 @@ async def to_code(config):
         sens = await sensor.new_sensor(config[CONF_TARGET_TEMPERATURE])
         cg.add(var.set_target_temperature_sensor(sens))
 
+    if CONF_TIME_TO_TARGET in config:
+        sens = await sensor.new_sensor(config[CONF_TIME_TO_TARGET])
+        cg.add(var.set_time_to_target_sensor(sens))
+
+    if CONF_HEATING_RATE in config:
+        sens = await sensor.new_sensor(config[CONF_HEATING_RATE])
+        cg.add(var.set_heating_rate_sensor(sens))
+
+    if CONF_COOLING_RATE in config:
+        sens = await sensor.new_sensor(config[CONF_COOLING_RATE])
+        cg.add(var.set_cooling_rate_sensor(sens))
+
+    if CONF_REPLY_LATENCY in config:
+        sens = await sensor.new_sensor(config[CONF_REPLY_LATENCY])
+        cg.add(var.set_reply_latency_sensor(sens))
+
+    if CONF_LINK_QUALITY in config:
+        link_quality = config[CONF_LINK_QUALITY]
+        cg.add(var.set_link_interval(link_quality[CONF_UPDATE_INTERVAL].total_milliseconds))
+        for key, counter in LINK_COUNTERS.items():
+            if key in link_quality:
+                sens = await sensor.new_sensor(link_quality[key])
+                cg.add(var.set_link_sensor(counter, sens))
+        if CONF_FRAME_PERIOD in link_quality:
+            sens = await sensor.new_sensor(link_quality[CONF_FRAME_PERIOD])
+            cg.add(var.set_frame_period_sensor(sens))
+
     # Register binary sensors
     if CONF_HEATING in config:
         sens = await binary_sensor.new_binary_sensor(config[CONF_HEATING])
@@ -214,6 +647,92 @@ async def to_code(config):
         cg.add(var.set_display_text_sensor(sens))
 
 
+# =============================================================================
+# ACTIONS
+# =============================================================================
+
+@automation.register_action(
+    "bestway_spa.dump_capture",
+    DumpCaptureAction,
+    cv.Schema({cv.GenerateID(): cv.use_id(BestwaySpa)}),
+)
+async def dump_capture_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    parent = await cg.get_variable(config[CONF_ID])
+    cg.add(var.set_parent(parent))
+    return var
+
+
+@automation.register_action(
+    "bestway_spa.apply_state",
+    ApplyStateAction,
+    cv.All(
+        cv.Schema(
+            {
+                cv.GenerateID(): cv.use_id(BestwaySpa),
+                **{
+                    cv.Optional(key): cv.templatable(validator)
+                    for key, (_, validator, _) in APPLY_STATE_FIELDS.items()
+                },
+            }
+        ),
+        cv.has_at_least_one_key(*APPLY_STATE_FIELDS),
+    ),
+)
+async def apply_state_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    parent = await cg.get_variable(config[CONF_ID])
+    cg.add(var.set_parent(parent))
+    for key, (setter, _, type_) in APPLY_STATE_FIELDS.items():
+        if key in config:
+            value = await cg.templatable(config[key], args, type_)
+            cg.add(getattr(var, setter)(value))
+    return var
+
+
+def validate_heating_plan_action(config):
+    spas = [c for c in CORE.config.get("climate", []) if c.get(CONF_PLATFORM) == "bestway_spa"]
+    if not any(CONF_HEATING_PLAN in c for c in spas):
+        raise cv.Invalid("heating plan actions need heating_plan configured on the spa")
+    return config
+
+
+@automation.register_action(
+    "bestway_spa.start_heating_plan",
+    StartHeatingPlanAction,
+    cv.All(
+        cv.Schema(
+            {
+                cv.GenerateID(): cv.use_id(BestwaySpa),
+                cv.Required(CONF_TARGET_TEMPERATURE): cv.templatable(cv.float_),
+                cv.Required(CONF_DEADLINE): cv.time_of_day,
+            }
+        ),
+        validate_heating_plan_action,
+    ),
+)
+async def start_heating_plan_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    parent = await cg.get_variable(config[CONF_ID])
+    cg.add(var.set_parent(parent))
+    target = await cg.templatable(config[CONF_TARGET_TEMPERATURE], args, cg.float_)
+    cg.add(var.set_target_temperature(target))
+    cg.add(var.set_deadline(minute_of_day(config[CONF_DEADLINE])))
+    return var
+
+
+@automation.register_action(
+    "bestway_spa.cancel_heating_plan",
+    CancelHeatingPlanAction,
+    cv.All(cv.Schema({cv.GenerateID(): cv.use_id(BestwaySpa)}), validate_heating_plan_action),
+)
+async def cancel_heating_plan_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    parent = await cg.get_variable(config[CONF_ID])
+    cg.add(var.set_parent(parent))
+    return var
+
+
 # =============================================================================
 # SWITCH PLATFORMS
 # =============================================================================
@@ -0,0 +1,684 @@
+#include "bestway_codec.h"
+
+#include <cstring>
+
+namespace esphome {
+namespace bestway_spa {
+
+// =============================================================================
+// TABLES
+// =============================================================================
+
+constexpr uint8_t CHARCODES_TYPE1[CHARCODE_COUNT] = {
+  0x7F, 0x0D, 0xB7, 0x9F, 0xCD, 0xDB, 0xFB, 0x0F, 0xFF, 0xDF,  // 0-9
+  0xEF, 0xF9, 0x73, 0xBD, 0xF3, 0xE3, 0x7B, 0xE9, 0x09, 0x3D,  // A-J
+  0xE1, 0x71, 0x49, 0xA9, 0xB9, 0xE7, 0xCF, 0xA1, 0xDB, 0xF1,  // K-T
+  0x7D, 0x7D, 0x7D, 0xED, 0xDD, 0xB7, 0x00, 0x80              // U-Z, space, dash
+};
+
+constexpr uint8_t CHARCODES_TYPE2[CHARCODE_COUNT] = {
+  0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F,  // 0-9
+  0x77, 0x7C, 0x39, 0x5E, 0x79, 0x71, 0x3D, 0x76, 0x06, 0x0E,  // A-J
+  0x70, 0x38, 0x15, 0x54, 0x5C, 0x73, 0x67, 0x50, 0x6D, 0x78,  // K-T
+  0x3E, 0x3E, 0x3E, 0x76, 0x6E, 0x5B, 0x00, 0x40              // U-Z, space, dash
+};
+
+constexpr char CHARS[CHARCODE_COUNT + 1] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ -";
+
+// Reverse 7-segment tables, one entry per possible segment byte
+struct SegmentLookup {
+  char chars[256];
+};
+
+constexpr SegmentLookup build_segment_lookup(const uint8_t (&codes)[CHARCODE_COUNT]) {
+  SegmentLookup lut{};
+  for (size_t i = 0; i < 256; i++) {
+    lut.chars[i] = '?';  // Unknown segment pattern
+  }
+  // Walk backwards so the first character wins where patterns repeat (5/S, U/V/W)
+  for (size_t i = CHARCODE_COUNT; i-- > 0;) {
+    lut.chars[codes[i]] = CHARS[i];
+  }
+  return lut;
+}
+
+static constexpr SegmentLookup SEGMENT_LOOKUP_TYPE1 = build_segment_lookup(CHARCODES_TYPE1);
+static constexpr SegmentLookup SEGMENT_LOOKUP_TYPE2 = build_segment_lookup(CHARCODES_TYPE2);
+
+static_assert(SEGMENT_LOOKUP_TYPE1.chars[0xDB] == '5', "first match must win");
+static_assert(SEGMENT_LOOKUP_TYPE2.chars[0x3F] == '0', "TYPE2 lookup");
+
+#ifdef USE_BESTWAY_SPA_6WIRE_T1
+// Button codes for PRE2021 (6-wire TYPE1)
+const uint16_t BTN_CODES_PRE2021[BTN_COUNT] = {
+  0x1B1B, 0x0200, 0x0100, 0x0300, 0x1012, 0x1212, 0x1112, 0x1312, 0x0809, 0x0000, 0x0000
+};
+
+// Button codes for P05504 (6-wire TYPE1 variant)
+const uint16_t BTN_CODES_P05504[BTN_COUNT] = {
+  0x1B1B, 0x0210, 0x0110, 0x0310, 0x1022, 0x1222, 0x1122, 0x1322, 0x081A, 0x0000, 0x0000
+};
+#endif
+
+#ifdef USE_BESTWAY_SPA_6WIRE_T2
+// Button codes for MODEL54149E (6-wire TYPE2)
+const uint16_t BTN_CODES_54149E[BTN_COUNT] = {
+  0x0000, 0x0080, 0x0040, 0x0020, 0x0010, 0x0008, 0x0004, 0x0002, 0x0001, 0x0100, 0x0200
+};
+#endif
+
+// Model configurations
+const ModelConfig4W CONFIG_54123 = {0x02, 0x08, 0x04, 0x10, 0x00, false, false};
+const ModelConfig4W CONFIG_54138 = {0x30, 0x40, 0x04, 0x08, 0x80, true, true};
+const ModelConfig4W CONFIG_54144 = {0x30, 0x40, 0x04, 0x08, 0x80, true, false};
+const ModelConfig4W CONFIG_54154 = {0x02, 0x08, 0x04, 0x10, 0x00, false, false};
+const ModelConfig4W CONFIG_54173 = {0x30, 0x40, 0x04, 0x08, 0x80, true, true};
+
+// =============================================================================
+// MODEL LOOKUPS
+// =============================================================================
+
+const ModelConfig4W *get_model_config_4w(SpaModel model) {
+  switch (model) {
+    case MODEL_54123:
+      return &CONFIG_54123;
+    case MODEL_54138:
+      return &CONFIG_54138;
+    case MODEL_54144:
+      return &CONFIG_54144;
+    case MODEL_54154:
+      return &CONFIG_54154;
+    case MODEL_54173:
+      return &CONFIG_54173;
+    default:
+      return &CONFIG_54154;
+  }
+}
+
+const uint16_t *get_button_codes(SpaModel model) {
+  // Only the tables for compiled-in protocols are referenced
+#ifdef USE_BESTWAY_SPA_6WIRE_T2
+  if (model == MODEL_54149E)
+    return BTN_CODES_54149E;
+#endif
+#ifdef USE_BESTWAY_SPA_6WIRE_T1
+  if (model == MODEL_P05504)
+    return BTN_CODES_P05504;
+  return BTN_CODES_PRE2021;
+#elif defined(USE_BESTWAY_SPA_6WIRE_T2)
+  return BTN_CODES_54149E;
+#else
+  (void) model;
+  return nullptr;  // 4-wire has no button codes
+#endif
+}
+
+const char *model_name(SpaModel model) {
+  switch (model) {
+    case MODEL_PRE2021:
+      return "PRE2021";
+    case MODEL_54149E:
+      return "54149E";
+    case MODEL_54123:
+      return "54123";
+    case MODEL_54138:
+      return "54138";
+    case MODEL_54144:
+      return "54144";
+    case MODEL_54154:
+      return "54154";
+    case MODEL_54173:
+      return "54173";
+    case MODEL_P05504:
+      return "P05504";
+    default:
+      return "unknown";
+  }
+}
+
+// =============================================================================
+// 4-WIRE FRAMES
+// =============================================================================
+
+uint8_t calculate_checksum(const uint8_t *data, size_t len) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < len; i++) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+FrameCheck check_4wire_frame(const FrameView &frame) {
+  if (frame.size() < FRAME_4W_LEN || frame[0] != FRAME_4W_MARKER || frame[FRAME_4W_LEN - 1] != FRAME_4W_MARKER) {
+    return FRAME_BAD_MARKER;
+  }
+  if (calculate_checksum(frame.data + 1, 4) != frame[5]) {
+    return FRAME_BAD_CHECKSUM;
+  }
+  return FRAME_OK;
+}
+
+size_t find_4wire_resync(const uint8_t *data, size_t len) {
+  // Skip to the next candidate start marker, always dropping at least one byte
+  size_t skip = 1;
+  while (skip < len && data[skip] != FRAME_4W_MARKER) {
+    skip++;
+  }
+  return skip;
+}
+
+void decode_4wire_frame(const FrameView &frame, const ModelConfig4W &config, CioStatus4W *out) {
+  out->command = frame[1];
+  out->temperature = frame[2];
+  out->error_code = frame[3];
+
+  out->filter_pump = (out->command & config.pump_bitmask) != 0;
+  out->bubbles = (out->command & config.bubbles_bitmask) != 0;
+  out->jets = config.has_jets && (out->command & config.jets_bitmask) != 0;
+  out->heater_red = (out->command & (config.heat_bitmask1 | config.heat_bitmask2)) != 0;
+}
+
+void encode_4wire_response(const CioCommand4W &cmd, const ModelConfig4W &config, uint8_t out[FRAME_4W_LEN]) {
+  uint8_t command = 0;
+  if (cmd.heater_stage >= 1) {
+    command |= config.heat_bitmask1;
+  }
+  if (cmd.heater_stage >= 2) {
+    command |= config.heat_bitmask2;
+  }
+  if (cmd.filter_pump) {
+    command |= config.pump_bitmask;
+  }
+  if (cmd.bubbles) {
+    command |= config.bubbles_bitmask;
+  }
+  if (config.has_jets && cmd.jets) {
+    command |= config.jets_bitmask;
+  }
+
+  out[0] = FRAME_4W_MARKER;
+  out[1] = command;
+  out[2] = cmd.target_temp;
+  out[3] = 0x00;  // Reserved
+  out[4] = 0x00;  // Reserved
+  out[5] = calculate_checksum(out + 1, 4);
+  out[6] = FRAME_4W_MARKER;
+}
+
+void encode_4wire_status(const CioStatus4W &status, const ModelConfig4W &config, uint8_t out[FRAME_4W_LEN]) {
+  uint8_t command = 0;
+  if (status.heater_red) {
+    command |= config.heat_bitmask1 | config.heat_bitmask2;
+  }
+  if (status.filter_pump) {
+    command |= config.pump_bitmask;
+  }
+  if (status.bubbles) {
+    command |= config.bubbles_bitmask;
+  }
+  if (config.has_jets && status.jets) {
+    command |= config.jets_bitmask;
+  }
+
+  out[0] = FRAME_4W_MARKER;
+  out[1] = command;
+  out[2] = status.temperature;
+  out[3] = status.error_code;
+  out[4] = 0x00;  // Reserved
+  out[5] = calculate_checksum(out + 1, 4);
+  out[6] = FRAME_4W_MARKER;
+}
+
+// =============================================================================
+// 6-WIRE PAYLOADS
+// =============================================================================
+
+void decode_display_status(const uint8_t *payload, bool is_type1, DisplayStatus *out) {
+  if (is_type1) {
+    out->locked = (payload[T1_LOCK_IDX] >> T1_LOCK_BIT) & 0x01;
+    out->timer = (payload[T1_TIMER_IDX] >> T1_TIMER_BIT) & 0x01;
+    out->heater_green = (payload[T1_HEATGRN_IDX] >> T1_HEATGRN_BIT) & 0x01;
+    out->heater_red = (payload[T1_HEATRED_IDX] >> T1_HEATRED_BIT) & 0x01;
+    out->bubbles = (payload[T1_AIR_IDX] >> T1_AIR_BIT) & 0x01;
+    out->filter_pump = (payload[T1_FILTER_IDX] >> T1_FILTER_BIT) & 0x01;
+    out->celsius = (payload[T1_C_IDX] >> T1_C_BIT) & 0x01;
+    out->fahrenheit = (payload[T1_F_IDX] >> T1_F_BIT) & 0x01;
+    out->power = (payload[T1_POWER_IDX] >> T1_POWER_BIT) & 0x01;
+    out->jets = (payload[T1_JETS_IDX] >> T1_JETS_BIT) & 0x01;
+  } else {
+    out->locked = (payload[T2_LOCK_IDX] >> T2_LOCK_BIT) & 0x01;
+    out->timer = (payload[T2_TIMER_IDX] >> T2_TIMER_BIT) & 0x01;
+    out->heater_green = (payload[T2_HEATGRN_IDX] >> T2_HEATGRN_BIT) & 0x01;
+    out->heater_red = (payload[T2_HEATRED_IDX] >> T2_HEATRED_BIT) & 0x01;
+    out->bubbles = (payload[T2_AIR_IDX] >> T2_AIR_BIT) & 0x01;
+    out->filter_pump = (payload[T2_FILTER_IDX] >> T2_FILTER_BIT) & 0x01;
+    out->celsius = (payload[T2_C_IDX] >> T2_C_BIT) & 0x01;
+    out->fahrenheit = (payload[T2_F_IDX] >> T2_F_BIT) & 0x01;
+    out->power = (payload[T2_POWER_IDX] >> T2_POWER_BIT) & 0x01;
+    out->jets = (payload[T2_JETS_IDX] >> T2_JETS_BIT) & 0x01;
+  }
+}
+
+void encode_display_payload(const DisplayStatus &status, const char *digits, bool is_type1, uint8_t *payload) {
+  if (is_type1) {
+    for (size_t i = 1; i < T1_PAYLOAD_LEN; i++) {
+      payload[i] = 0x00;
+    }
+    payload[T1_DGT1_IDX] = encode_7segment(digits[0], true);
+    payload[T1_DGT2_IDX] = encode_7segment(digits[1], true);
+    payload[T1_DGT3_IDX] = encode_7segment(digits[2], true);
+    payload[T1_LOCK_IDX] |= (status.locked ? 1 : 0) << T1_LOCK_BIT;
+    payload[T1_TIMER_IDX] |= (status.timer ? 1 : 0) << T1_TIMER_BIT;
+    payload[T1_HEATGRN_IDX] |= (status.heater_green ? 1 : 0) << T1_HEATGRN_BIT;
+    payload[T1_HEATRED_IDX] |= (status.heater_red ? 1 : 0) << T1_HEATRED_BIT;
+    payload[T1_AIR_IDX] |= (status.bubbles ? 1 : 0) << T1_AIR_BIT;
+    payload[T1_FILTER_IDX] |= (status.filter_pump ? 1 : 0) << T1_FILTER_BIT;
+    payload[T1_C_IDX] |= (status.celsius ? 1 : 0) << T1_C_BIT;
+    payload[T1_F_IDX] |= (status.fahrenheit ? 1 : 0) << T1_F_BIT;
+    payload[T1_POWER_IDX] |= (status.power ? 1 : 0) << T1_POWER_BIT;
+    payload[T1_JETS_IDX] |= (status.jets ? 1 : 0) << T1_JETS_BIT;
+  } else {
+    for (size_t i = 0; i < T2_PAYLOAD_LEN; i++) {
+      payload[i] = 0x00;
+    }
+    payload[T2_DGT1_IDX] = encode_7segment(digits[0], false);
+    payload[T2_DGT2_IDX] = encode_7segment(digits[1], false);
+    payload[T2_DGT3_IDX] = encode_7segment(digits[2], false);
+    payload[T2_LOCK_IDX] |= (status.locked ? 1 : 0) << T2_LOCK_BIT;
+    payload[T2_TIMER_IDX] |= (status.timer ? 1 : 0) << T2_TIMER_BIT;
+    payload[T2_HEATGRN_IDX] |= (status.heater_green ? 1 : 0) << T2_HEATGRN_BIT;
+    payload[T2_HEATRED_IDX] |= (status.heater_red ? 1 : 0) << T2_HEATRED_BIT;
+    payload[T2_AIR_IDX] |= (status.bubbles ? 1 : 0) << T2_AIR_BIT;
+    payload[T2_FILTER_IDX] |= (status.filter_pump ? 1 : 0) << T2_FILTER_BIT;
+    payload[T2_C_IDX] |= (status.celsius ? 1 : 0) << T2_C_BIT;
+    payload[T2_F_IDX] |= (status.fahrenheit ? 1 : 0) << T2_F_BIT;
+    payload[T2_POWER_IDX] |= (status.power ? 1 : 0) << T2_POWER_BIT;
+    payload[T2_JETS_IDX] |= (status.jets ? 1 : 0) << T2_JETS_BIT;
+  }
+}
+
+Buttons decode_button_code(const uint16_t *codes, uint16_t code) {
+  if (code == 0x0000) {
+    return NOBTN;
+  }
+  for (uint8_t i = NOBTN + 1; i < BTN_COUNT; i++) {
+    if (codes[i] == code) {
+      return static_cast<Buttons>(i);
+    }
+  }
+  return NOBTN;
+}
+
+char decode_7segment(uint8_t segments, bool is_type1) {
+  return is_type1 ? SEGMENT_LOOKUP_TYPE1.chars[segments] : SEGMENT_LOOKUP_TYPE2.chars[segments];
+}
+
+void decode_display_digits(const uint8_t *payload, bool is_type1, char out[3]) {
+  if (is_type1) {
+    out[0] = SEGMENT_LOOKUP_TYPE1.chars[payload[T1_DGT1_IDX]];
+    out[1] = SEGMENT_LOOKUP_TYPE1.chars[payload[T1_DGT2_IDX]];
+    out[2] = SEGMENT_LOOKUP_TYPE1.chars[payload[T1_DGT3_IDX]];
+  } else {
+    out[0] = SEGMENT_LOOKUP_TYPE2.chars[payload[T2_DGT1_IDX]];
+    out[1] = SEGMENT_LOOKUP_TYPE2.chars[payload[T2_DGT2_IDX]];
+    out[2] = SEGMENT_LOOKUP_TYPE2.chars[payload[T2_DGT3_IDX]];
+  }
+}
+
+uint8_t encode_7segment(char c, bool is_type1) {
+  const uint8_t *codes = is_type1 ? CHARCODES_TYPE1 : CHARCODES_TYPE2;
+
+  if (c >= 'a' && c <= 'z') {
+    c = c - 'a' + 'A';
+  }
+  for (size_t i = 0; i < CHARCODE_COUNT; i++) {
+    if (CHARS[i] == c) {
+      return codes[i];
+    }
+  }
+  return 0x00;  // Blank for anything we cannot draw
+}
+
+// =============================================================================
+// TEMPERATURE FILTER
+// =============================================================================
+
+void TempFilter::configure(const TempFilterConfig &config) {
+  config_ = config;
+  if (config_.window < 1) config_.window = 1;
+  if (config_.window > WINDOW_MAX) config_.window = WINDOW_MAX;
+  if (config_.ema_shift > EMA_SHIFT_MAX) config_.ema_shift = EMA_SHIFT_MAX;
+  reset();
+}
+
+void TempFilter::reset() {
+  head_ = 0;
+  count_ = 0;
+  outliers_ = 0;
+}
+
+void TempFilter::seed_(int16_t raw) {
+  history_[0] = raw;
+  head_ = 1 % config_.window;
+  count_ = 1;
+  outliers_ = 0;
+  ema_ = raw * SCALE;
+  out_ = raw;
+}
+
+int16_t TempFilter::median_() const {
+  // At most seven values: an insertion sort on a copy is the cheapest way
+  int16_t sorted[WINDOW_MAX];
+  for (uint8_t i = 0; i < count_; i++) {
+    int16_t v = history_[i];
+    uint8_t j = i;
+    for (; j > 0 && sorted[j - 1] > v; j--) sorted[j] = sorted[j - 1];
+    sorted[j] = v;
+  }
+  return sorted[count_ / 2];
+}
+
+bool TempFilter::push(int16_t raw) {
+  if (count_ == 0) {
+    seed_(raw);
+    return true;
+  }
+
+  if (config_.max_jump > 0) {
+    int32_t jump = raw - median_();
+    if (jump > config_.max_jump || jump < -config_.max_jump) {
+      rejected_++;
+      if (++outliers_ < config_.window) return false;
+      int16_t old = out_;
+      seed_(raw);
+      return out_ != old;
+    }
+  }
+  outliers_ = 0;
+
+  history_[head_] = raw;
+  head_ = (head_ + 1) % config_.window;
+  if (count_ < config_.window) count_++;
+
+  // Division rather than >> keeps the EMA symmetric for falling readings
+  ema_ += (median_() * SCALE - ema_) / (1 << config_.ema_shift);
+
+  int32_t delta = ema_ - out_ * SCALE;
+  int32_t threshold = SCALE / 2 + config_.hysteresis;
+  if (delta < threshold && delta > -threshold) return false;
+  int16_t next = (int16_t) ((ema_ + (ema_ >= 0 ? SCALE / 2 : -SCALE / 2)) / SCALE);
+  if (next == out_) return false;
+  out_ = next;
+  return true;
+}
+
+// =============================================================================
+// HEATING RATE MODEL
+// =============================================================================
+
+void HeatRateModel::sample(uint32_t now_ms, float temp, RateCondition cond) {
+  if (cond != cond_ || (cond_ != RATE_NONE && now_ms - start_ms_ > MAX_SEGMENT_S * 1000)) {
+    end_segment();
+    cond_ = cond;
+    start_ms_ = now_ms;
+  }
+  if (cond_ == RATE_NONE) return;
+  fit_.add((int32_t) ((now_ms - start_ms_) / 1000), (int32_t) (temp * TEMP_SCALE));
+}
+
+bool HeatRateModel::segment_rate_(int32_t *out) const {
+  // Need enough samples, and enough movement to see past the 1-degree steps
+  if (cond_ == RATE_NONE || fit_.n < MIN_SAMPLES || fit_.y_max - fit_.y_min < MIN_RISE) return false;
+  // y/s -> centidegrees/h
+  if (!fit_.slope(3600 * 100, TEMP_SCALE, out)) return false;
+  // Heating that does not raise the temperature is a reading glitch, not a rate
+  return cond_ != RATE_HEATING || *out > 0;
+}
+
+void HeatRateModel::end_segment() {
+  int32_t r;
+  if (segment_rate_(&r)) {
+    if (!valid_[cond_]) {
+      rate_[cond_] = r;
+      valid_[cond_] = true;
+    } else {
+      rate_[cond_] += (r - rate_[cond_]) / 4;
+    }
+  }
+  fit_.clear();
+  cond_ = RATE_NONE;
+}
+
+void HeatRateModel::reset() {
+  fit_.clear();
+  cond_ = RATE_NONE;
+  for (uint8_t i = 0; i < RATE_CONDITION_COUNT; i++) {
+    rate_[i] = 0;
+    valid_[i] = false;
+  }
+}
+
+int32_t HeatRateModel::minutes_to_target(float current, float target) const {
+  if (current >= target) return 0;
+  // Prefer the learned average; fall back to the heating run in progress
+  int32_t r = 0;
+  if (!(cond_ == RATE_HEATING && !valid_[RATE_HEATING] && segment_rate_(&r))) {
+    r = rate(RATE_HEATING);
+  }
+  if (r <= 0) return -1;
+  return (int32_t) ((target - current) * 100.0f * 60.0f / r + 0.5f);
+}
+
+// =============================================================================
+// TARIFF PLANNER
+// =============================================================================
+
+static const uint16_t MINUTES_PER_DAY = 24 * 60;
+
+float price_at(const PriceWindow *windows, size_t count, float default_price, uint16_t minute) {
+  for (size_t i = 0; i < count; i++) {
+    const PriceWindow &w = windows[i];
+    bool inside = w.start_minute <= w.end_minute ? (minute >= w.start_minute && minute < w.end_minute)
+                                                 : (minute >= w.start_minute || minute < w.end_minute);
+    if (inside) return w.price;
+  }
+  return default_price;
+}
+
+size_t heat_slots_needed(int32_t deficit, int32_t heat_rate, int32_t idle_rate, size_t slots) {
+  // k heated and (slots - k) idle slots of a quarter hour each gain
+  // (k * heat + (slots - k) * idle) / 4; solve for the smallest k
+  int64_t per_slot = (int64_t) heat_rate - idle_rate;
+  if (per_slot <= 0) return slots + 1;
+  int64_t needed = 4 * (int64_t) deficit - (int64_t) slots * idle_rate;
+  if (needed <= 0) return 0;
+  int64_t k = (needed + per_slot - 1) / per_slot;
+  return k > (int64_t) slots ? slots + 1 : (size_t) k;
+}
+
+void plan_cheapest_slots(const PriceWindow *windows, size_t count, float default_price, uint16_t start_minute,
+                         size_t slots, size_t heat, bool *out) {
+  float prices[PLAN_MAX_SLOTS];
+  if (slots > PLAN_MAX_SLOTS) slots = PLAN_MAX_SLOTS;
+  for (size_t i = 0; i < slots; i++) {
+    prices[i] = price_at(windows, count, default_price, (start_minute + i * PLAN_SLOT_MINUTES) % MINUTES_PER_DAY);
+    out[i] = false;
+  }
+  // Selection of the cheapest; at most a day of slots so O(n * heat) is fine
+  for (size_t n = 0; n < heat && n < slots; n++) {
+    size_t best = slots;
+    for (size_t i = slots; i-- > 0;) {
+      if (!out[i] && (best == slots || prices[i] < prices[best])) best = i;
+    }
+    out[best] = true;
+  }
+}
+
+// =============================================================================
+// PROTOCOL DETECTION
+// =============================================================================
+
+static uint8_t command_mask(const ModelConfig4W &config) {
+  return config.heat_bitmask1 | config.heat_bitmask2 | config.pump_bitmask | config.bubbles_bitmask |
+         config.jets_bitmask;
+}
+
+// Command bits only the 54154 family (54123/54154) or only the 54144
+// family (54138/54144/54173) uses
+static const uint8_t FAMILY_54154_BITS = command_mask(CONFIG_54154) & ~command_mask(CONFIG_54144);
+static const uint8_t FAMILY_54144_BITS = command_mask(CONFIG_54144) & ~command_mask(CONFIG_54154);
+
+static bool in_family_54154(SpaModel model) { return model == MODEL_54123 || model == MODEL_54154; }
+static bool in_family_54144(SpaModel model) {
+  return model == MODEL_54138 || model == MODEL_54144 || model == MODEL_54173;
+}
+
+void ProtocolDetector::feed_uart(const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (window_len_ == 0 && data[i] != FRAME_4W_MARKER) continue;
+    window_[window_len_++] = data[i];
+    if (window_len_ < FRAME_4W_LEN) continue;
+
+    FrameView frame{window_, FRAME_4W_LEN};
+    if (check_4wire_frame(frame) == FRAME_OK) {
+      frames_4w_++;
+      command_bits_ |= window_[1];
+      window_len_ = 0;
+      continue;
+    }
+    // Resync on the next marker inside the window
+    size_t skip = find_4wire_resync(window_, window_len_);
+    memmove(window_, window_ + skip, window_len_ - skip);
+    window_len_ -= skip;
+  }
+}
+
+void ProtocolDetector::feed_6wire_frame(const uint8_t *frame, size_t len) {
+  if (len == T1_PAYLOAD_LEN) {
+    frames_t1_++;
+    if (frame[0] == DSP_CMD1_MODE6_11_7) seen_pre2021_ = true;
+    if (frame[0] == DSP_CMD1_MODE6_11_7_P05504) seen_p05504_ = true;
+  } else if (len == 4 && frame[1] == DSP_CMD2_DATAREAD) {
+    frames_t1_++;
+#ifdef USE_BESTWAY_SPA_6WIRE_T1
+    uint16_t code = (frame[2] << 8) | frame[3];
+    bool pre2021 = decode_button_code(BTN_CODES_PRE2021, code) != NOBTN;
+    bool p05504 = decode_button_code(BTN_CODES_P05504, code) != NOBTN;
+    if (pre2021 != p05504) {
+      seen_pre2021_ |= pre2021;
+      seen_p05504_ |= p05504;
+    }
+#endif
+  } else if ((len == T2_PAYLOAD_LEN + 1 && frame[0] == TYPE2_CMD1) || (len == 3 && frame[0] == TYPE2_CMD2)) {
+    frames_t2_++;
+  }
+}
+
+bool ProtocolDetector::protocol_known() const {
+  return frames_4w_ >= FRAMES_NEEDED || frames_t1_ >= FRAMES_NEEDED || frames_t2_ >= FRAMES_NEEDED;
+}
+
+ProtocolType ProtocolDetector::protocol() const {
+  // Whichever protocol produced the most frames; stray matches of the
+  // others on a floating line stay well behind
+  if (frames_4w_ >= frames_t1_ && frames_4w_ >= frames_t2_) return PROTOCOL_4WIRE;
+  return frames_t1_ >= frames_t2_ ? PROTOCOL_6WIRE_T1 : PROTOCOL_6WIRE_T2;
+}
+
+bool ProtocolDetector::model_known() const {
+  if (!protocol_known()) return false;
+  switch (protocol()) {
+    case PROTOCOL_4WIRE:
+      return ((command_bits_ & FAMILY_54154_BITS) != 0) != ((command_bits_ & FAMILY_54144_BITS) != 0);
+    case PROTOCOL_6WIRE_T1:
+      return seen_pre2021_ != seen_p05504_;
+    default:
+      return true;  // 54149E is the only TYPE2 model
+  }
+}
+
+SpaModel ProtocolDetector::model(SpaModel hint) const {
+  switch (protocol()) {
+    case PROTOCOL_4WIRE: {
+      bool family_54154 = (command_bits_ & FAMILY_54154_BITS) != 0;
+      bool family_54144 = (command_bits_ & FAMILY_54144_BITS) != 0;
+      // Within a family the bitmasks are the same; keep the hint if it fits
+      if (family_54144 && !family_54154) return in_family_54144(hint) ? hint : MODEL_54144;
+      if (family_54154 && !family_54144) return in_family_54154(hint) ? hint : MODEL_54154;
+      return model_protocol(hint) == PROTOCOL_4WIRE ? hint : MODEL_54154;
+    }
+    case PROTOCOL_6WIRE_T1:
+      if (seen_p05504_ && !seen_pre2021_) return MODEL_P05504;
+      if (seen_pre2021_ && !seen_p05504_) return MODEL_PRE2021;
+      return model_protocol(hint) == PROTOCOL_6WIRE_T1 ? hint : MODEL_PRE2021;
+    default:
+      return MODEL_54149E;
+  }
+}
+
+// =============================================================================
+// CAPTURE DUMPS
+// =============================================================================
+
+void encode_capture_header(ProtocolType protocol, SpaModel model, uint8_t out[CAPTURE_HEADER_LEN]) {
+  out[0] = 'B';
+  out[1] = 'W';
+  out[2] = 'C';
+  out[3] = CAPTURE_VERSION;
+  out[4] = (uint8_t) protocol;
+  out[5] = (uint8_t) model;
+}
+
+size_t decode_capture_header(const uint8_t *in, size_t len, ProtocolType *protocol, SpaModel *model) {
+  if (len < CAPTURE_HEADER_LEN || in[0] != 'B' || in[1] != 'W' || in[2] != 'C' || in[3] != CAPTURE_VERSION) {
+    return 0;
+  }
+  if (in[4] > PROTOCOL_6WIRE_T2 || in[5] > MODEL_UNKNOWN) {
+    return 0;
+  }
+  *protocol = (ProtocolType) in[4];
+  *model = (SpaModel) in[5];
+  return CAPTURE_HEADER_LEN;
+}
+
+size_t encode_capture_record(const CaptureRecord &rec, uint32_t prev_time_ms, uint8_t out[CAPTURE_RECORD_MAX]) {
+  size_t pos = 0;
+  out[pos++] = rec.kind;
+  uint32_t delta = rec.time_ms - prev_time_ms;
+  do {
+    uint8_t b = delta & 0x7F;
+    delta >>= 7;
+    out[pos++] = delta != 0 ? (b | 0x80) : b;
+  } while (delta != 0);
+  out[pos++] = rec.len;
+  for (size_t i = 0; i < rec.len; i++) {
+    out[pos++] = rec.data[i];
+  }
+  return pos;
+}
+
+size_t decode_capture_record(const uint8_t *in, size_t len, uint32_t prev_time_ms, CaptureRecord *out) {
+  size_t pos = 0;
+  if (len < 3 || in[0] >= CAPTURE_KIND_COUNT) return 0;
+  out->kind = in[pos++];
+
+  uint32_t delta = 0;
+  for (uint8_t shift = 0;; shift += 7) {
+    if (pos >= len || shift > 28) return 0;
+    uint8_t b = in[pos++];
+    delta |= (uint32_t) (b & 0x7F) << shift;
+    if ((b & 0x80) == 0) break;
+  }
+  out->time_ms = prev_time_ms + delta;
+
+  if (pos >= len) return 0;
+  out->len = in[pos++];
+  if (out->len > CAPTURE_DATA_MAX || pos + out->len > len) return 0;
+  for (size_t i = 0; i < out->len; i++) {
+    out->data[i] = in[pos++];
+  }
+  return pos;
+}
+
+}  // namespace bestway_spa
+}  // namespace esphome
@@ -0,0 +1,909 @@
+#pragma once
+
+// Protocol codec for Bestway spas.
+//
+// Everything in this file is plain C++ with no ESPHome or Arduino dependency,
+// so the frame encoders/decoders can be compiled and profiled on a host:
+//
+//   g++ -std=c++17 -O2 -c components/bestway_spa/bestway_codec.cpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Protocols compiled into the firmware. ESPHome codegen passes
+// -DUSE_BESTWAY_SPA_<PROTOCOL> for every protocol used in the YAML so the
+// others drop out of the binary; a plain host build gets all three.
+#if !defined(USE_BESTWAY_SPA_4WIRE) && !defined(USE_BESTWAY_SPA_6WIRE_T1) && !defined(USE_BESTWAY_SPA_6WIRE_T2)
+#define USE_BESTWAY_SPA_4WIRE
+#define USE_BESTWAY_SPA_6WIRE_T1
+#define USE_BESTWAY_SPA_6WIRE_T2
+#endif
+#if defined(USE_BESTWAY_SPA_6WIRE_T1) || defined(USE_BESTWAY_SPA_6WIRE_T2)
+#define USE_BESTWAY_SPA_6WIRE
+#endif
+
+namespace esphome {
+namespace bestway_spa {
+
+// =============================================================================
+// ENUMERATIONS - Based on VisualApproach firmware
+// =============================================================================
+
+// Protocol types
+enum ProtocolType {
+  PROTOCOL_4WIRE,     // 2021+ models (UART)
+  PROTOCOL_6WIRE_T1,  // Pre-2021 6-wire TYPE1 (SPI-like)
+  PROTOCOL_6WIRE_T2   // 6-wire TYPE2 (54149E)
+};
+
+// Spa model identifiers
+enum SpaModel {
+  MODEL_PRE2021,    // Pre-2021 (6-wire TYPE1)
+  MODEL_54149E,     // 6-wire TYPE2
+  MODEL_54123,      // 4-wire (NO54123)
+  MODEL_54138,      // 4-wire with jets and air
+  MODEL_54144,      // 4-wire with jets
+  MODEL_54154,      // 4-wire
+  MODEL_54173,      // 4-wire with jets and air
+  MODEL_P05504,     // 6-wire TYPE1 variant
+  MODEL_UNKNOWN
+};
+
+// Button indices - matches VisualApproach
+enum Buttons : uint8_t {
+  NOBTN = 0,
+  LOCK,
+  TIMER,
+  BUBBLES,
+  UNIT,
+  HEAT,
+  PUMP,
+  DOWN,
+  UP,
+  POWER,
+  HYDROJETS,
+  BTN_COUNT
+};
+
+// State indices - matches VisualApproach
+enum States : uint8_t {
+  LOCKEDSTATE = 0,
+  POWERSTATE,
+  UNITSTATE,
+  BUBBLESSTATE,
+  HEATGRNSTATE,
+  HEATREDSTATE,
+  HEATSTATE,
+  PUMPSTATE,
+  CHAR1,
+  CHAR2,
+  CHAR3,
+  JETSSTATE,
+  GODSTATE,
+  TIMERSTATE,
+  STATE_COUNT
+};
+
+// =============================================================================
+// PROTOCOL CONSTANTS
+// =============================================================================
+
+// 4-wire frame: [0xFF] [CMD] [TEMP] [ERR] [RSV] [CHK] [0xFF]
+static const size_t FRAME_4W_LEN = 7;
+static const uint8_t FRAME_4W_MARKER = 0xFF;
+
+// 6-wire TYPE1 protocol constants
+static const uint8_t DSP_CMD1_MODE6_11_7 = 0x01;
+static const uint8_t DSP_CMD1_MODE6_11_7_P05504 = 0x05;
+static const uint8_t DSP_CMD2_DATAREAD = 0x42;
+static const uint8_t DSP_CMD2_DATAWRITE = 0x40;
+static const uint8_t DSP_DIM_BASE = 0x80;
+static const uint8_t DSP_DIM_ON = 0x08;
+
+// 6-wire TYPE2 protocol constants
+static const uint8_t TYPE2_CMD1 = 0x40;
+static const uint8_t TYPE2_CMD2 = 0xC0;
+static const uint8_t TYPE2_CMD3 = 0x88;
+
+// Payload lengths
+static const size_t T1_PAYLOAD_LEN = 11;
+static const size_t T2_PAYLOAD_LEN = 5;
+
+// Payload byte indices for TYPE1 (11-byte payload)
+static const uint8_t T1_DGT1_IDX = 1;
+static const uint8_t T1_DGT2_IDX = 3;
+static const uint8_t T1_DGT3_IDX = 5;
+static const uint8_t T1_TIMER_IDX = 7;
+static const uint8_t T1_TIMER_BIT = 1;
+static const uint8_t T1_LOCK_IDX = 7;
+static const uint8_t T1_LOCK_BIT = 2;
+static const uint8_t T1_HEATGRN_IDX = 9;
+static const uint8_t T1_HEATGRN_BIT = 0;
+static const uint8_t T1_HEATRED_IDX = 9;
+static const uint8_t T1_HEATRED_BIT = 3;
+static const uint8_t T1_AIR_IDX = 9;
+static const uint8_t T1_AIR_BIT = 1;
+static const uint8_t T1_FILTER_IDX = 9;
+static const uint8_t T1_FILTER_BIT = 2;
+static const uint8_t T1_C_IDX = 7;
+static const uint8_t T1_C_BIT = 0;
+static const uint8_t T1_F_IDX = 9;
+static const uint8_t T1_F_BIT = 4;
+static const uint8_t T1_POWER_IDX = 9;
+static const uint8_t T1_POWER_BIT = 5;
+static const uint8_t T1_JETS_IDX = 9;
+static const uint8_t T1_JETS_BIT = 6;
+
+// Payload byte indices for TYPE2 (5-byte payload)
+static const uint8_t T2_DGT1_IDX = 0;
+static const uint8_t T2_DGT2_IDX = 1;
+static const uint8_t T2_DGT3_IDX = 2;
+static const uint8_t T2_TIMER_IDX = 3;
+static const uint8_t T2_TIMER_BIT = 0;
+static const uint8_t T2_LOCK_IDX = 3;
+static const uint8_t T2_LOCK_BIT = 1;
+static const uint8_t T2_HEATGRN_IDX = 3;
+static const uint8_t T2_HEATGRN_BIT = 2;
+static const uint8_t T2_HEATRED_IDX = 3;
+static const uint8_t T2_HEATRED_BIT = 3;
+static const uint8_t T2_AIR_IDX = 3;
+static const uint8_t T2_AIR_BIT = 4;
+static const uint8_t T2_FILTER_IDX = 3;
+static const uint8_t T2_FILTER_BIT = 5;
+static const uint8_t T2_C_IDX = 3;
+static const uint8_t T2_C_BIT = 6;
+static const uint8_t T2_F_IDX = 3;
+static const uint8_t T2_F_BIT = 7;
+static const uint8_t T2_POWER_IDX = 4;
+static const uint8_t T2_POWER_BIT = 0;
+static const uint8_t T2_JETS_IDX = 4;
+static const uint8_t T2_JETS_BIT = 1;
+
+// =============================================================================
+// 7-SEGMENT DISPLAY CHARACTER CODES
+// =============================================================================
+
+static const size_t CHARCODE_COUNT = 38;
+
+// 7-segment character codes for TYPE1 and TYPE2 (0-9, A-Z, space, dash)
+extern const uint8_t CHARCODES_TYPE1[CHARCODE_COUNT];
+extern const uint8_t CHARCODES_TYPE2[CHARCODE_COUNT];
+
+// Character lookup table
+extern const char CHARS[CHARCODE_COUNT + 1];
+
+// =============================================================================
+// BUTTON CODES BY MODEL
+// =============================================================================
+
+// Index: NOBTN, LOCK, TIMER, BUBBLES, UNIT, HEAT, PUMP, DOWN, UP, POWER, JETS.
+// 0x0000 marks a button the model does not have (no TYPE1 display sends it)
+extern const uint16_t BTN_CODES_PRE2021[BTN_COUNT];
+extern const uint16_t BTN_CODES_P05504[BTN_COUNT];
+extern const uint16_t BTN_CODES_54149E[BTN_COUNT];
+
+// =============================================================================
+// 4-WIRE MODEL CONFIGURATIONS
+// =============================================================================
+
+// Heater bitmasks for 4-wire models
+struct ModelConfig4W {
+  uint8_t heat_bitmask1;
+  uint8_t heat_bitmask2;
+  uint8_t pump_bitmask;
+  uint8_t bubbles_bitmask;
+  uint8_t jets_bitmask;
+  bool has_jets;
+  bool has_air;
+};
+
+extern const ModelConfig4W CONFIG_54123;
+extern const ModelConfig4W CONFIG_54138;
+extern const ModelConfig4W CONFIG_54144;
+extern const ModelConfig4W CONFIG_54154;
+extern const ModelConfig4W CONFIG_54173;
+
+// =============================================================================
+// FRAME BUFFERS
+// =============================================================================
+
+// Non-owning view of a received frame, valid until the buffer is consumed
+struct FrameView {
+  const uint8_t *data;
+  size_t len;
+
+  uint8_t operator[](size_t i) const { return data[i]; }
+  size_t size() const { return len; }
+};
+
+// Fixed-capacity receive buffer for the 4-wire UART. Bytes are appended at
+// the tail and consumed from the head; unread bytes are slid back to the
+// start only when the tail reaches the end, so frames are always contiguous
+// and can be handed out as a FrameView without copying.
+template<size_t N> class RxBuffer {
+ public:
+  uint8_t *write_ptr() { return buf_ + tail_; }
+  size_t free_space() const { return N - tail_; }
+  void commit(size_t n) { tail_ += n; }
+
+  const uint8_t *data() const { return buf_ + head_; }
+  size_t size() const { return tail_ - head_; }
+  bool empty() const { return head_ == tail_; }
+  uint8_t operator[](size_t i) const { return buf_[head_ + i]; }
+  FrameView view(size_t offset, size_t len) const { return FrameView{buf_ + head_ + offset, len}; }
+
+  void consume(size_t n) {
+    head_ += n;
+    if (head_ >= tail_) {
+      head_ = tail_ = 0;
+    }
+  }
+  void clear() { head_ = tail_ = 0; }
+
+  // Move unread bytes to the front to make room at the tail
+  void compact() {
+    if (head_ == 0) return;
+    size_t len = tail_ - head_;
+    for (size_t i = 0; i < len; i++) {
+      buf_[i] = buf_[head_ + i];
+    }
+    head_ = 0;
+    tail_ = len;
+  }
+
+ protected:
+  uint8_t buf_[N];
+  size_t head_{0};
+  size_t tail_{0};
+};
+
+// =============================================================================
+// QUEUES
+// =============================================================================
+
+// Fixed-capacity FIFO ring. push() fails instead of growing when full, and
+// items can be removed from the middle so queued entries can be merged away.
+template<typename T, size_t N> class RingQueue {
+ public:
+  static constexpr size_t capacity() { return N; }
+  size_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+  bool full() const { return count_ == N; }
+
+  // Index 0 is the front of the queue
+  T &operator[](size_t i) { return items_[(head_ + i) % N]; }
+  const T &operator[](size_t i) const { return items_[(head_ + i) % N]; }
+  T &front() { return items_[head_]; }
+
+  bool push(const T &item) {
+    if (full()) return false;
+    items_[(head_ + count_) % N] = item;
+    count_++;
+    return true;
+  }
+
+  void pop() {
+    if (empty()) return;
+    head_ = (head_ + 1) % N;
+    count_--;
+  }
+
+  // Remove item i, keeping the order of the rest
+  void erase(size_t i) {
+    if (i >= count_) return;
+    for (size_t j = i; j + 1 < count_; j++) {
+      (*this)[j] = (*this)[j + 1];
+    }
+    count_--;
+  }
+
+  void clear() { head_ = count_ = 0; }
+
+ protected:
+  T items_[N];
+  size_t head_{0};
+  size_t count_{0};
+};
+
+// =============================================================================
+// FRAME CAPTURE
+// =============================================================================
+
+// What a captured record holds
+enum CaptureKind : uint8_t {
+  CAPTURE_4W_RX = 0,     // Frame from the CIO, checksum OK
+  CAPTURE_4W_RX_BAD,     // Frame from the CIO with a bad checksum
+  CAPTURE_4W_TX,         // Response frame sent to the CIO
+  CAPTURE_DSP_PAYLOAD,   // Display payload sent to the DSP
+  CAPTURE_CIO_PAYLOAD,   // Display payload sniffed from the CIO (passive mode)
+  CAPTURE_BUTTON,        // 16-bit button code read from the DSP, big-endian
+  CAPTURE_KIND_COUNT,
+};
+
+static const uint8_t CAPTURE_DATA_MAX = 11;  // Largest payload (TYPE1)
+
+struct CaptureRecord {
+  uint32_t time_ms;
+  uint8_t kind;
+  uint8_t len;
+  uint8_t data[CAPTURE_DATA_MAX];
+};
+
+// Dump format: a header followed by records, all bytes.
+//   header: 'B' 'W' 'C' version protocol model
+//   record: kind, time since the previous record in ms (LEB128), len, data
+static const uint8_t CAPTURE_VERSION = 1;
+static const size_t CAPTURE_HEADER_LEN = 6;
+static const size_t CAPTURE_RECORD_MAX = 1 + 5 + 1 + CAPTURE_DATA_MAX;
+
+// Fixed-size ring of the most recent records; the oldest is overwritten when
+// full. A record identical to the previous one of its kind is skipped so the
+// 20 Hz display refresh does not flush everything else out.
+template<size_t N> class CaptureRing {
+ public:
+  bool push(CaptureKind kind, uint32_t time_ms, const uint8_t *data, size_t len) {
+    if (kind >= CAPTURE_KIND_COUNT) return false;
+    if (len > CAPTURE_DATA_MAX) len = CAPTURE_DATA_MAX;
+    if (has_last_[kind] && last_len_[kind] == len && equal_(last_data_[kind], data, len)) {
+      return false;
+    }
+    has_last_[kind] = true;
+    last_len_[kind] = len;
+    copy_(last_data_[kind], data, len);
+
+    CaptureRecord &rec = records_[(head_ + count_) % N];
+    rec.time_ms = time_ms;
+    rec.kind = kind;
+    rec.len = len;
+    copy_(rec.data, data, len);
+    if (count_ < N) {
+      count_++;
+    } else {
+      head_ = (head_ + 1) % N;
+    }
+    return true;
+  }
+
+  static constexpr size_t capacity() { return N; }
+  size_t size() const { return count_; }
+  // Index 0 is the oldest record
+  const CaptureRecord &operator[](size_t i) const { return records_[(head_ + i) % N]; }
+  void clear() {
+    head_ = count_ = 0;
+    for (auto &h : has_last_) h = false;
+  }
+
+ protected:
+  static bool equal_(const uint8_t *a, const uint8_t *b, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      if (a[i] != b[i]) return false;
+    }
+    return true;
+  }
+  static void copy_(uint8_t *dst, const uint8_t *src, size_t len) {
+    for (size_t i = 0; i < len; i++) dst[i] = src[i];
+  }
+
+  CaptureRecord records_[N];
+  size_t head_{0};
+  size_t count_{0};
+  bool has_last_[CAPTURE_KIND_COUNT]{false};
+  uint8_t last_len_[CAPTURE_KIND_COUNT]{0};
+  uint8_t last_data_[CAPTURE_KIND_COUNT][CAPTURE_DATA_MAX]{};
+};
+
+// Lock-free single-producer/single-consumer queue: one thread pushes and
+// one other thread pops, with no locks. N must be a power of two.
+template<typename T, size_t N> class SpscQueue {
+  static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+ public:
+  // Producer side
+  bool push(const T &item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == N) return false;
+    items_[tail & (N - 1)] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  bool pop(T &out) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return false;
+    out = items_[head & (N - 1)];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Either side. Head is read first: both indices only grow, so the tail
+  // read after it is never behind it. The producer may have pushed again
+  // after a pop in between, hence the clamp.
+  size_t size() const {
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    return tail - head < N ? tail - head : N;
+  }
+  bool empty() const { return size() == 0; }
+  static constexpr size_t capacity() { return N; }
+
+ protected:
+  T items_[N];
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+};
+
+// =============================================================================
+// STATISTICS
+// =============================================================================
+
+// Running duration statistics in microseconds. Histogram bucket i counts
+// samples below 128us << i; the last bucket takes everything above.
+struct StageStats {
+  static const uint8_t BUCKETS = 8;
+  static const uint8_t BUCKET_SHIFT = 7;
+
+  uint32_t count{0};
+  uint64_t total_us{0};
+  uint32_t min_us{UINT32_MAX};
+  uint32_t max_us{0};
+  uint32_t window_max_us{0};  // Largest sample since the last take_window_max()
+  uint32_t buckets[BUCKETS]{0};
+
+  void record(uint32_t us) {
+    count++;
+    total_us += us;
+    if (us < min_us) min_us = us;
+    if (us > max_us) max_us = us;
+    if (us > window_max_us) window_max_us = us;
+    uint8_t b = 0;
+    for (uint32_t v = us >> BUCKET_SHIFT; v != 0 && b < BUCKETS - 1; v >>= 1) {
+      b++;
+    }
+    buckets[b]++;
+  }
+
+  uint32_t mean_us() const { return count == 0 ? 0 : (uint32_t) (total_us / count); }
+  uint32_t take_window_max() {
+    uint32_t m = window_max_us;
+    window_max_us = 0;
+    return m;
+  }
+  // Exclusive upper bound of bucket i, 0 for the open-ended last bucket
+  static uint32_t bucket_limit_us(uint8_t i) { return i < BUCKETS - 1 ? (1u << BUCKET_SHIFT) << i : 0; }
+};
+
+// Bus link-quality counters
+enum LinkCounter : uint8_t {
+  LINK_FRAMES_RX = 0,     // Good frames from the CIO (4-wire, passive) or button reads (6-wire)
+  LINK_FRAMES_TX,         // 4-wire replies and 6-wire display payloads
+  LINK_CHECKSUM_ERRORS,   // 4-wire frames with a bad checksum
+  LINK_BYTES_DISCARDED,   // 4-wire bytes skipped to resync or dropped from a full buffer
+  LINK_TIMEOUTS,          // 4-wire partial frames flushed when the line went quiet
+  LINK_BAD_READS,         // 6-wire button reads of 0xFFFF (and 0x0000 on TYPE1, where it is no code)
+  LINK_COUNTER_COUNT,
+};
+
+// Always-on counters, cheap enough for every frame. Wiring and level
+// shifter faults show up here long before the state stops updating.
+struct LinkStats {
+  uint32_t counters[LINK_COUNTER_COUNT]{0};
+  StageStats frame_period;  // Time between good received frames, us
+  uint32_t last_frame_us{0};
+
+  void count(LinkCounter counter, uint32_t n = 1) { counters[counter] += n; }
+  void frame_received(uint32_t now_us) {
+    counters[LINK_FRAMES_RX]++;
+    if (last_frame_us != 0)
+      frame_period.record(now_us - last_frame_us);
+    last_frame_us = now_us;
+  }
+};
+
+// =============================================================================
+// TEMPERATURE FILTER
+// =============================================================================
+
+// Settings for TempFilter. The defaults suit a CIO that reports several
+// frames a second in whole degrees.
+struct TempFilterConfig {
+  uint8_t window{5};        // Median of the last N accepted readings, 1..7
+  uint8_t ema_shift{2};     // EMA weight 1/2^shift on the median, 0 (off)..4
+  uint8_t max_jump{3};      // Readings this far from the median are outliers; 0 disables the gate
+  uint16_t hysteresis{26};  // Extra 1/256 degree past the rounding point before the output moves
+};
+
+// Cleans up raw whole-degree readings before they reach the state, in
+// integer math only (the ESP8266 has no FPU). A reading further than
+// max_jump from the median is dropped; once `window` outliers arrive in a
+// row the step is taken as real (refill, unit change) and the filter starts
+// over from it. Accepted readings feed a median of `window`, the median
+// feeds an EMA kept in 1/256 degree, and the whole-degree output follows the
+// EMA only once it has moved past the rounding point plus hysteresis.
+class TempFilter {
+ public:
+  static const uint8_t WINDOW_MAX = 7;
+  static const uint8_t EMA_SHIFT_MAX = 4;
+  static const int32_t SCALE = 256;
+
+  void configure(const TempFilterConfig &config);
+  // Feeds one reading; true when value() changed (always on the first)
+  bool push(int16_t raw);
+  void reset();
+
+  int16_t value() const { return out_; }
+  bool has_value() const { return count_ > 0; }
+  uint32_t rejected() const { return rejected_; }
+  const TempFilterConfig &config() const { return config_; }
+
+ protected:
+  void seed_(int16_t raw);
+  int16_t median_() const;
+
+  TempFilterConfig config_;
+  int16_t history_[WINDOW_MAX]{};
+  uint8_t head_{0};
+  uint8_t count_{0};
+  uint8_t outliers_{0};
+  int32_t ema_{0};
+  int16_t out_{0};
+  uint32_t rejected_{0};
+};
+
+// =============================================================================
+// HEATING RATE MODEL
+// =============================================================================
+
+// Conditions the tub's temperature drift is learned for
+enum RateCondition : uint8_t {
+  RATE_HEATING = 0,  // Heater on at full power
+  RATE_IDLE_PUMP,    // Heater off, filter pump running
+  RATE_IDLE,         // Everything off
+  RATE_CONDITION_COUNT,
+  RATE_NONE = 0xFF,  // Not learned (bubbles/jets, heater stage 1, power off)
+};
+
+// Least-squares line through (x, y) samples kept as integer running sums
+struct RunningFit {
+  int32_t n{0};
+  int64_t sx{0};
+  int64_t sy{0};
+  int64_t sxx{0};
+  int64_t sxy{0};
+  int32_t y_min{0};
+  int32_t y_max{0};
+
+  void add(int32_t x, int32_t y) {
+    if (n == 0 || y < y_min) y_min = y;
+    if (n == 0 || y > y_max) y_max = y;
+    n++;
+    sx += x;
+    sy += y;
+    sxx += (int64_t) x * x;
+    sxy += (int64_t) x * y;
+  }
+  void clear() { *this = RunningFit{}; }
+  // Slope times num_scale / den_scale; false while the x values are all equal
+  bool slope(int64_t num_scale, int64_t den_scale, int32_t *out) const {
+    int64_t den = n * sxx - sx * sx;
+    if (n < 2 || den <= 0) return false;
+    *out = (int32_t) ((n * sxy - sx * sy) * num_scale / (den * den_scale));
+    return true;
+  }
+};
+
+// Learns the temperature drift per condition from a stream of readings. The
+// current run of one condition is fitted with a RunningFit (x in seconds, y
+// in 1/16 degree); when the condition changes the fitted rate is folded into
+// a per-condition average. Rates are in centidegrees per hour.
+class HeatRateModel {
+ public:
+  static const int32_t TEMP_SCALE = 16;
+  static const int32_t MIN_SAMPLES = 10;
+  static const int32_t MIN_RISE = 2 * TEMP_SCALE;  // Readings move in whole degrees
+  static const uint32_t MAX_SEGMENT_S = 6 * 3600;
+
+  void sample(uint32_t now_ms, float temp, RateCondition cond);
+  // Folds a finished run into the averages
+  void end_segment();
+  void reset();
+
+  bool has_rate(RateCondition cond) const { return cond < RATE_CONDITION_COUNT && valid_[cond]; }
+  int32_t rate(RateCondition cond) const { return has_rate(cond) ? rate_[cond] : 0; }
+  // Minutes until target is reached with the heater on, -1 while unknown
+  int32_t minutes_to_target(float current, float target) const;
+
+ protected:
+  bool segment_rate_(int32_t *out) const;
+
+  RunningFit fit_;
+  RateCondition cond_{RATE_NONE};
+  uint32_t start_ms_{0};
+  int32_t rate_[RATE_CONDITION_COUNT]{0};
+  bool valid_[RATE_CONDITION_COUNT]{false};
+};
+
+// =============================================================================
+// TARIFF PLANNER
+// =============================================================================
+
+static const uint32_t PLAN_SLOT_MINUTES = 15;
+static const size_t PLAN_MAX_SLOTS = 24 * 60 / PLAN_SLOT_MINUTES;  // Deadlines are at most a day ahead
+static const size_t PRICE_WINDOW_MAX = 8;
+
+// Time-of-use price from start to end minute of the day; a window whose end
+// is before its start runs past midnight
+struct PriceWindow {
+  uint16_t start_minute;
+  uint16_t end_minute;
+  float price;
+};
+
+// Price in effect at a minute of the day; the first matching window wins
+float price_at(const PriceWindow *windows, size_t count, float default_price, uint16_t minute);
+
+// Heated slots out of `slots` needed to gain `deficit` centidegrees, with the
+// heater and idle drift rates in centidegrees per hour (idle is usually
+// negative). Returns slots + 1 if the target cannot be reached in time.
+size_t heat_slots_needed(int32_t deficit, int32_t heat_rate, int32_t idle_rate, size_t slots);
+
+// Marks the `heat` cheapest of `slots` slots starting at `start_minute` in
+// out[]. On equal prices the later slot wins, so less heat is lost before
+// the deadline.
+void plan_cheapest_slots(const PriceWindow *windows, size_t count, float default_price, uint16_t start_minute,
+                         size_t slots, size_t heat, bool *out);
+
+// =============================================================================
+// DECODED FRAMES
+// =============================================================================
+
+// Result of checking the head of a 4-wire receive buffer
+enum FrameCheck : uint8_t {
+  FRAME_OK,
+  FRAME_BAD_MARKER,
+  FRAME_BAD_CHECKSUM,
+};
+
+// Status reported by a 4-wire CIO frame
+struct CioStatus4W {
+  uint8_t command;
+  uint8_t temperature;
+  uint8_t error_code;
+  bool filter_pump;
+  bool bubbles;
+  bool jets;
+  bool heater_red;
+};
+
+// Outputs requested from a 4-wire CIO
+struct CioCommand4W {
+  uint8_t heater_stage;  // 0 = off, 1 = first element, 2 = both elements
+  bool filter_pump;
+  bool bubbles;
+  bool jets;
+  uint8_t target_temp;
+};
+
+inline bool operator==(const CioCommand4W &a, const CioCommand4W &b) {
+  return a.heater_stage == b.heater_stage && a.filter_pump == b.filter_pump && a.bubbles == b.bubbles &&
+         a.jets == b.jets && a.target_temp == b.target_temp;
+}
+inline bool operator!=(const CioCommand4W &a, const CioCommand4W &b) { return !(a == b); }
+
+// Status LEDs shown on a 6-wire display
+struct DisplayStatus {
+  bool locked;
+  bool timer;
+  bool heater_green;
+  bool heater_red;
+  bool bubbles;
+  bool filter_pump;
+  bool celsius;
+  bool fahrenheit;
+  bool power;
+  bool jets;
+};
+
+// =============================================================================
+// 6-WIRE TRANSPORT
+// =============================================================================
+
+// Bit order of a 6-wire transfer. TYPE1 is MSB first; TYPE2 sends its
+// payload and reads its button code LSB first.
+enum BitOrder : uint8_t {
+  BIT_ORDER_MSB = 0,
+  BIT_ORDER_LSB,
+};
+
+inline constexpr uint8_t reverse_bits(uint8_t b) {
+  return (uint8_t) (((b & 0x01) << 7) | ((b & 0x02) << 5) | ((b & 0x04) << 3) | ((b & 0x08) << 1) |
+                    ((b & 0x10) >> 1) | ((b & 0x20) >> 3) | ((b & 0x40) >> 5) | ((b & 0x80) >> 7));
+}
+
+// Moves bytes over the shared CLK/DATA/CS lines to the display. begin()
+// pulls CS low, end() releases it; write() and read() clock whole bytes
+// inside one transaction and switch DATA between output and input as
+// needed. Bytes are given and returned in logical order: for
+// BIT_ORDER_LSB, bit 0 of each byte is the first bit on the wire.
+class SixWireTransport {
+ public:
+  virtual ~SixWireTransport() = default;
+  virtual void setup() {}
+  virtual void begin() = 0;
+  virtual void end() = 0;
+  virtual void write(const uint8_t *data, size_t len, BitOrder order) = 0;
+  virtual void read(uint8_t *data, size_t len, BitOrder order) = 0;
+  // True if a transfer holds the CPU for its whole duration
+  virtual bool is_blocking() const { return false; }
+};
+
+// In-memory transport for host tests. Written bytes are stored in wire
+// order (first bit on the wire is the MSB), reads are served from a
+// scripted buffer in the same order and return 0xFF once it runs out.
+class MemoryTransport : public SixWireTransport {
+ public:
+  static const size_t BUFFER_SIZE = 64;
+
+  void begin() override {
+    in_transaction_ = true;
+    transactions_++;
+  }
+  void end() override { in_transaction_ = false; }
+  void write(const uint8_t *data, size_t len, BitOrder order) override {
+    for (size_t i = 0; i < len && written_len_ < BUFFER_SIZE; i++) {
+      written_[written_len_++] = order == BIT_ORDER_LSB ? reverse_bits(data[i]) : data[i];
+    }
+  }
+  void read(uint8_t *data, size_t len, BitOrder order) override {
+    for (size_t i = 0; i < len; i++) {
+      uint8_t b = read_pos_ < read_len_ ? read_data_[read_pos_++] : 0xFF;
+      data[i] = order == BIT_ORDER_LSB ? reverse_bits(b) : b;
+    }
+  }
+
+  void set_read_data(const uint8_t *data, size_t len) {
+    read_len_ = len < BUFFER_SIZE ? len : BUFFER_SIZE;
+    for (size_t i = 0; i < read_len_; i++) read_data_[i] = data[i];
+    read_pos_ = 0;
+  }
+  const uint8_t *written() const { return written_; }
+  size_t written_len() const { return written_len_; }
+  uint32_t transactions() const { return transactions_; }
+  bool in_transaction() const { return in_transaction_; }
+  void clear() {
+    written_len_ = 0;
+    read_len_ = 0;
+    read_pos_ = 0;
+    transactions_ = 0;
+  }
+
+ protected:
+  uint8_t written_[BUFFER_SIZE]{};
+  size_t written_len_{0};
+  uint8_t read_data_[BUFFER_SIZE]{};
+  size_t read_len_{0};
+  size_t read_pos_{0};
+  uint32_t transactions_{0};
+  bool in_transaction_{false};
+};
+
+// =============================================================================
+// PROTOCOL DETECTION
+// =============================================================================
+
+// Works out protocol and model from traffic seen while only listening.
+// 4-wire shows up as checksummed 0xFF-framed UART frames, and the command
+// bits they carry tell the two 4-wire bitmask families apart (54123/54154
+// against 54138/54144/54173) once a bit only one family uses is seen.
+// 6-wire frames are sniffed MSB first, one per CS pulse: TYPE1 sends
+// 11-byte display payloads whose command byte differs on the P05504, and
+// TYPE2 frames start with a TYPE2 command, which is MSB first on the wire
+// like TYPE1's. TYPE1 button reads match the button codes of only one of
+// PRE2021 and P05504.
+class ProtocolDetector {
+ public:
+  // Frames of one protocol needed before it is taken as detected
+  static const uint16_t FRAMES_NEEDED = 4;
+
+  void feed_uart(const uint8_t *data, size_t len);
+  void feed_6wire_frame(const uint8_t *frame, size_t len);
+
+  bool protocol_known() const;
+  ProtocolType protocol() const;
+  // True once the model is pinned down, not just its protocol
+  bool model_known() const;
+  // Detected model; `hint` (the configured model) wins whenever the
+  // evidence does not rule it out
+  SpaModel model(SpaModel hint) const;
+
+  uint16_t frames_4w() const { return frames_4w_; }
+  uint16_t frames_t1() const { return frames_t1_; }
+  uint16_t frames_t2() const { return frames_t2_; }
+
+ protected:
+  uint8_t window_[FRAME_4W_LEN]{};
+  uint8_t window_len_{0};
+  uint8_t command_bits_{0};  // OR of every 4-wire command byte
+  uint16_t frames_4w_{0};
+  uint16_t frames_t1_{0};
+  uint16_t frames_t2_{0};
+  bool seen_pre2021_{false};
+  bool seen_p05504_{false};
+};
+
+// =============================================================================
+// CODEC FUNCTIONS
+// =============================================================================
+
+// Model lookups
+const ModelConfig4W *get_model_config_4w(SpaModel model);
+const uint16_t *get_button_codes(SpaModel model);
+const char *model_name(SpaModel model);  // As written in the YAML
+
+// Inline so a model fixed at compile time folds to a constant
+inline constexpr bool model_has_jets(SpaModel model) {
+  switch (model) {
+    case MODEL_54138:
+    case MODEL_54144:
+    case MODEL_54173:
+      return true;
+    default:
+      return false;
+  }
+}
+
+inline constexpr ProtocolType model_protocol(SpaModel model) {
+  return model == MODEL_PRE2021 || model == MODEL_P05504 ? PROTOCOL_6WIRE_T1
+         : model == MODEL_54149E                         ? PROTOCOL_6WIRE_T2
+                                                         : PROTOCOL_4WIRE;
+}
+
+inline constexpr bool model_has_air(SpaModel model) {
+  switch (model) {
+    case MODEL_PRE2021:
+    case MODEL_54138:
+    case MODEL_54173:
+    case MODEL_54149E:
+    case MODEL_P05504:
+      return true;
+    case MODEL_54123:
+    case MODEL_54144:
+    case MODEL_54154:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// 8-bit additive checksum used by the 4-wire protocol
+uint8_t calculate_checksum(const uint8_t *data, size_t len);
+
+// 4-wire framing
+FrameCheck check_4wire_frame(const FrameView &frame);
+size_t find_4wire_resync(const uint8_t *data, size_t len);
+void decode_4wire_frame(const FrameView &frame, const ModelConfig4W &config, CioStatus4W *out);
+void encode_4wire_response(const CioCommand4W &cmd, const ModelConfig4W &config, uint8_t out[FRAME_4W_LEN]);
+// CIO side of the 4-wire link (the frame decode_4wire_frame() parses)
+void encode_4wire_status(const CioStatus4W &status, const ModelConfig4W &config, uint8_t out[FRAME_4W_LEN]);
+
+// 6-wire payloads
+void decode_display_status(const uint8_t *payload, bool is_type1, DisplayStatus *out);
+// Fills digits and status LEDs; for TYPE1 the command byte at payload[0] is left untouched
+void encode_display_payload(const DisplayStatus &status, const char *digits, bool is_type1, uint8_t *payload);
+// NOBTN for the idle code, unknown codes and 0x0000 (never a button)
+Buttons decode_button_code(const uint16_t *codes, uint16_t code);
+// O(1) via 256-entry tables generated at compile time
+char decode_7segment(uint8_t segments, bool is_type1);
+void decode_display_digits(const uint8_t *payload, bool is_type1, char out[3]);
+uint8_t encode_7segment(char c, bool is_type1);
+
+// Capture dump serialization. The decoders return the bytes consumed, 0 if
+// the input is truncated or malformed.
+void encode_capture_header(ProtocolType protocol, SpaModel model, uint8_t out[CAPTURE_HEADER_LEN]);
+size_t decode_capture_header(const uint8_t *in, size_t len, ProtocolType *protocol, SpaModel *model);
+size_t encode_capture_record(const CaptureRecord &rec, uint32_t prev_time_ms, uint8_t out[CAPTURE_RECORD_MAX]);
+size_t decode_capture_record(const uint8_t *in, size_t len, uint32_t prev_time_ms, CaptureRecord *out);
+
+}  // namespace bestway_spa
+}  // namespace esphome
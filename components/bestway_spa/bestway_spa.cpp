@@ -1,6 +1,9 @@
 #include "bestway_spa.h"
 #include "esphome/core/log.h"
 #include "esphome/core/helpers.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 
 namespace esphome {
 namespace bestway_spa {
@@ -17,114 +20,141 @@ static const uint32_t SENSOR_UPDATE_INTERVAL_MS = 2000;
 static const uint32_t DSP_REFRESH_INTERVAL_MS = 50;      // ~20Hz display refresh
 static const uint32_t BUTTON_POLL_INTERVAL_MS = 100;
 static const uint32_t BUTTON_DEBOUNCE_MS = 50;
+static const uint32_t BUTTON_PRESS_MS = 300;              // Hold time for toggle buttons
+static const uint32_t BUTTON_STEP_MS = 150;               // Hold time for UP/DOWN, spans one poll
+static const uint32_t BUTTON_SETTLE_MS = 2 * BUTTON_POLL_INTERVAL_MS;
+static const uint8_t BUTTON_MAX_RETRIES = 2;
+static const size_t STATE_PLAN_MAX = 8;                   // Presses for the fields of one DesiredState
 static const uint32_t CLOCK_PULSE_US = 50;               // Clock pulse width
+static const uint32_t RATE_SAMPLE_INTERVAL_MS = 60000;
+static const uint32_t LATENCY_PUBLISH_INTERVAL_MS = 60000;
+static const uint32_t REPLY_LATENCY_WARN_US = 50000;
+static const uint32_t STATE_SAVE_INTERVAL_MS = 60000;
+static const uint32_t STATE_PREF_HASH = 0x5A7E0B18UL;  // Bumped with the SavedSpaState layout
+
+#ifdef USE_BESTWAY_SPA_DETECT
+static const uint32_t DETECT_PREF_HASH = 0xD37EC7A5UL;
+static const uint8_t DETECT_FORGOTTEN = 0xFF;  // Saved in place of a result that stopped working
+#endif
+
+#ifdef USE_BESTWAY_SPA_ENERGY
+static const uint32_t ENERGY_PUBLISH_INTERVAL_MS = 60000;
+static const uint32_t ENERGY_PREF_HASH = 0x42E57A11UL;
+static const double WATT_MS_PER_KWH = 3.6e9;
+static const char *const ENERGY_LOAD_NAMES[ENERGY_LOAD_COUNT] = {"Heater", "Pump", "Bubbles", "Jets"};
+#endif
 
-// 6-wire TYPE1 protocol constants
-static const uint8_t DSP_CMD1_MODE6_11_7 = 0x01;
-static const uint8_t DSP_CMD1_MODE6_11_7_P05504 = 0x05;
-static const uint8_t DSP_CMD2_DATAREAD = 0x42;
-static const uint8_t DSP_CMD2_DATAWRITE = 0x40;
-static const uint8_t DSP_DIM_BASE = 0x80;
-static const uint8_t DSP_DIM_ON = 0x08;
-
-// 6-wire TYPE2 protocol constants
-static const uint8_t TYPE2_CMD1 = 0x40;
-static const uint8_t TYPE2_CMD2 = 0xC0;
-static const uint8_t TYPE2_CMD3 = 0x88;
-
-// Payload byte indices for TYPE1 (11-byte payload)
-static const uint8_t T1_DGT1_IDX = 1;
-static const uint8_t T1_DGT2_IDX = 3;
-static const uint8_t T1_DGT3_IDX = 5;
-static const uint8_t T1_TIMER_IDX = 7;
-static const uint8_t T1_TIMER_BIT = 1;
-static const uint8_t T1_LOCK_IDX = 7;
-static const uint8_t T1_LOCK_BIT = 2;
-static const uint8_t T1_HEATGRN_IDX = 9;
-static const uint8_t T1_HEATGRN_BIT = 0;
-static const uint8_t T1_HEATRED_IDX = 9;
-static const uint8_t T1_HEATRED_BIT = 3;
-static const uint8_t T1_AIR_IDX = 9;
-static const uint8_t T1_AIR_BIT = 1;
-static const uint8_t T1_FILTER_IDX = 9;
-static const uint8_t T1_FILTER_BIT = 2;
-static const uint8_t T1_C_IDX = 7;
-static const uint8_t T1_C_BIT = 0;
-static const uint8_t T1_F_IDX = 9;
-static const uint8_t T1_F_BIT = 4;
-static const uint8_t T1_POWER_IDX = 9;
-static const uint8_t T1_POWER_BIT = 5;
-static const uint8_t T1_JETS_IDX = 9;
-static const uint8_t T1_JETS_BIT = 6;
-
-// Payload byte indices for TYPE2 (5-byte payload)
-static const uint8_t T2_DGT1_IDX = 0;
-static const uint8_t T2_DGT2_IDX = 1;
-static const uint8_t T2_DGT3_IDX = 2;
-static const uint8_t T2_TIMER_IDX = 3;
-static const uint8_t T2_TIMER_BIT = 0;
-static const uint8_t T2_LOCK_IDX = 3;
-static const uint8_t T2_LOCK_BIT = 1;
-static const uint8_t T2_HEATGRN_IDX = 3;
-static const uint8_t T2_HEATGRN_BIT = 2;
-static const uint8_t T2_HEATRED_IDX = 3;
-static const uint8_t T2_HEATRED_BIT = 3;
-static const uint8_t T2_AIR_IDX = 3;
-static const uint8_t T2_AIR_BIT = 4;
-static const uint8_t T2_FILTER_IDX = 3;
-static const uint8_t T2_FILTER_BIT = 5;
-static const uint8_t T2_C_IDX = 3;
-static const uint8_t T2_C_BIT = 6;
-static const uint8_t T2_F_IDX = 3;
-static const uint8_t T2_F_BIT = 7;
-static const uint8_t T2_POWER_IDX = 4;
-static const uint8_t T2_POWER_BIT = 0;
-static const uint8_t T2_JETS_IDX = 4;
-static const uint8_t T2_JETS_BIT = 1;
+// =============================================================================
+// INSTANCES AND BUS SCHEDULING
+// =============================================================================
+
+uint8_t BestwaySpa::instance_count_ = 0;
+std::atomic<uint8_t> BusScheduler::bitbang_count_{0};
+std::atomic<uint32_t> BusScheduler::last_grant_ms_{0};
+
+BestwaySpa::BestwaySpa() : instance_index_(instance_count_++) {
+  // The first spa keeps the plain tag so existing logger filters still apply
+  if (instance_index_ == 0) {
+    snprintf(tag_, sizeof(tag_), "%s", TAG);
+  } else {
+    snprintf(tag_, sizeof(tag_), "%s.%u", TAG, instance_index_);
+  }
+}
+
+bool BusScheduler::acquire(uint32_t now) {
+  uint8_t count = bitbang_count_.load(std::memory_order_relaxed);
+  if (count <= 1) {
+    return true;
+  }
+  // One transfer per slot; n spas share each display refresh period
+  uint32_t last = last_grant_ms_.load(std::memory_order_relaxed);
+  if (now - last < DSP_REFRESH_INTERVAL_MS / count) {
+    return false;
+  }
+  // Two bus tasks asking at once: only one gets the slot
+  return last_grant_ms_.compare_exchange_strong(last, now, std::memory_order_relaxed);
+}
+
+// =============================================================================
+// PROFILING
+// =============================================================================
+
+#ifdef USE_BESTWAY_SPA_PROFILING
+// Times the enclosing scope into a StageStats
+class ProfileScope {
+ public:
+  explicit ProfileScope(StageStats &stats) : stats_(stats), start_(micros()) {}
+  ~ProfileScope() { stats_.record(micros() - start_); }
+
+ protected:
+  StageStats &stats_;
+  uint32_t start_;
+};
+#define BESTWAY_PROFILE(stage) ProfileScope profile_scope(this->profile_[stage])
+#else
+#define BESTWAY_PROFILE(stage)
+#endif
 
 // =============================================================================
 // SETUP
 // =============================================================================
 
 void BestwaySpa::setup() {
-  ESP_LOGCONFIG(TAG, "Setting up Bestway Spa...");
+  ESP_LOGCONFIG(tag_, "Setting up Bestway Spa...");
 
-  // Set model configuration for 4-wire models
-  switch (model_) {
-    case MODEL_54123:
-      model_config_ = &CONFIG_54123;
-      break;
-    case MODEL_54138:
-      model_config_ = &CONFIG_54138;
-      break;
-    case MODEL_54144:
-      model_config_ = &CONFIG_54144;
-      break;
-    case MODEL_54154:
-      model_config_ = &CONFIG_54154;
-      break;
-    case MODEL_54173:
-      model_config_ = &CONFIG_54173;
-      break;
-    default:
-      model_config_ = &CONFIG_54154;
-      break;
+  // Start from the last confirmed state, before the bus task takes state_ over
+  setup_time_ = millis();
+  if (restore_state_) {
+    restore_state_from_flash_();
+  }
+
+#ifdef USE_BESTWAY_SPA_ENERGY
+  setup_energy_();
+#endif
+
+  // Initialize climate state
+  this->mode = climate::CLIMATE_MODE_OFF;
+  this->action = climate::CLIMATE_ACTION_IDLE;
+  this->current_temperature = state_.current_temp();
+  this->target_temperature = state_.target_temp();
+
+#ifdef USE_BESTWAY_SPA_DETECT
+  // The bus is set up once the protocol is known; until then only listen
+  if (detect_ && !load_detection_()) {
+    start_detection_();
+    return;
+  }
+#endif
+  setup_protocol_();
+}
+
+void BestwaySpa::setup_protocol_() {
+  // Resolve model tables once
+  model_config_ = get_model_config_4w(get_model());
+  btn_codes_ = get_button_codes(get_model());
+  if (btn_codes_ != nullptr) {
+    // Nothing pressed until the first poll or queued press says otherwise
+    current_button_code_ = btn_codes_[NOBTN];
+    virtual_button_code_ = btn_codes_[NOBTN];
   }
 
+#ifdef USE_BESTWAY_SPA_6WIRE
   // Initialize 6-wire pins
-  if (protocol_type_ == PROTOCOL_6WIRE_T1 || protocol_type_ == PROTOCOL_6WIRE_T2) {
-    if (clk_pin_ != nullptr) {
-      clk_pin_->setup();
-      clk_pin_->digital_write(false);  // Clock idle low
+  if ((get_protocol_type() == PROTOCOL_6WIRE_T1 || get_protocol_type() == PROTOCOL_6WIRE_T2) && passive_mode_) {
+    setup_passive_capture_();
+  } else if (get_protocol_type() == PROTOCOL_6WIRE_T1 || get_protocol_type() == PROTOCOL_6WIRE_T2) {
+    // Bit-bang from the pins unless a hardware transport was configured
+    if (transport_ == nullptr && clk_pin_ != nullptr && data_pin_ != nullptr && cs_pin_ != nullptr) {
+      bitbang_.set_pins(clk_pin_, data_pin_, cs_pin_);
+      transport_ = &bitbang_;
     }
-    if (data_pin_ != nullptr) {
-      data_pin_->setup();
-      data_pin_->pin_mode(gpio::FLAG_OUTPUT);
-      data_pin_->digital_write(true);  // Data idle high
-    }
-    if (cs_pin_ != nullptr) {
-      cs_pin_->setup();
-      cs_pin_->digital_write(true);    // CS idle high
+    if (transport_ != nullptr) {
+      transport_->setup();
+      if (transport_->is_blocking()) {
+        BusScheduler::add_bitbang_instance();
+      }
+    } else {
+      ESP_LOGW(tag_, "6-wire pins not configured");
     }
     if (audio_pin_ != nullptr) {
       audio_pin_->setup();
@@ -132,9 +162,9 @@ void BestwaySpa::setup() {
     }
 
     // Initialize default DSP payload
-    if (protocol_type_ == PROTOCOL_6WIRE_T1) {
+    if (get_protocol_type() == PROTOCOL_6WIRE_T1) {
       dsp_payload_len_ = 11;
-      dsp_payload_[0] = (model_ == MODEL_P05504) ? DSP_CMD1_MODE6_11_7_P05504 : DSP_CMD1_MODE6_11_7;
+      dsp_payload_[0] = (get_model() == MODEL_P05504) ? DSP_CMD1_MODE6_11_7_P05504 : DSP_CMD1_MODE6_11_7;
       dsp_payload_[1] = 0x00;  // Digit 1
       dsp_payload_[2] = 0x00;
       dsp_payload_[3] = 0x00;  // Digit 2
@@ -149,15 +179,16 @@ void BestwaySpa::setup() {
       dsp_payload_len_ = 5;
     }
   }
+#endif
 
-  // Initialize climate state
-  this->mode = climate::CLIMATE_MODE_OFF;
-  this->action = climate::CLIMATE_ACTION_IDLE;
-  this->current_temperature = state_.current_temp;
-  this->target_temperature = state_.target_temp;
+#ifdef USE_BESTWAY_SPA_BUS_TASK
+  if (bus_task_enabled_) {
+    start_bus_task_();
+  }
+#endif
 
   const char *proto_str;
-  switch (protocol_type_) {
+  switch (get_protocol_type()) {
     case PROTOCOL_4WIRE:
       proto_str = "4-wire UART";
       break;
@@ -171,9 +202,113 @@ void BestwaySpa::setup() {
       proto_str = "unknown";
   }
 
-  ESP_LOGCONFIG(TAG, "Bestway Spa initialized (Protocol: %s)", proto_str);
+  ESP_LOGCONFIG(tag_, "Bestway Spa initialized (Protocol: %s%s)", proto_str, passive_mode_ ? ", passive" : "");
 }
 
+// =============================================================================
+// PROTOCOL DETECTION
+// =============================================================================
+
+#ifdef USE_BESTWAY_SPA_DETECT
+
+bool BestwaySpa::load_detection_() {
+  detect_pref_ = global_preferences->make_preference<DetectedSpa>(this->get_object_id_hash() ^ DETECT_PREF_HASH);
+  if (!save_detected_) {
+    return false;
+  }
+
+  DetectedSpa saved{};
+  if (!detect_pref_.load(&saved) || saved.model >= MODEL_UNKNOWN ||
+      saved.protocol != model_protocol(static_cast<SpaModel>(saved.model))) {
+    return false;
+  }
+
+  protocol_type_ = static_cast<ProtocolType>(saved.protocol);
+  model_ = static_cast<SpaModel>(saved.model);
+  detection_from_flash_ = true;
+  ESP_LOGI(tag_, "Using detected model %s from flash", model_name(model_));
+  return true;
+}
+
+void BestwaySpa::start_detection_() {
+  ESP_LOGI(tag_, "Detecting protocol (up to %u s)...", (unsigned) (detect_timeout_ / 1000));
+  detecting_ = true;
+  detect_start_ = millis();
+
+  // Listen on the 6-wire lines too when they are wired; never drive them
+  if (clk_pin_ == nullptr || data_pin_ == nullptr || cs_pin_ == nullptr) {
+    return;
+  }
+  start_sniffer_();
+  detect_sniffing_ = true;
+}
+
+void BestwaySpa::run_detection_(uint32_t now) {
+  uint8_t buf[32];
+  int avail;
+  while ((avail = available()) > 0) {
+    size_t chunk = std::min((size_t) avail, sizeof(buf));
+    read_array(buf, chunk);
+    detector_.feed_uart(buf, chunk);
+  }
+
+  SniffedFrame frame;
+  while (detect_sniffing_ && sniffer_->frames.pop(frame)) {
+    detector_.feed_6wire_frame(frame.data, frame.len);
+  }
+
+  if ((detector_.protocol_known() && detector_.model_known()) || now - detect_start_ >= detect_timeout_) {
+    finish_detection_();
+  }
+}
+
+void BestwaySpa::finish_detection_() {
+  detecting_ = false;
+#ifdef USE_BESTWAY_SPA_ENERGY
+  // loop() did not integrate while detecting; that time is not the spa's
+  last_energy_update_ = millis();
+#endif
+  if (detect_sniffing_) {
+    // Passive mode starts over with its own once the protocol is known
+    stop_sniffer_();
+    detect_sniffing_ = false;
+  }
+
+  if (detector_.protocol_known()) {
+    protocol_type_ = detector_.protocol();
+    model_ = detector_.model(model_);
+    ESP_LOGI(tag_, "Detected model %s%s (4-wire %u, TYPE1 %u, TYPE2 %u frames)", model_name(model_),
+             detector_.model_known() ? "" : " (assumed within its family)", detector_.frames_4w(),
+             detector_.frames_t1(), detector_.frames_t2());
+    if (save_detected_) {
+      DetectedSpa detected{static_cast<uint8_t>(protocol_type_), static_cast<uint8_t>(model_)};
+      detect_pref_.save(&detected);
+    }
+  } else {
+    ESP_LOGW(tag_, "No spa traffic recognised in %u s, using the configured model %s",
+             (unsigned) (detect_timeout_ / 1000), model_name(model_));
+  }
+
+  setup_protocol_();
+}
+
+void BestwaySpa::check_saved_detection_(uint32_t now) {
+  if (shown_.confirmed) {
+    detection_from_flash_ = false;
+    return;
+  }
+  if (now - setup_time_ < detect_timeout_) {
+    return;
+  }
+  // The saved result no longer talks to this spa; detect again next boot
+  ESP_LOGW(tag_, "No state from the spa with the saved detection, it will be redone on the next boot");
+  DetectedSpa forgotten{DETECT_FORGOTTEN, DETECT_FORGOTTEN};
+  detect_pref_.save(&forgotten);
+  detection_from_flash_ = false;
+}
+
+#endif
+
 // =============================================================================
 // MAIN LOOP
 // =============================================================================
@@ -185,37 +320,302 @@ void BestwaySpa::loop() {
     return;
   }
 
+#ifdef USE_BESTWAY_SPA_DETECT
+  if (detecting_) {
+    run_detection_(now);
+    return;
+  }
+#endif
+
+  BESTWAY_PROFILE(PROFILE_LOOP);
+
+  bool bus_in_task = false;
+#ifdef USE_BESTWAY_SPA_BUS_TASK
+  if (bus_task_ != nullptr) {
+    // The bus task owns state_; publish from its latest snapshot
+    bus_in_task = true;
+    SpaState snapshot;
+    while (bus_states_.pop(snapshot)) {
+      shown_ = snapshot;
+    }
+    BusReport report;
+    while (bus_reports_.pop(report)) {
+      take_bus_report_(report);
+    }
+  }
+#endif
+  if (!bus_in_task) {
+    run_bus_(now);
+    shown_ = state_;
+    BusReport report;
+    make_bus_report_(&report);
+    take_bus_report_(report);
+  }
+
+  // Publish whatever changed; entities are held back until the bus
+  // confirms the state or the restore timeout runs out
+  if (publish_ready_(now)) {
+    publish_changes_(now);
+  }
+
+#ifdef USE_BESTWAY_SPA_DETECT
+  if (detection_from_flash_) {
+    check_saved_detection_(now);
+  }
+#endif
+
+  if (shown_.confirmed) {
+    // Learn heating/cooling rates
+    update_rate_model_(now);
+
+#ifdef USE_BESTWAY_SPA_PLANNER
+    update_heating_plan_();
+#endif
+
+    if (restore_state_) {
+      save_state_(now, false);
+    }
+  }
+
+#ifdef USE_BESTWAY_SPA_4WIRE
+  if (get_protocol_type() == PROTOCOL_4WIRE) {
+    publish_reply_latency_(now);
+  }
+#endif
+
+  publish_link_quality_(now);
+
+#ifdef USE_BESTWAY_SPA_ENERGY
+  update_energy_(now);
+#endif
+
+#ifdef USE_BESTWAY_SPA_PROFILING
+  publish_profile_(now);
+#endif
+}
+
+void BestwaySpa::run_bus_(uint32_t now) {
   // Handle protocol based on type
-  switch (protocol_type_) {
-    case PROTOCOL_4WIRE:
-      handle_4wire_protocol_();
-      break;
-    case PROTOCOL_6WIRE_T1:
-      handle_6wire_type1_protocol_();
-      break;
-    case PROTOCOL_6WIRE_T2:
-      handle_6wire_type2_protocol_();
-      break;
+  {
+    BESTWAY_PROFILE(PROFILE_PROTOCOL);
+    switch (get_protocol_type()) {
+#ifdef USE_BESTWAY_SPA_4WIRE
+      case PROTOCOL_4WIRE:
+        handle_4wire_protocol_();
+        break;
+#endif
+#ifdef USE_BESTWAY_SPA_6WIRE_T1
+      case PROTOCOL_6WIRE_T1:
+        if (passive_mode_) {
+          handle_6wire_passive_();
+        } else {
+          handle_6wire_type1_protocol_();
+        }
+        break;
+#endif
+#ifdef USE_BESTWAY_SPA_6WIRE_T2
+      case PROTOCOL_6WIRE_T2:
+        if (passive_mode_) {
+          handle_6wire_passive_();
+        } else {
+          handle_6wire_type2_protocol_();
+        }
+        break;
+#endif
+      default:
+        break;
+    }
   }
 
+#ifdef USE_BESTWAY_SPA_6WIRE
   // Process button queue (for 6-wire)
-  if (protocol_type_ != PROTOCOL_4WIRE) {
+  if (get_protocol_type() != PROTOCOL_4WIRE && !passive_mode_) {
+    BESTWAY_PROFILE(PROFILE_BUTTONS);
     process_button_queue_();
   }
+#endif
 
   // Handle toggle requests
-  handle_toggles_();
+  {
+    BESTWAY_PROFILE(PROFILE_TOGGLES);
+    handle_toggles_();
+  }
 
-  // Update climate state periodically
-  if (now - last_state_update_ > STATE_UPDATE_INTERVAL_MS) {
-    update_climate_state_();
-    last_state_update_ = now;
+#ifdef USE_BESTWAY_SPA_4WIRE
+  if (get_protocol_type() == PROTOCOL_4WIRE) {
+    // Pick up this pass's state changes for the next reply
+    refresh_4wire_response_(now);
   }
+#else
+  (void) now;
+#endif
+}
 
-  // Update sensors periodically
-  if (now - last_sensor_update_ > SENSOR_UPDATE_INTERVAL_MS) {
-    update_sensors_();
-    last_sensor_update_ = now;
+#ifdef USE_BESTWAY_SPA_PROFILING
+// Stages timed inside run_bus_(), on the bus side
+static const ProfileStage BUS_PROFILE_STAGES[] = {PROFILE_PROTOCOL, PROFILE_BUTTONS, PROFILE_TOGGLES};
+
+static bool is_bus_stage(uint8_t stage) {
+  return stage == PROFILE_PROTOCOL || stage == PROFILE_BUTTONS || stage == PROFILE_TOGGLES;
+}
+#endif
+
+void BestwaySpa::make_bus_report_(BusReport *report) {
+  // Runs on the bus side, which owns these; the windows restart here once copied
+  report->link = link_;
+  link_.frame_period.take_window_max();
+  report->reply_latency_max_us = reply_latency_max_us_;
+  report->reply_latency_window_us = reply_latency_window_us_;
+  reply_latency_window_us_ = 0;
+  report->heater_stage = heater_stage_;
+  report->temp_rejected = temp_filter_.rejected();
+#ifdef USE_BESTWAY_SPA_PROFILING
+  for (ProfileStage stage : BUS_PROFILE_STAGES) {
+    report->profile[stage] = profile_[stage];
+    profile_[stage].take_window_max();
+  }
+#endif
+}
+
+void BestwaySpa::take_bus_report_(const BusReport &report) {
+  // Keep the worst of every report until loop() publishes and resets the window
+  uint32_t gap_us = std::max(report_.link.frame_period.window_max_us, report.link.frame_period.window_max_us);
+  uint32_t latency_us = std::max(report_.reply_latency_window_us, report.reply_latency_window_us);
+#ifdef USE_BESTWAY_SPA_PROFILING
+  uint32_t stage_us[PROFILE_STAGE_COUNT];
+  for (ProfileStage stage : BUS_PROFILE_STAGES) {
+    stage_us[stage] = std::max(report_.profile[stage].window_max_us, report.profile[stage].window_max_us);
+  }
+#endif
+
+  report_ = report;
+  report_.link.frame_period.window_max_us = gap_us;
+  report_.reply_latency_window_us = latency_us;
+#ifdef USE_BESTWAY_SPA_PROFILING
+  for (ProfileStage stage : BUS_PROFILE_STAGES) {
+    report_.profile[stage].window_max_us = stage_us[stage];
+  }
+#endif
+}
+
+// =============================================================================
+// BUS TASK (ESP32)
+// =============================================================================
+
+#ifdef USE_BESTWAY_SPA_BUS_TASK
+static const uint32_t BUS_TASK_STACK_SIZE = 4096;
+static const UBaseType_t BUS_TASK_PRIORITY = 5;
+
+void BestwaySpa::start_bus_task_() {
+  // Run on the core that loop() is not on, away from WiFi/API/OTA work
+  BaseType_t core = xPortGetCoreID() == 0 ? 1 : 0;
+  if (xTaskCreatePinnedToCore(bus_task_fn_, tag_, BUS_TASK_STACK_SIZE, this, BUS_TASK_PRIORITY, &bus_task_,
+                              core) != pdPASS) {
+    bus_task_ = nullptr;
+    ESP_LOGE(tag_, "Could not start the bus task, running the bus from loop()");
+    return;
+  }
+  ESP_LOGCONFIG(tag_, "Bus task running on core %d", (int) core);
+}
+
+void BestwaySpa::bus_task_fn_(void *arg) {
+  auto *spa = static_cast<BestwaySpa *>(arg);
+  SpaSnapshot sent;
+  bool sent_once = false;
+
+  for (;;) {
+    if (!spa->paused_) {
+      BusCommand cmd;
+      while (spa->bus_commands_.pop(cmd)) {
+        spa->apply_bus_command_(cmd);
+      }
+      spa->run_bus_(millis());
+
+      // One report in flight at a time; until loop() takes it the windows
+      // keep collecting here
+      if (spa->bus_reports_.empty()) {
+        BusReport report;
+        spa->make_bus_report_(&report);
+        spa->bus_reports_.push(report);
+      }
+
+      // Hand a snapshot to loop() whenever something changed; if the queue is
+      // full the next pass tries again
+      SpaSnapshot snap = spa->state_.snapshot();
+      if (!sent_once || snap.diff(sent) != 0) {
+        if (spa->bus_states_.push(spa->state_)) {
+          sent = snap;
+          sent_once = true;
+        }
+      }
+    }
+    vTaskDelay(1);
+  }
+}
+#endif  // USE_BESTWAY_SPA_BUS_TASK
+
+bool BestwaySpa::defer_to_bus_(BusCommandType type, int16_t value) {
+  return defer_to_bus_(BusCommand{type, value, {}});
+}
+
+bool BestwaySpa::defer_to_bus_(const BusCommand &cmd) {
+#ifdef USE_BESTWAY_SPA_BUS_TASK
+  // Calls from loop() are forwarded; the bus task runs them itself
+  if (bus_task_ != nullptr && xTaskGetCurrentTaskHandle() != bus_task_) {
+    if (!bus_commands_.push(cmd)) {
+      ESP_LOGW(tag_, "Bus command queue full, dropped command %u", (unsigned) cmd.type);
+    }
+    return true;
+  }
+#else
+  (void) cmd;
+#endif
+  return false;
+}
+
+void BestwaySpa::apply_bus_command_(const BusCommand &cmd) {
+  switch (cmd.type) {
+    case BUS_CMD_POWER:
+      set_power(cmd.value);
+      break;
+    case BUS_CMD_HEATER:
+      set_heater(cmd.value);
+      break;
+    case BUS_CMD_FILTER:
+      set_filter(cmd.value);
+      break;
+    case BUS_CMD_BUBBLES:
+      set_bubbles(cmd.value);
+      break;
+    case BUS_CMD_JETS:
+      set_jets(cmd.value);
+      break;
+    case BUS_CMD_LOCK:
+      set_lock(cmd.value);
+      break;
+    case BUS_CMD_UNIT:
+      set_unit(cmd.value);
+      break;
+    case BUS_CMD_TARGET:
+      set_target_temp(cmd.value / 10.0f);
+      break;
+    case BUS_CMD_ADJUST_TARGET:
+      adjust_target_temp((int8_t) cmd.value);
+      break;
+    case BUS_CMD_TIMER:
+      set_timer((uint8_t) cmd.value);
+      break;
+    case BUS_CMD_BRIGHTNESS:
+      set_brightness((uint8_t) cmd.value);
+      break;
+    case BUS_CMD_APPLY_STATE:
+      apply_state(cmd.desired);
+      break;
+    case BUS_CMD_DUMP_CAPTURE:
+      dump_capture();
+      break;
+    default:
+      break;
   }
 }
 
@@ -224,10 +624,10 @@ void BestwaySpa::loop() {
 // =============================================================================
 
 void BestwaySpa::dump_config() {
-  ESP_LOGCONFIG(TAG, "Bestway Spa:");
+  ESP_LOGCONFIG(tag_, "Bestway Spa:");
 
   const char *proto_str;
-  switch (protocol_type_) {
+  switch (get_protocol_type()) {
     case PROTOCOL_4WIRE:
       proto_str = "4-wire UART";
       break;
@@ -240,10 +640,16 @@ void BestwaySpa::dump_config() {
     default:
       proto_str = "unknown";
   }
-  ESP_LOGCONFIG(TAG, "  Protocol: %s", proto_str);
+  ESP_LOGCONFIG(tag_, "  Protocol: %s", proto_str);
+  if (instance_count_ > 1) {
+    ESP_LOGCONFIG(tag_, "  Instance: %u of %u", instance_index_, instance_count_);
+  }
+  if (get_protocol_type() != PROTOCOL_4WIRE) {
+    ESP_LOGCONFIG(tag_, "  Passive Mode: %s", passive_mode_ ? "yes" : "no");
+  }
 
   const char *model_str;
-  switch (model_) {
+  switch (get_model()) {
     case MODEL_PRE2021:
       model_str = "PRE2021";
       break;
@@ -271,22 +677,409 @@ void BestwaySpa::dump_config() {
     default:
       model_str = "unknown";
   }
-  ESP_LOGCONFIG(TAG, "  Model: %s", model_str);
-  ESP_LOGCONFIG(TAG, "  Has Jets: %s", has_jets() ? "yes" : "no");
-  ESP_LOGCONFIG(TAG, "  Has Air: %s", has_air() ? "yes" : "no");
-
-  if (protocol_type_ != PROTOCOL_4WIRE) {
+  ESP_LOGCONFIG(tag_, "  Model: %s", model_str);
+#ifdef USE_BESTWAY_SPA_DETECT
+  if (detect_) {
+    const char *detect_str = detecting_              ? "running"
+                             : detection_from_flash_ ? "saved result"
+                             : detector_.protocol_known() ? "detected"
+                                                          : "nothing found, configured model";
+    ESP_LOGCONFIG(tag_, "  Detection: %s (timeout %us)", detect_str, (unsigned) (detect_timeout_ / 1000));
+  }
+#endif
+  ESP_LOGCONFIG(tag_, "  Temperature Deadband: %.1f", temperature_deadband_);
+  ESP_LOGCONFIG(tag_, "  Heartbeat Interval: %us", (unsigned) (heartbeat_interval_ / 1000));
+#ifdef USE_BESTWAY_SPA_4WIRE
+  if (get_protocol_type() == PROTOCOL_4WIRE) {
+    const TempFilterConfig &filter = temp_filter_.config();
+    ESP_LOGCONFIG(tag_, "  Temperature Filter: median %u, EMA 1/%u, max jump %u, %u outliers dropped",
+                  filter.window, 1u << filter.ema_shift, filter.max_jump, (unsigned) report_.temp_rejected);
+  }
+#endif
+  ESP_LOGCONFIG(tag_, "  Has Jets: %s", has_jets() ? "yes" : "no");
+  ESP_LOGCONFIG(tag_, "  Has Air: %s", has_air() ? "yes" : "no");
+#ifdef USE_BESTWAY_SPA_4WIRE
+  if (get_protocol_type() == PROTOCOL_4WIRE && report_.reply_latency_max_us != 0) {
+    ESP_LOGCONFIG(tag_, "  Max Reply Latency: %.1fms", report_.reply_latency_max_us / 1000.0f);
+  }
+#endif
+  if (get_protocol_type() != PROTOCOL_4WIRE && !passive_mode_) {
+    ESP_LOGCONFIG(tag_, "  Button Queue: %u slots", (unsigned) button_queue_.capacity());
+  }
+
+  if (get_protocol_type() != PROTOCOL_4WIRE) {
+#ifdef USE_BESTWAY_SPA_6WIRE
+    if (transport_ != nullptr)
+      ESP_LOGCONFIG(tag_, "  Transport: %s", transport_->is_blocking() ? "bit-bang" : "hardware");
+#endif
     if (clk_pin_ != nullptr)
-      ESP_LOGCONFIG(TAG, "  CLK Pin: GPIO%d", clk_pin_->get_pin());
+      ESP_LOGCONFIG(tag_, "  CLK Pin: GPIO%d", clk_pin_->get_pin());
     if (data_pin_ != nullptr)
-      ESP_LOGCONFIG(TAG, "  DATA Pin: GPIO%d", data_pin_->get_pin());
+      ESP_LOGCONFIG(tag_, "  DATA Pin: GPIO%d", data_pin_->get_pin());
     if (cs_pin_ != nullptr)
-      ESP_LOGCONFIG(TAG, "  CS Pin: GPIO%d", cs_pin_->get_pin());
-  }
+      ESP_LOGCONFIG(tag_, "  CS Pin: GPIO%d", cs_pin_->get_pin());
+  }
+
+  const uint32_t *link = report_.link.counters;
+  ESP_LOGCONFIG(tag_, "  Link: %u frames in, %u out, %u checksum errors, %u bytes discarded, %u timeouts, %u bad reads",
+                (unsigned) link[LINK_FRAMES_RX], (unsigned) link[LINK_FRAMES_TX], (unsigned) link[LINK_CHECKSUM_ERRORS],
+                (unsigned) link[LINK_BYTES_DISCARDED], (unsigned) link[LINK_TIMEOUTS], (unsigned) link[LINK_BAD_READS]);
+  const StageStats &period = report_.link.frame_period;
+  if (period.count != 0) {
+    ESP_LOGCONFIG(tag_, "  Frame Period: %.1f/%.1f/%.1fms (min/mean/max)", period.min_us / 1000.0f,
+                  period.mean_us() / 1000.0f, period.max_us / 1000.0f);
+  }
+#ifdef USE_BESTWAY_SPA_6WIRE
+  if (passive_mode_ && sniffer_ != nullptr && sniffer_->frames_dropped != 0) {
+    ESP_LOGCONFIG(tag_, "  Sniffer: %u frames dropped", (unsigned) sniffer_->frames_dropped);
+  }
+#endif
+
+#ifdef USE_BESTWAY_SPA_CAPTURE
+  ESP_LOGCONFIG(tag_, "  Frame Capture: %u records", (unsigned) capture_.capacity());
+#endif
+#ifdef USE_BESTWAY_SPA_ENERGY
+  ESP_LOGCONFIG(tag_, "  Energy Save Interval: %us", (unsigned) (energy_save_interval_ / 1000));
+  for (uint8_t i = 0; i < ENERGY_LOAD_COUNT; i++) {
+    ESP_LOGCONFIG(tag_, "  %s Power: %uW, %.3f kWh", ENERGY_LOAD_NAMES[i], (unsigned) load_power_[i],
+                  energy_.watt_ms[i] / WATT_MS_PER_KWH);
+  }
+#endif
+#ifdef USE_BESTWAY_SPA_PLANNER
+  ESP_LOGCONFIG(tag_, "  Heating Planner: %u price windows, default price %.3f", (unsigned) price_window_count_,
+                default_price_);
+  for (size_t i = 0; i < price_window_count_; i++) {
+    const PriceWindow &w = price_windows_[i];
+    ESP_LOGCONFIG(tag_, "    %02u:%02u-%02u:%02u %.3f", w.start_minute / 60, w.start_minute % 60, w.end_minute / 60,
+                  w.end_minute % 60, w.price);
+  }
+#endif
+#ifdef USE_BESTWAY_SPA_PROFILING
+  dump_profile_();
+#endif
 
   LOG_CLIMATE("", "Bestway Spa Climate", this);
 }
 
+void BestwaySpa::publish_link_quality_(uint32_t now) {
+  if (now - last_link_publish_ < link_interval_) {
+    return;
+  }
+  last_link_publish_ = now;
+
+  for (uint8_t i = 0; i < LINK_COUNTER_COUNT; i++) {
+    if (link_sensors_[i] != nullptr)
+      link_sensors_[i]->publish_state(report_.link.counters[i]);
+  }
+  // Longest gap between frames over the last interval, in ms
+  uint32_t gap_us = report_.link.frame_period.take_window_max();
+  if (frame_period_sensor_ != nullptr && gap_us != 0)
+    frame_period_sensor_->publish_state(gap_us / 1000.0f);
+}
+
+#ifdef USE_BESTWAY_SPA_PROFILING
+static const char *const PROFILE_STAGE_NAMES[PROFILE_STAGE_COUNT] = {
+    "loop", "protocol", "button queue", "toggles", "climate", "sensors",
+};
+
+void BestwaySpa::dump_profile_() {
+  ESP_LOGCONFIG(tag_, "  Profiling (us, min/mean/max, histogram <128 <256 ... <8192 more):");
+  for (uint8_t i = 0; i < PROFILE_STAGE_COUNT; i++) {
+    const StageStats &st = is_bus_stage(i) ? report_.profile[i] : profile_[i];
+    if (st.count == 0) {
+      ESP_LOGCONFIG(tag_, "    %-12s no samples", PROFILE_STAGE_NAMES[i]);
+      continue;
+    }
+    ESP_LOGCONFIG(tag_, "    %-12s %u/%u/%u over %u, %u %u %u %u %u %u %u %u", PROFILE_STAGE_NAMES[i],
+                  (unsigned) st.min_us, (unsigned) st.mean_us(), (unsigned) st.max_us, (unsigned) st.count,
+                  (unsigned) st.buckets[0], (unsigned) st.buckets[1], (unsigned) st.buckets[2],
+                  (unsigned) st.buckets[3], (unsigned) st.buckets[4], (unsigned) st.buckets[5],
+                  (unsigned) st.buckets[6], (unsigned) st.buckets[7]);
+  }
+}
+
+void BestwaySpa::publish_profile_(uint32_t now) {
+  if (now - last_profile_publish_ < profile_interval_) {
+    return;
+  }
+  last_profile_publish_ = now;
+
+  // Each sensor reports the worst case of its stage over the last interval, in ms
+  for (uint8_t i = 0; i < PROFILE_STAGE_COUNT; i++) {
+    uint32_t max_us = is_bus_stage(i) ? report_.profile[i].take_window_max() : profile_[i].take_window_max();
+    if (profile_sensors_[i] != nullptr)
+      profile_sensors_[i]->publish_state(max_us / 1000.0f);
+  }
+  ESP_LOGD(tag_, "Loop time mean %uus, max %uus", (unsigned) profile_[PROFILE_LOOP].mean_us(),
+           (unsigned) profile_[PROFILE_LOOP].max_us);
+}
+#endif  // USE_BESTWAY_SPA_PROFILING
+
+void BestwaySpa::on_shutdown() {
+  if (restore_state_ && shown_.confirmed) {
+    save_state_(millis(), true);
+  }
+#ifdef USE_BESTWAY_SPA_ENERGY
+  save_energy_();
+#endif
+}
+
+// =============================================================================
+// STATE SNAPSHOTS
+// =============================================================================
+
+SpaSnapshot SpaState::snapshot() const {
+  SpaSnapshot snap;
+  snap.flags = (heater_red ? FIELD_HEATING : 0) | (filter_pump ? FIELD_FILTER : 0) | (bubbles ? FIELD_BUBBLES : 0) |
+               (jets ? FIELD_JETS : 0) | (locked ? FIELD_LOCKED : 0) | (power ? FIELD_POWER : 0) |
+               (heater_enabled ? FIELD_HEATER_ENABLED : 0) | (heater_green ? FIELD_HEATER_GREEN : 0) |
+               (unit_celsius ? FIELD_UNIT : 0) | (timer_active ? FIELD_TIMER : 0) |
+               (confirmed ? FIELD_CONFIRMED : 0);
+  snap.current_x10 = current_x10;
+  snap.target_x10 = target_x10;
+  snap.error_code = error_code;
+  snap.timer_hours = timer_hours;
+  snap.brightness = brightness;
+  memcpy(snap.display_chars, display_chars, sizeof(snap.display_chars));
+  return snap;
+}
+
+void SpaState::set_flags(uint16_t flags, uint16_t mask) {
+  flags &= mask;
+  if (mask & FIELD_HEATING)
+    heater_red = flags & FIELD_HEATING;
+  if (mask & FIELD_FILTER)
+    filter_pump = flags & FIELD_FILTER;
+  if (mask & FIELD_BUBBLES)
+    bubbles = flags & FIELD_BUBBLES;
+  if (mask & FIELD_JETS)
+    jets = flags & FIELD_JETS;
+  if (mask & FIELD_LOCKED)
+    locked = flags & FIELD_LOCKED;
+  if (mask & FIELD_POWER)
+    power = flags & FIELD_POWER;
+  if (mask & FIELD_HEATER_ENABLED)
+    heater_enabled = flags & FIELD_HEATER_ENABLED;
+  if (mask & FIELD_HEATER_GREEN)
+    heater_green = flags & FIELD_HEATER_GREEN;
+  if (mask & FIELD_UNIT)
+    unit_celsius = flags & FIELD_UNIT;
+  if (mask & FIELD_TIMER)
+    timer_active = flags & FIELD_TIMER;
+  if (mask & FIELD_CONFIRMED)
+    confirmed = flags & FIELD_CONFIRMED;
+}
+
+uint16_t SpaSnapshot::diff(const SpaSnapshot &other) const {
+  uint16_t fields = flags ^ other.flags;
+  if (current_x10 != other.current_x10)
+    fields |= FIELD_CURRENT_TEMP;
+  if (target_x10 != other.target_x10)
+    fields |= FIELD_TARGET_TEMP;
+  if (error_code != other.error_code)
+    fields |= FIELD_ERROR;
+  if (timer_hours != other.timer_hours)
+    fields |= FIELD_TIMER;
+  if (brightness != other.brightness)
+    fields |= FIELD_BRIGHTNESS;
+  if (memcmp(display_chars, other.display_chars, sizeof(display_chars)) != 0)
+    fields |= FIELD_DISPLAY;
+  return fields;
+}
+
+void SpaSnapshot::merge(const SpaSnapshot &src, uint16_t fields) {
+  uint16_t mask = fields & FLAG_FIELDS;
+  flags = (flags & ~mask) | (src.flags & mask);
+  if (fields & FIELD_CURRENT_TEMP)
+    current_x10 = src.current_x10;
+  if (fields & FIELD_TARGET_TEMP)
+    target_x10 = src.target_x10;
+  if (fields & FIELD_ERROR)
+    error_code = src.error_code;
+  if (fields & FIELD_TIMER)
+    timer_hours = src.timer_hours;
+  if (fields & FIELD_BRIGHTNESS)
+    brightness = src.brightness;
+  if (fields & FIELD_DISPLAY)
+    memcpy(display_chars, src.display_chars, sizeof(display_chars));
+}
+
+// =============================================================================
+// LAST-KNOWN STATE
+// =============================================================================
+
+void BestwaySpa::restore_state_from_flash_() {
+  state_pref_ = global_preferences->make_preference<SavedSpaState>(this->get_object_id_hash() ^ STATE_PREF_HASH);
+  SavedSpaState saved{};
+  if (!state_pref_.load(&saved)) {
+    return;
+  }
+  state_.set_flags(saved.flags, SAVED_FIELDS & FLAG_FIELDS);
+  state_.current_x10 = saved.current_x10;
+  state_.target_x10 = saved.target_x10;
+  state_.brightness = saved.brightness;
+  saved_state_ = state_.snapshot();
+  ESP_LOGD(tag_, "Restored last state: temp=%.1f target=%.1f power=%d", state_.current_temp(),
+           state_.target_temp(), state_.power);
+}
+
+void BestwaySpa::save_state_(uint32_t now, bool force) {
+  if (!force && now - last_state_save_ < STATE_SAVE_INTERVAL_MS) {
+    return;
+  }
+  last_state_save_ = now;
+  SpaSnapshot snap = shown_.snapshot();
+  if ((snap.diff(saved_state_) & SAVED_FIELDS) == 0) {
+    return;
+  }
+  SavedSpaState saved{};
+  saved.flags = snap.flags & SAVED_FIELDS;
+  saved.current_x10 = snap.current_x10;
+  saved.target_x10 = snap.target_x10;
+  saved.brightness = snap.brightness;
+  if (state_pref_.save(&saved)) {
+    saved_state_ = snap;
+    ESP_LOGV(tag_, "Saved last state");
+  }
+}
+
+bool BestwaySpa::publish_ready_(uint32_t now) {
+  if (shown_.confirmed || stale_published_) {
+    return true;
+  }
+  if (now - setup_time_ < restore_timeout_) {
+    return false;
+  }
+  // Nothing heard from the spa: show the last known state rather than nothing
+  ESP_LOGW(tag_, "No frames from the spa after %us, publishing last known state", (unsigned) (restore_timeout_ / 1000));
+  stale_published_ = true;
+  return true;
+}
+
+// =============================================================================
+// ENERGY ACCOUNTING
+// =============================================================================
+
+#ifdef USE_BESTWAY_SPA_ENERGY
+void BestwaySpa::setup_energy_() {
+  energy_pref_ = global_preferences->make_preference<EnergyTotals>(this->get_object_id_hash() ^ ENERGY_PREF_HASH);
+  if (energy_pref_.load(&energy_)) {
+    ESP_LOGD(tag_, "Restored energy totals");
+  } else {
+    energy_ = EnergyTotals{};
+  }
+  energy_saved_ = energy_;
+  last_energy_update_ = last_energy_save_ = millis();
+}
+
+void BestwaySpa::update_energy_(uint32_t now) {
+  // A restored or default state says nothing about what is running; start
+  // counting from the pass the bus first confirms it
+  if (!shown_.confirmed) {
+    last_energy_update_ = now;
+    return;
+  }
+
+  // Integrate on every pass so short runs between sensor ticks still count
+  uint32_t dt = now - last_energy_update_;
+  last_energy_update_ = now;
+
+  uint32_t heater = shown_.heater_red ? load_power_[ENERGY_HEATER] : 0;
+#ifdef USE_BESTWAY_SPA_4WIRE
+  // The first 10 s of staged start-up run one of the two elements
+  if (get_protocol_type() == PROTOCOL_4WIRE && report_.heater_stage == 1) {
+    heater /= 2;
+  }
+#endif
+  energy_.watt_ms[ENERGY_HEATER] += (uint64_t) heater * dt;
+  if (shown_.filter_pump)
+    energy_.watt_ms[ENERGY_PUMP] += (uint64_t) load_power_[ENERGY_PUMP] * dt;
+  if (shown_.bubbles)
+    energy_.watt_ms[ENERGY_BUBBLES] += (uint64_t) load_power_[ENERGY_BUBBLES] * dt;
+  if (shown_.jets && has_jets())
+    energy_.watt_ms[ENERGY_JETS] += (uint64_t) load_power_[ENERGY_JETS] * dt;
+
+  if (now - last_energy_publish_ >= ENERGY_PUBLISH_INTERVAL_MS) {
+    last_energy_publish_ = now;
+    publish_energy_();
+  }
+
+  // Flash writes are batched; only write when a counter moved
+  if (energy_save_interval_ > 0 && now - last_energy_save_ >= energy_save_interval_) {
+    last_energy_save_ = now;
+    save_energy_();
+  }
+}
+
+void BestwaySpa::publish_energy_() {
+  uint64_t total = 0;
+  for (uint8_t i = 0; i < ENERGY_LOAD_COUNT; i++) {
+    total += energy_.watt_ms[i];
+    if (energy_sensors_[i] != nullptr)
+      energy_sensors_[i]->publish_state(energy_.watt_ms[i] / WATT_MS_PER_KWH);
+  }
+  if (total_energy_sensor_ != nullptr)
+    total_energy_sensor_->publish_state(total / WATT_MS_PER_KWH);
+}
+
+void BestwaySpa::save_energy_() {
+  if (memcmp(&energy_, &energy_saved_, sizeof(EnergyTotals)) == 0) {
+    return;
+  }
+  if (energy_pref_.save(&energy_)) {
+    energy_saved_ = energy_;
+    ESP_LOGV(tag_, "Saved energy totals");
+  }
+}
+#endif  // USE_BESTWAY_SPA_ENERGY
+
+// =============================================================================
+// FRAME CAPTURE
+// =============================================================================
+
+#ifdef USE_BESTWAY_SPA_CAPTURE
+static const size_t CAPTURE_LINE_BYTES = 32;
+
+static void log_capture_line(const char *tag, unsigned index, const uint8_t *data, size_t len) {
+  ESP_LOGI(tag, "capture %03u: %s", index, format_hex(data, len).c_str());
+}
+#endif
+
+void BestwaySpa::dump_capture() {
+  if (defer_to_bus_(BUS_CMD_DUMP_CAPTURE, 0)) return;
+
+#ifdef USE_BESTWAY_SPA_CAPTURE
+  // Serialize oldest first and log in fixed-size hex lines; the replay tool
+  // stitches the lines back together by index
+  uint8_t line[CAPTURE_LINE_BYTES + CAPTURE_RECORD_MAX];
+  encode_capture_header(get_protocol_type(), get_model(), line);
+  size_t fill = CAPTURE_HEADER_LEN;
+  size_t total = 0;
+  unsigned index = 0;
+  uint32_t prev_time = 0;
+
+  ESP_LOGI(tag_, "capture begin: %u records", (unsigned) capture_.size());
+  for (size_t i = 0; i < capture_.size(); i++) {
+    const CaptureRecord &rec = capture_[i];
+    fill += encode_capture_record(rec, prev_time, line + fill);
+    prev_time = rec.time_ms;
+    if (fill >= CAPTURE_LINE_BYTES) {
+      log_capture_line(tag_, index++, line, CAPTURE_LINE_BYTES);
+      total += CAPTURE_LINE_BYTES;
+      fill -= CAPTURE_LINE_BYTES;
+      memmove(line, line + CAPTURE_LINE_BYTES, fill);
+    }
+  }
+  if (fill > 0) {
+    log_capture_line(tag_, index++, line, fill);
+    total += fill;
+  }
+  ESP_LOGI(tag_, "capture end: %u lines, %u bytes", index, (unsigned) total);
+#else
+  ESP_LOGW(tag_, "Frame capture is not enabled, set capture_size to use it");
+#endif
+}
+
 // =============================================================================
 // CLIMATE TRAITS
 // =============================================================================
@@ -297,7 +1090,7 @@ climate::ClimateTraits BestwaySpa::traits() {
   traits.set_supports_two_point_target_temperature(false);
 
   // Temperature range depends on unit
-  if (state_.unit_celsius) {
+  if (shown_.unit_celsius) {
     traits.set_visual_min_temperature(20.0f);
     traits.set_visual_max_temperature(40.0f);
   } else {
@@ -320,23 +1113,26 @@ climate::ClimateTraits BestwaySpa::traits() {
 // =============================================================================
 
 void BestwaySpa::control(const climate::ClimateCall &call) {
+  // Mode and target go out as one transaction so their presses are planned together
+  DesiredState desired;
+
   if (call.get_mode().has_value()) {
     climate::ClimateMode mode = *call.get_mode();
 
     switch (mode) {
       case climate::CLIMATE_MODE_OFF:
-        set_heater(false);
-        set_filter(false);
+        desired.set(DESIRED_HEATER, false);
+        desired.set(DESIRED_FILTER, false);
         break;
 
       case climate::CLIMATE_MODE_HEAT:
-        set_heater(true);
-        set_filter(true);
+        desired.set(DESIRED_HEATER, true);
+        desired.set(DESIRED_FILTER, true);
         break;
 
       case climate::CLIMATE_MODE_FAN_ONLY:
-        set_heater(false);
-        set_filter(true);
+        desired.set(DESIRED_HEATER, false);
+        desired.set(DESIRED_FILTER, true);
         break;
 
       default:
@@ -345,8 +1141,11 @@ void BestwaySpa::control(const climate::ClimateCall &call) {
   }
 
   if (call.get_target_temperature().has_value()) {
-    float new_target = *call.get_target_temperature();
-    set_target_temp(new_target);
+    desired.set_target(*call.get_target_temperature());
+  }
+
+  if (desired.fields != 0) {
+    apply_state(desired);
   }
 }
 
@@ -354,146 +1153,207 @@ void BestwaySpa::control(const climate::ClimateCall &call) {
 // 4-WIRE UART PROTOCOL HANDLER
 // =============================================================================
 
+#ifdef USE_BESTWAY_SPA_4WIRE
+
 void BestwaySpa::handle_4wire_protocol_() {
-  // Read available bytes from UART
-  while (available()) {
-    uint8_t byte;
-    read_byte(&byte);
-    rx_buffer_.push_back(byte);
+  // Drain everything the UART has buffered, parsing frames as we go so a
+  // backlog after a stall is cleared in a single loop() pass. The reply goes
+  // out from process_4wire_frames_() as soon as a frame is found.
+  size_t frames = 0;
+  int avail;
+  while ((avail = available()) > 0) {
+    if (rx_buffer_.free_space() == 0) {
+      rx_buffer_.compact();
+    }
+    size_t chunk = std::min((size_t) avail, rx_buffer_.free_space());
+    if (chunk == 0) {
+      // Full buffer without a single frame in it - line noise
+      ESP_LOGV(tag_, "4-wire buffer full, discarding %u bytes", (unsigned) rx_buffer_.size());
+      link_.count(LINK_BYTES_DISCARDED, rx_buffer_.size());
+      rx_buffer_.clear();
+      continue;
+    }
+    read_array(rx_buffer_.write_ptr(), chunk);
+    rx_buffer_.commit(chunk);
     last_packet_time_ = millis();
-  }
 
-  // Process complete packets (7-byte fixed format)
-  if (rx_buffer_.size() >= 7) {
-    // Check for valid packet start/end markers
-    if (rx_buffer_[0] == 0xFF && rx_buffer_[6] == 0xFF) {
-      // Validate checksum
-      uint8_t calc_sum = rx_buffer_[1] + rx_buffer_[2] + rx_buffer_[3] + rx_buffer_[4];
-      if (calc_sum == rx_buffer_[5]) {
-        parse_4wire_packet_(rx_buffer_);
-        new_packet_available_ = true;
-      } else {
-        ESP_LOGW(TAG, "4-wire checksum mismatch: calc=%02X, recv=%02X", calc_sum, rx_buffer_[5]);
-      }
-      rx_buffer_.erase(rx_buffer_.begin(), rx_buffer_.begin() + 7);
-    } else {
-      // Invalid packet, skip first byte
-      rx_buffer_.erase(rx_buffer_.begin());
-    }
+    frames += process_4wire_frames_();
   }
 
   // Clear buffer on timeout
   if (!rx_buffer_.empty() && (millis() - last_packet_time_) > PACKET_TIMEOUT_MS) {
-    ESP_LOGV(TAG, "4-wire packet timeout, clearing %d bytes", rx_buffer_.size());
+    ESP_LOGV(tag_, "4-wire packet timeout, clearing %u bytes", (unsigned) rx_buffer_.size());
+    link_.count(LINK_TIMEOUTS);
     rx_buffer_.clear();
   }
 
-  // Send response if we have pending commands
-  if (new_packet_available_) {
-    send_4wire_response_();
-    new_packet_available_ = false;
+  if (frames > 1) {
+    ESP_LOGV(tag_, "4-wire processed %u frames in one pass", (unsigned) frames);
   }
+
+  // A frame arriving from here on waits at most until the next pass
+  rx_idle_us_ = micros();
 }
 
-void BestwaySpa::parse_4wire_packet_(const std::vector<uint8_t> &packet) {
-  if (packet.size() < 7) return;
+size_t BestwaySpa::process_4wire_frames_() {
+  size_t frames = 0;
+
+  while (rx_buffer_.size() >= FRAME_4W_LEN) {
+    FrameView frame = rx_buffer_.view(0, FRAME_4W_LEN);
+    FrameCheck check = check_4wire_frame(frame);
+
+    if (check == FRAME_BAD_MARKER) {
+      // Resync: skip to the next candidate start marker in one step
+      size_t skip = find_4wire_resync(rx_buffer_.data(), rx_buffer_.size());
+      link_.count(LINK_BYTES_DISCARDED, skip);
+      rx_buffer_.consume(skip);
+      continue;
+    }
+
+    if (check == FRAME_OK) {
+      // Answer the first good frame of this read before doing anything else;
+      // a backlog of several frames gets a single reply
+      if (frames == 0) {
+        send_4wire_response_();
+      }
+      capture_frame_(CAPTURE_4W_RX, frame.data, frame.len);
+      link_.frame_received(micros());
+      parse_4wire_packet_(frame);
+      frames++;
+    } else {
+      capture_frame_(CAPTURE_4W_RX_BAD, frame.data, frame.len);
+      link_.count(LINK_CHECKSUM_ERRORS);
+      ESP_LOGW(tag_, "4-wire checksum mismatch: calc=%02X, recv=%02X",
+               calculate_checksum(frame.data + 1, 4), frame[5]);
+    }
+    rx_buffer_.consume(FRAME_4W_LEN);
+  }
+
+  return frames;
+}
 
-  // Extract command byte and temperature
-  uint8_t command = packet[1];
-  uint8_t temp_raw = packet[2];
-  uint8_t error = packet[3];
+void BestwaySpa::parse_4wire_packet_(const FrameView &packet) {
+  if (packet.size() < FRAME_4W_LEN) return;
 
-  // Parse temperature (raw value is actual temperature)
-  state_.current_temp = (float)temp_raw;
+  CioStatus4W status;
+  decode_4wire_frame(packet, *model_config_, &status);
+  state_.confirmed = true;
+
+  // Parse temperature (raw value is actual temperature), committed only
+  // once the filter has settled on a new value
+  if (temp_filter_.push(status.temperature)) {
+    state_.current_x10 = (int16_t) (temp_filter_.value() * 10);
+  }
 
   // Parse error code
-  state_.error_code = error;
+  state_.error_code = status.error_code;
 
   // Parse state flags from command byte
-  state_.filter_pump = (command & model_config_->pump_bitmask) != 0;
-  state_.bubbles = (command & model_config_->bubbles_bitmask) != 0;
+  state_.filter_pump = status.filter_pump;
+  state_.bubbles = status.bubbles;
   if (model_config_->has_jets) {
-    state_.jets = (command & model_config_->jets_bitmask) != 0;
+    state_.jets = status.jets;
   }
 
   // Parse heater state (dual stage)
-  bool heat1 = (command & model_config_->heat_bitmask1) != 0;
-  bool heat2 = (command & model_config_->heat_bitmask2) != 0;
-  state_.heater_red = heat1 || heat2;
+  state_.heater_red = status.heater_red;
   state_.heater_green = state_.heater_enabled && !state_.heater_red;
   state_.heater_enabled = state_.heater_red || state_.heater_green;
 
-  ESP_LOGV(TAG, "4-wire: cmd=%02X temp=%d err=%d pump=%d bubbles=%d heat=%d",
-           command, temp_raw, error, state_.filter_pump, state_.bubbles, state_.heater_red);
+  ESP_LOGV(tag_, "4-wire: cmd=%02X temp=%d err=%d pump=%d bubbles=%d heat=%d",
+           status.command, status.temperature, status.error_code, state_.filter_pump, state_.bubbles,
+           state_.heater_red);
 }
 
-void BestwaySpa::send_4wire_response_() {
-  // Build response packet
-  uint8_t packet[7];
-  packet[0] = 0xFF;  // Start marker
-
-  // Command byte with requested states
-  uint8_t command = 0;
-
+void BestwaySpa::refresh_4wire_response_(uint32_t now) {
   // Heater control with staged startup
   if (state_.heater_enabled) {
-    uint32_t now = millis();
     if (heater_stage_ == 0) {
       // Start stage 1
       heater_stage_ = 1;
       stage_start_time_ = now;
-      command |= model_config_->heat_bitmask1;
-    } else if (heater_stage_ == 1) {
-      // Stage 1 active, check if time to advance
-      command |= model_config_->heat_bitmask1;
-      if ((now - stage_start_time_) > 10000) {  // 10 second delay
-        heater_stage_ = 2;
-      }
-    } else {
-      // Both stages active
-      command |= model_config_->heat_bitmask1;
-      command |= model_config_->heat_bitmask2;
+    } else if (heater_stage_ == 1 && (now - stage_start_time_) > 10000) {
+      // Stage 1 active for 10 seconds, switch on both elements
+      heater_stage_ = 2;
     }
   } else {
     heater_stage_ = 0;
   }
 
-  if (state_.filter_pump) {
-    command |= model_config_->pump_bitmask;
-  }
-  if (state_.bubbles) {
-    command |= model_config_->bubbles_bitmask;
-  }
-  if (model_config_->has_jets && state_.jets) {
-    command |= model_config_->jets_bitmask;
+  CioCommand4W cmd;
+  cmd.heater_stage = heater_stage_;
+  cmd.filter_pump = state_.filter_pump;
+  cmd.bubbles = state_.bubbles;
+  cmd.jets = state_.jets;
+  cmd.target_temp = (uint8_t) (state_.target_x10 / 10);
+
+  // Only re-encode when the commanded outputs change
+  if (response_valid_ && cmd == response_cmd_) {
+    return;
   }
+  response_cmd_ = cmd;
+  encode_4wire_response(cmd, *model_config_, response_frame_);
+  response_valid_ = true;
+}
 
-  packet[1] = command;
-  packet[2] = (uint8_t)state_.target_temp;  // Target temperature
-  packet[3] = 0x00;  // Reserved
-  packet[4] = 0x00;  // Reserved
-  packet[5] = packet[1] + packet[2] + packet[3] + packet[4];  // Checksum
-  packet[6] = 0xFF;  // End marker
+void BestwaySpa::send_4wire_response_() {
+  if (!response_valid_) {
+    refresh_4wire_response_(millis());
+  }
+  write_array(response_frame_, FRAME_4W_LEN);
+  link_.count(LINK_FRAMES_TX);
+  capture_frame_(CAPTURE_4W_TX, response_frame_, FRAME_4W_LEN);
+
+  // Upper bound of the frame-to-reply time: the frame cannot have been
+  // complete before the UART was last seen empty
+  if (rx_idle_us_ != 0) {
+    uint32_t latency = micros() - rx_idle_us_;
+    if (latency > reply_latency_max_us_)
+      reply_latency_max_us_ = latency;
+    if (latency > reply_latency_window_us_)
+      reply_latency_window_us_ = latency;
+  }
+}
 
-  write_array(packet, 7);
-  flush();
+void BestwaySpa::publish_reply_latency_(uint32_t now) {
+  if (now - last_latency_publish_ < LATENCY_PUBLISH_INTERVAL_MS) {
+    return;
+  }
+  last_latency_publish_ = now;
+  uint32_t latency_us = report_.reply_latency_window_us;
+  report_.reply_latency_window_us = 0;
+  if (reply_latency_sensor_ != nullptr && latency_us != 0)
+    reply_latency_sensor_->publish_state(latency_us / 1000.0f);
+  if (latency_us > REPLY_LATENCY_WARN_US) {
+    ESP_LOGW(tag_, "4-wire reply took up to %ums", (unsigned) (latency_us / 1000));
+  }
 }
 
+#endif  // USE_BESTWAY_SPA_4WIRE
+
 // =============================================================================
 // 6-WIRE TYPE1 PROTOCOL HANDLER
 // =============================================================================
 
+#ifdef USE_BESTWAY_SPA_6WIRE_T1
+
 void BestwaySpa::handle_6wire_type1_protocol_() {
   uint32_t now = millis();
 
+  bool refresh_due = now - last_dsp_refresh_ >= DSP_REFRESH_INTERVAL_MS;
+  bool poll_due = now - last_button_poll_ >= BUTTON_POLL_INTERVAL_MS;
+  if (!(refresh_due || poll_due) || !acquire_transport_(now)) {
+    return;
+  }
+
   // Refresh DSP display at regular intervals
-  if (now - last_dsp_refresh_ >= DSP_REFRESH_INTERVAL_MS) {
+  if (refresh_due) {
     send_dsp_payload_type1_();
     last_dsp_refresh_ = now;
   }
 
   // Poll for button presses at regular intervals
-  if (now - last_button_poll_ >= BUTTON_POLL_INTERVAL_MS) {
+  if (poll_due) {
     receive_cio_payload_type1_();
     update_states_from_payload_();
     last_button_poll_ = now;
@@ -501,75 +1361,66 @@ void BestwaySpa::handle_6wire_type1_protocol_() {
 }
 
 void BestwaySpa::send_dsp_payload_type1_() {
-  if (cs_pin_ == nullptr || clk_pin_ == nullptr || data_pin_ == nullptr) {
-    ESP_LOGW(TAG, "6-wire pins not configured");
-    return;
-  }
-
-  // Set data pin to output mode
-  data_pin_->pin_mode(gpio::FLAG_OUTPUT);
-
-  // Start transmission - CS low
-  cs_pin_->digital_write(false);
-  delayMicroseconds(10);
+  capture_frame_(CAPTURE_DSP_PAYLOAD, dsp_payload_, T1_PAYLOAD_LEN);
 
   // Send 11-byte payload
-  for (size_t i = 0; i < 11; i++) {
-    send_bits_to_dsp_(dsp_payload_[i], 8);
-  }
-
-  // End transmission - CS high
-  cs_pin_->digital_write(true);
+  transport_->begin();
+  transport_->write(dsp_payload_, T1_PAYLOAD_LEN, BIT_ORDER_MSB);
+  transport_->end();
+  link_.count(LINK_FRAMES_TX);
 }
 
 void BestwaySpa::receive_cio_payload_type1_() {
-  if (cs_pin_ == nullptr || clk_pin_ == nullptr || data_pin_ == nullptr) {
-    return;
+  // Send data read command, then read the 16-bit button code
+  uint8_t cmd[2] = {(get_model() == MODEL_P05504) ? DSP_CMD1_MODE6_11_7_P05504 : DSP_CMD1_MODE6_11_7,
+                    DSP_CMD2_DATAREAD};
+  uint8_t code[2];
+  transport_->begin();
+  transport_->write(cmd, sizeof(cmd), BIT_ORDER_MSB);
+  transport_->read(code, sizeof(code), BIT_ORDER_MSB);
+  transport_->end();
+  uint16_t button_code = (code[0] << 8) | code[1];
+
+  // A floating or shorted DATA line reads as all ones or all zeros
+  if (button_code == 0xFFFF || button_code == 0x0000) {
+    link_.count(LINK_BAD_READS);
+  } else {
+    link_.frame_received(micros());
   }
 
-  // Send command to request button state
-  data_pin_->pin_mode(gpio::FLAG_OUTPUT);
-
-  cs_pin_->digital_write(false);
-  delayMicroseconds(10);
-
-  // Send data read command
-  uint8_t cmd1 = (model_ == MODEL_P05504) ? DSP_CMD1_MODE6_11_7_P05504 : DSP_CMD1_MODE6_11_7;
-  send_bits_to_dsp_(cmd1, 8);
-  send_bits_to_dsp_(DSP_CMD2_DATAREAD, 8);
-
-  // Switch to input mode
-  data_pin_->pin_mode(gpio::FLAG_INPUT);
-  delayMicroseconds(10);
-
-  // Read 16-bit button code
-  uint16_t button_code = receive_bits_from_dsp_(16);
-
-  // End transmission
-  cs_pin_->digital_write(true);
-
   // Store button code if valid
   if (button_code != 0xFFFF) {
+    capture_button_(button_code);
     current_button_code_ = button_code;
-    ESP_LOGV(TAG, "6-wire TYPE1 button code: 0x%04X", button_code);
+    ESP_LOGV(tag_, "6-wire TYPE1 button code: 0x%04X", button_code);
   }
 }
 
+#endif  // USE_BESTWAY_SPA_6WIRE_T1
+
 // =============================================================================
 // 6-WIRE TYPE2 PROTOCOL HANDLER
 // =============================================================================
 
+#ifdef USE_BESTWAY_SPA_6WIRE_T2
+
 void BestwaySpa::handle_6wire_type2_protocol_() {
   uint32_t now = millis();
 
+  bool refresh_due = now - last_dsp_refresh_ >= DSP_REFRESH_INTERVAL_MS;
+  bool poll_due = now - last_button_poll_ >= BUTTON_POLL_INTERVAL_MS;
+  if (!(refresh_due || poll_due) || !acquire_transport_(now)) {
+    return;
+  }
+
   // Refresh DSP display at regular intervals
-  if (now - last_dsp_refresh_ >= DSP_REFRESH_INTERVAL_MS) {
+  if (refresh_due) {
     send_dsp_payload_type2_();
     last_dsp_refresh_ = now;
   }
 
   // Poll for button presses at regular intervals
-  if (now - last_button_poll_ >= BUTTON_POLL_INTERVAL_MS) {
+  if (poll_due) {
     receive_cio_payload_type2_();
     update_states_from_payload_();
     last_button_poll_ = now;
@@ -577,421 +1428,1163 @@ void BestwaySpa::handle_6wire_type2_protocol_() {
 }
 
 void BestwaySpa::send_dsp_payload_type2_() {
+  capture_frame_(CAPTURE_DSP_PAYLOAD, dsp_payload_, T2_PAYLOAD_LEN);
+
+  // Command byte 1, then the 5-byte payload (LSB first for TYPE2)
+  uint8_t cmd1 = TYPE2_CMD1;
+  transport_->begin();
+  transport_->write(&cmd1, 1, BIT_ORDER_MSB);
+  transport_->write(dsp_payload_, T2_PAYLOAD_LEN, BIT_ORDER_LSB);
+  transport_->end();
+  delayMicroseconds(10);
+
+  // Send brightness command
+  uint8_t cmd3 = TYPE2_CMD3 | (state_.brightness & 0x07);
+  transport_->begin();
+  transport_->write(&cmd3, 1, BIT_ORDER_MSB);
+  transport_->end();
+  link_.count(LINK_FRAMES_TX);
+}
+
+void BestwaySpa::receive_cio_payload_type2_() {
+  // Send data read command, then read the 16-bit button code (LSB first for TYPE2)
+  uint8_t cmd2 = TYPE2_CMD2;
+  uint8_t code[2];
+  transport_->begin();
+  transport_->write(&cmd2, 1, BIT_ORDER_MSB);
+  transport_->read(code, sizeof(code), BIT_ORDER_LSB);
+  transport_->end();
+  uint16_t button_code = code[0] | (code[1] << 8);
+
+  // 0x0000 is "no button" on TYPE2, so only all ones points at the wiring
+  if (button_code == 0xFFFF) {
+    link_.count(LINK_BAD_READS);
+  } else {
+    link_.frame_received(micros());
+  }
+
+  // Store button code if valid
+  if (button_code != 0x0000) {
+    capture_button_(button_code);
+    current_button_code_ = button_code;
+    ESP_LOGV(tag_, "6-wire TYPE2 button code: 0x%04X", button_code);
+  }
+}
+
+#endif  // USE_BESTWAY_SPA_6WIRE_T2
+
+// =============================================================================
+// 6-WIRE PASSIVE CAPTURE
+// =============================================================================
+
+#ifdef USE_BESTWAY_SPA_6WIRE
+
+void IRAM_ATTR SnifferStore::gpio_intr_cs(SnifferStore *arg) {
+  if (!arg->cs_pin.digital_read()) {
+    // CS low - start of a new frame
+    arg->shift_byte = 0;
+    arg->shift_bits = 0;
+    arg->shift.len = 0;
+    arg->shift_overflow = false;
+    return;
+  }
+
+  // CS high - frame complete, hand over whole bytes only
+  if (arg->shift.len == 0 || arg->shift_overflow) {
+    return;
+  }
+  arg->shift.time_us = micros();
+  if (!arg->frames.push(arg->shift)) {
+    // loop() has fallen a whole queue behind
+    arg->frames_dropped++;
+  }
+  arg->shift.len = 0;
+}
+
+void IRAM_ATTR SnifferStore::gpio_intr_clk(SnifferStore *arg) {
+  if (arg->cs_pin.digital_read()) {
+    return;  // Not selected
+  }
+
+  arg->shift_byte = (arg->shift_byte << 1) | (arg->data_pin.digital_read() ? 1 : 0);
+
+  if (++arg->shift_bits < 8) {
+    return;
+  }
+  if (arg->shift.len < SNIFF_FRAME_MAX) {
+    arg->shift.data[arg->shift.len++] = arg->shift_byte;
+  } else {
+    arg->shift_overflow = true;
+  }
+  arg->shift_byte = 0;
+  arg->shift_bits = 0;
+}
+
+void BestwaySpa::setup_passive_capture_() {
   if (cs_pin_ == nullptr || clk_pin_ == nullptr || data_pin_ == nullptr) {
-    ESP_LOGW(TAG, "6-wire pins not configured");
+    ESP_LOGW(tag_, "6-wire pins not configured");
     return;
   }
+  start_sniffer_();
 
-  // Set data pin to output mode
-  data_pin_->pin_mode(gpio::FLAG_OUTPUT);
+  dsp_payload_len_ = (get_protocol_type() == PROTOCOL_6WIRE_T1) ? T1_PAYLOAD_LEN : T2_PAYLOAD_LEN;
+}
 
-  // Start transmission - CS low
-  cs_pin_->digital_write(false);
-  delayMicroseconds(10);
+void BestwaySpa::start_sniffer_() {
+  // Only spas that listen in pay for the frame queue
+  if (sniffer_ == nullptr) {
+    sniffer_ = new SnifferStore();
+  }
+
+  // Never drive the bus while listening
+  clk_pin_->setup();
+  clk_pin_->pin_mode(gpio::FLAG_INPUT);
+  data_pin_->setup();
+  data_pin_->pin_mode(gpio::FLAG_INPUT);
+  cs_pin_->setup();
+  cs_pin_->pin_mode(gpio::FLAG_INPUT);
 
-  // Send command byte 1
-  send_bits_to_dsp_(TYPE2_CMD1, 8);
+  sniffer_->data_pin = data_pin_->to_isr();
+  sniffer_->cs_pin = cs_pin_->to_isr();
 
-  // Send 5-byte payload (LSB first for TYPE2)
-  for (size_t i = 0; i < 5; i++) {
-    // TYPE2 sends LSB first
-    uint8_t byte = dsp_payload_[i];
-    for (int bit = 0; bit < 8; bit++) {
-      data_pin_->digital_write((byte >> bit) & 0x01);
-      pulse_clock_();
+  cs_pin_->attach_interrupt(SnifferStore::gpio_intr_cs, sniffer_, gpio::INTERRUPT_ANY_EDGE);
+  clk_pin_->attach_interrupt(SnifferStore::gpio_intr_clk, sniffer_, gpio::INTERRUPT_RISING_EDGE);
+}
+
+void BestwaySpa::stop_sniffer_() {
+  cs_pin_->detach_interrupt();
+  clk_pin_->detach_interrupt();
+  delete sniffer_;
+  sniffer_ = nullptr;
+}
+
+void BestwaySpa::handle_6wire_passive_() {
+  if (sniffer_ == nullptr) {
+    return;  // Pins not configured
+  }
+  // Drain everything the ISR queued since the last pass
+  SniffedFrame frame;
+  while (sniffer_->frames.pop(frame)) {
+    decode_sniffed_frame_(frame);
+  }
+}
+
+void BestwaySpa::decode_sniffed_frame_(const SniffedFrame &sniffed) {
+  const uint8_t *frame = sniffed.data;
+  const uint8_t len = sniffed.len;
+  link_.frame_received(sniffed.time_us);
+  last_packet_time_ = millis();
+
+  if (get_protocol_type() == PROTOCOL_6WIRE_T1) {
+    if (len == T1_PAYLOAD_LEN) {
+      // CIO -> DSP display payload
+      memcpy(cio_payload_, frame, len);
+      cio_payload_len_ = len;
+      capture_frame_(CAPTURE_CIO_PAYLOAD, cio_payload_, len);
+      DisplayStatus status;
+      decode_display_status(cio_payload_, true, &status);
+      decode_display_digits(cio_payload_, true, state_.display_chars);
+      update_states_from_display_(status);
+    } else if (len == 4 && frame[1] == DSP_CMD2_DATAREAD) {
+      // Button read: command pair followed by the 16-bit answer from the DSP
+      uint16_t button_code = (frame[2] << 8) | frame[3];
+      capture_button_(button_code);
+      ESP_LOGV(tag_, "6-wire TYPE1 sniffed button code: 0x%04X", button_code);
+    }
+  } else {
+    // Command bytes are MSB first on the wire, payload and button bytes LSB first
+    if (len == T2_PAYLOAD_LEN + 1 && frame[0] == TYPE2_CMD1) {
+      for (size_t i = 0; i < T2_PAYLOAD_LEN; i++) {
+        cio_payload_[i] = reverse_bits(frame[1 + i]);
+      }
+      cio_payload_len_ = T2_PAYLOAD_LEN;
+      capture_frame_(CAPTURE_CIO_PAYLOAD, cio_payload_, T2_PAYLOAD_LEN);
+      DisplayStatus status;
+      decode_display_status(cio_payload_, false, &status);
+      decode_display_digits(cio_payload_, false, state_.display_chars);
+      update_states_from_display_(status);
+    } else if (len == 3 && frame[0] == TYPE2_CMD2) {
+      uint16_t button_code = reverse_bits(frame[1]) | (reverse_bits(frame[2]) << 8);
+      capture_button_(button_code);
+      ESP_LOGV(tag_, "6-wire TYPE2 sniffed button code: 0x%04X", button_code);
     }
   }
+}
 
-  // End transmission - CS high
-  cs_pin_->digital_write(true);
-  delayMicroseconds(10);
+void BestwaySpa::update_states_from_display_(const DisplayStatus &status) {
+  state_.confirmed = true;
+
+  // Status LEDs as driven by the CIO
+  state_.locked = status.locked;
+  state_.timer_active = status.timer;
+  state_.heater_green = status.heater_green;
+  state_.heater_red = status.heater_red;
+  state_.bubbles = status.bubbles;
+  state_.filter_pump = status.filter_pump;
+  state_.power = status.power;
+  if (has_jets()) {
+    state_.jets = status.jets;
+  }
+  if (status.celsius) {
+    state_.unit_celsius = true;
+  } else if (status.fahrenheit) {
+    state_.unit_celsius = false;
+  }
+  state_.heater_enabled = state_.heater_green || state_.heater_red;
+
+  // Error codes are shown on the digits as "Exx"
+  const char *chars = state_.display_chars;
+  if (chars[0] == 'E' && isdigit(chars[1]) && isdigit(chars[2])) {
+    state_.error_code = (chars[1] - '0') * 10 + (chars[2] - '0');
+  } else {
+    state_.error_code = 0;
+  }
 
-  // Send brightness command
-  cs_pin_->digital_write(false);
-  send_bits_to_dsp_(TYPE2_CMD3 | (state_.brightness & 0x07), 8);
-  cs_pin_->digital_write(true);
+  ESP_LOGV(tag_, "6-wire display: '%s' lock=%d pwr=%d pump=%d bubbles=%d heat=%d/%d",
+           state_.display_chars, state_.locked, state_.power, state_.filter_pump, state_.bubbles,
+           state_.heater_green, state_.heater_red);
 }
 
-void BestwaySpa::receive_cio_payload_type2_() {
-  if (cs_pin_ == nullptr || clk_pin_ == nullptr || data_pin_ == nullptr) {
-    return;
+#endif  // USE_BESTWAY_SPA_6WIRE
+
+// =============================================================================
+// 6-WIRE TRANSPORTS
+// =============================================================================
+
+#ifdef USE_BESTWAY_SPA_6WIRE
+
+bool BestwaySpa::acquire_transport_(uint32_t now) {
+  if (transport_ == nullptr) {
+    return false;
   }
+  return !transport_->is_blocking() || BusScheduler::acquire(now);
+}
 
-  // Send command to request button state
+static const uint32_t BITBANG_HALF_PERIOD_US = 50;
+static const uint32_t CS_SETUP_US = 10;
+
+void BitBangTransport::setup() {
+  clk_pin_->setup();
+  clk_pin_->digital_write(false);  // Clock idle low
+  data_pin_->setup();
   data_pin_->pin_mode(gpio::FLAG_OUTPUT);
+  data_pin_->digital_write(true);  // Data idle high
+  output_ = true;
+  cs_pin_->setup();
+  cs_pin_->digital_write(true);    // CS idle high
+}
 
+void BitBangTransport::begin() {
+  data_pin_->pin_mode(gpio::FLAG_OUTPUT);
+  output_ = true;
   cs_pin_->digital_write(false);
-  delayMicroseconds(10);
-
-  // Send data read command
-  send_bits_to_dsp_(TYPE2_CMD2, 8);
+  delayMicroseconds(CS_SETUP_US);
+}
 
-  // Switch to input mode
-  data_pin_->pin_mode(gpio::FLAG_INPUT);
-  delayMicroseconds(10);
+void BitBangTransport::end() { cs_pin_->digital_write(true); }
 
-  // Read 16-bit button code (LSB first for TYPE2)
-  uint16_t button_code = 0;
-  for (int bit = 0; bit < 16; bit++) {
-    pulse_clock_();
-    if (data_pin_->digital_read()) {
-      button_code |= (1 << bit);
+void BitBangTransport::write(const uint8_t *data, size_t len, BitOrder order) {
+  set_output_(true);
+  for (size_t i = 0; i < len; i++) {
+    uint8_t byte = order == BIT_ORDER_LSB ? reverse_bits(data[i]) : data[i];
+    for (int bit = 7; bit >= 0; bit--) {
+      data_pin_->digital_write((byte >> bit) & 0x01);
+      pulse_clock_();
     }
   }
+}
 
-  // End transmission
-  cs_pin_->digital_write(true);
-
-  // Store button code if valid
-  if (button_code != 0x0000) {
-    current_button_code_ = button_code;
-    ESP_LOGV(TAG, "6-wire TYPE2 button code: 0x%04X", button_code);
+void BitBangTransport::read(uint8_t *data, size_t len, BitOrder order) {
+  set_output_(false);
+  for (size_t i = 0; i < len; i++) {
+    uint8_t byte = 0;
+    for (int bit = 7; bit >= 0; bit--) {
+      pulse_clock_();
+      if (data_pin_->digital_read()) {
+        byte |= (1 << bit);
+      }
+    }
+    data[i] = order == BIT_ORDER_LSB ? reverse_bits(byte) : byte;
   }
 }
 
-// =============================================================================
-// 6-WIRE BIT-BANGING HELPERS
-// =============================================================================
-
-void BestwaySpa::send_bits_to_dsp_(uint32_t data, uint8_t bits) {
-  // Send MSB first (TYPE1 style)
-  for (int i = bits - 1; i >= 0; i--) {
-    data_pin_->digital_write((data >> i) & 0x01);
-    pulse_clock_();
+void BitBangTransport::set_output_(bool output) {
+  if (output == output_) {
+    return;
+  }
+  data_pin_->pin_mode(output ? gpio::FLAG_OUTPUT : gpio::FLAG_INPUT);
+  output_ = output;
+  if (!output) {
+    delayMicroseconds(CS_SETUP_US);  // Let the display take over DATA
   }
 }
 
-uint16_t BestwaySpa::receive_bits_from_dsp_(uint8_t bits) {
-  uint16_t result = 0;
+void BitBangTransport::pulse_clock_() {
+  clk_pin_->digital_write(true);
+  delayMicroseconds(BITBANG_HALF_PERIOD_US);
+  clk_pin_->digital_write(false);
+  delayMicroseconds(BITBANG_HALF_PERIOD_US);
+}
 
-  // Read MSB first (TYPE1 style)
-  for (int i = bits - 1; i >= 0; i--) {
-    pulse_clock_();
-    if (data_pin_->digital_read()) {
-      result |= (1 << i);
-    }
-  }
+#ifdef USE_BESTWAY_SPA_SPI
+void SpiTransport::begin() {
+  this->enable();
+  delayMicroseconds(CS_SETUP_US);
+}
 
-  return result;
+void SpiTransport::write(const uint8_t *data, size_t len, BitOrder order) {
+  for (size_t i = 0; i < len; i++) {
+    this->write_byte(order == BIT_ORDER_LSB ? reverse_bits(data[i]) : data[i]);
+  }
 }
 
-void BestwaySpa::pulse_clock_(uint32_t duration_us) {
-  clk_pin_->digital_write(true);
-  delayMicroseconds(duration_us);
-  clk_pin_->digital_write(false);
-  delayMicroseconds(duration_us);
+void SpiTransport::read(uint8_t *data, size_t len, BitOrder order) {
+  for (size_t i = 0; i < len; i++) {
+    uint8_t byte = this->read_byte();
+    data[i] = order == BIT_ORDER_LSB ? reverse_bits(byte) : byte;
+  }
 }
+#endif  // USE_BESTWAY_SPA_SPI
+
+#endif  // USE_BESTWAY_SPA_6WIRE
 
 // =============================================================================
 // STATE MANAGEMENT
 // =============================================================================
 
+#ifdef USE_BESTWAY_SPA_6WIRE
 void BestwaySpa::update_states_from_payload_() {
-  // Decode button press from current_button_code_
-  const uint16_t *btn_codes;
-  switch (model_) {
-    case MODEL_PRE2021:
-      btn_codes = BTN_CODES_PRE2021;
-      break;
-    case MODEL_P05504:
-      btn_codes = BTN_CODES_P05504;
-      break;
-    case MODEL_54149E:
-      btn_codes = BTN_CODES_54149E;
-      break;
-    default:
-      btn_codes = BTN_CODES_PRE2021;
-      break;
-  }
-
-  // Find which button was pressed
-  for (uint8_t i = 0; i < BTN_COUNT; i++) {
-    if (current_button_code_ == btn_codes[i] && i != NOBTN) {
-      ESP_LOGD(TAG, "Button pressed: %d", i);
-      switch (i) {
-        case LOCK:
-          state_.locked = !state_.locked;
-          break;
-        case POWER:
-          state_.power = !state_.power;
-          break;
-        case HEAT:
-          if (!state_.locked && state_.power) {
-            state_.heater_enabled = !state_.heater_enabled;
-          }
-          break;
-        case PUMP:
-          if (!state_.locked && state_.power) {
-            state_.filter_pump = !state_.filter_pump;
-          }
-          break;
-        case BUBBLES:
-          if (!state_.locked && state_.power) {
-            state_.bubbles = !state_.bubbles;
-          }
-          break;
-        case HYDROJETS:
-          if (!state_.locked && state_.power && has_jets()) {
-            state_.jets = !state_.jets;
-          }
-          break;
-        case UP:
-          if (!state_.locked && state_.power) {
-            state_.target_temp += 1.0f;
-            if (state_.unit_celsius && state_.target_temp > 40.0f)
-              state_.target_temp = 40.0f;
-            if (!state_.unit_celsius && state_.target_temp > 104.0f)
-              state_.target_temp = 104.0f;
-          }
-          break;
-        case DOWN:
-          if (!state_.locked && state_.power) {
-            state_.target_temp -= 1.0f;
-            if (state_.unit_celsius && state_.target_temp < 20.0f)
-              state_.target_temp = 20.0f;
-            if (!state_.unit_celsius && state_.target_temp < 68.0f)
-              state_.target_temp = 68.0f;
-          }
-          break;
-        case UNIT:
-          if (!state_.locked && state_.power) {
-            state_.unit_celsius = !state_.unit_celsius;
-            // Convert temperatures
-            if (state_.unit_celsius) {
-              state_.current_temp = fahrenheit_to_celsius_(state_.current_temp);
-              state_.target_temp = fahrenheit_to_celsius_(state_.target_temp);
-            } else {
-              state_.current_temp = celsius_to_fahrenheit_(state_.current_temp);
-              state_.target_temp = celsius_to_fahrenheit_(state_.target_temp);
-            }
-          }
-          break;
-        case TIMER:
-          if (!state_.locked && state_.power) {
-            state_.timer_active = !state_.timer_active;
+  // Driving the display ourselves, the state is ours once the bus runs
+  state_.confirmed = true;
+
+  // A physical press on the display wins over one held by the press engine
+  uint16_t code = current_button_code_;
+  if (btn_codes_ != nullptr && code == btn_codes_[NOBTN]) {
+    code = virtual_button_code_;
+  }
+
+  // Find which button was pressed, acting on the press edge only so a held
+  // button toggles once
+  Buttons pressed = decode_button_code(btn_codes_, code);
+  bool new_press = pressed != last_pressed_;
+  last_pressed_ = pressed;
+  if (pressed != NOBTN && new_press) {
+    ESP_LOGD(tag_, "Button pressed: %d", pressed);
+    switch (pressed) {
+      case LOCK:
+        state_.locked = !state_.locked;
+        break;
+      case POWER:
+        state_.power = !state_.power;
+        break;
+      case HEAT:
+        if (!state_.locked && state_.power) {
+          state_.heater_enabled = !state_.heater_enabled;
+        }
+        break;
+      case PUMP:
+        if (!state_.locked && state_.power) {
+          state_.filter_pump = !state_.filter_pump;
+        }
+        break;
+      case BUBBLES:
+        if (!state_.locked && state_.power) {
+          state_.bubbles = !state_.bubbles;
+        }
+        break;
+      case HYDROJETS:
+        if (!state_.locked && state_.power && has_jets()) {
+          state_.jets = !state_.jets;
+        }
+        break;
+      case UP:
+        if (!state_.locked && state_.power) {
+          state_.target_x10 += 10;
+          if (state_.unit_celsius && state_.target_x10 > 400)
+            state_.target_x10 = 400;
+          if (!state_.unit_celsius && state_.target_x10 > 1040)
+            state_.target_x10 = 1040;
+        }
+        break;
+      case DOWN:
+        if (!state_.locked && state_.power) {
+          state_.target_x10 -= 10;
+          if (state_.unit_celsius && state_.target_x10 < 200)
+            state_.target_x10 = 200;
+          if (!state_.unit_celsius && state_.target_x10 < 680)
+            state_.target_x10 = 680;
+        }
+        break;
+      case UNIT:
+        if (!state_.locked && state_.power) {
+          state_.unit_celsius = !state_.unit_celsius;
+          // Convert temperatures
+          if (state_.unit_celsius) {
+            state_.set_current_temp(fahrenheit_to_celsius_(state_.current_temp()));
+            state_.set_target_temp(fahrenheit_to_celsius_(state_.target_temp()));
+          } else {
+            state_.set_current_temp(celsius_to_fahrenheit_(state_.current_temp()));
+            state_.set_target_temp(celsius_to_fahrenheit_(state_.target_temp()));
           }
-          break;
-      }
-      break;
+        }
+        break;
+      case TIMER:
+        if (!state_.locked && state_.power) {
+          state_.timer_active = !state_.timer_active;
+        }
+        break;
+      default:
+        break;
     }
   }
 
   // Reset button code
-  current_button_code_ = btn_codes[NOBTN];
+  current_button_code_ = btn_codes_[NOBTN];
 }
+#endif  // USE_BESTWAY_SPA_6WIRE
 
 void BestwaySpa::handle_toggles_() {
-  // Process toggle requests from Home Assistant / automation
+  // Process toggle requests from Home Assistant / automation. Each press is
+  // queued with the state it should produce so the engine can verify it.
 
   if (toggles_.power_pressed) {
-    queue_button_(POWER, 300);
+    queue_button_(POWER, BUTTON_PRESS_MS, POWERSTATE, !state_.power);
     toggles_.power_pressed = false;
   }
 
   if (toggles_.lock_pressed) {
-    queue_button_(LOCK, 300);
+    queue_button_(LOCK, BUTTON_PRESS_MS, LOCKEDSTATE, !state_.locked);
     toggles_.lock_pressed = false;
   }
 
   if (toggles_.heat_pressed) {
-    queue_button_(HEAT, 300);
+    queue_button_(HEAT, BUTTON_PRESS_MS, HEATSTATE, !state_.heater_enabled);
     toggles_.heat_pressed = false;
   }
 
   if (toggles_.pump_pressed) {
-    queue_button_(PUMP, 300);
+    queue_button_(PUMP, BUTTON_PRESS_MS, PUMPSTATE, !state_.filter_pump);
     toggles_.pump_pressed = false;
   }
 
   if (toggles_.bubbles_pressed) {
-    queue_button_(BUBBLES, 300);
+    queue_button_(BUBBLES, BUTTON_PRESS_MS, BUBBLESSTATE, !state_.bubbles);
     toggles_.bubbles_pressed = false;
   }
 
   if (toggles_.jets_pressed && has_jets()) {
-    queue_button_(HYDROJETS, 300);
+    queue_button_(HYDROJETS, BUTTON_PRESS_MS, JETSSTATE, !state_.jets);
     toggles_.jets_pressed = false;
   }
 
   if (toggles_.unit_pressed) {
-    queue_button_(UNIT, 300);
+    queue_button_(UNIT, BUTTON_PRESS_MS, UNITSTATE, !state_.unit_celsius);
     toggles_.unit_pressed = false;
   }
 
   if (toggles_.timer_pressed) {
-    queue_button_(TIMER, 300);
+    queue_button_(TIMER, BUTTON_PRESS_MS, TIMERSTATE, !state_.timer_active);
     toggles_.timer_pressed = false;
   }
 
-  // Handle temperature adjustment
-  if (toggles_.set_target_temp && toggles_.target_temp_delta != 0) {
-    Buttons btn = toggles_.target_temp_delta > 0 ? UP : DOWN;
-    int steps = abs(toggles_.target_temp_delta);
-    for (int i = 0; i < steps; i++) {
-      queue_button_(btn, 300);
+  // Handle temperature adjustment: one queue entry that keeps stepping until
+  // the set-point is reached. An absolute set-point is queued as it is and
+  // replaces a pending one; relative steps build on the pending one.
+  if (toggles_.set_target_abs) {
+    int target = toggles_.target_temp_value;
+    int current = get_state_value_(TARGET_SETPOINT);
+    if (target != current || find_queued_button_(TARGET_SETPOINT) >= 0) {
+      queue_button_(target > current ? UP : DOWN, BUTTON_STEP_MS, TARGET_SETPOINT, target);
+    }
+    toggles_.set_target_abs = false;
+  }
+
+  if (toggles_.set_target_temp) {
+    if (toggles_.target_temp_delta != 0) {
+      Buttons btn = toggles_.target_temp_delta > 0 ? UP : DOWN;
+      // Step on from a set-point that is still being pressed towards
+      int pending = find_queued_button_(TARGET_SETPOINT);
+      int base = pending >= 0 ? button_queue_[pending].target_value : get_state_value_(TARGET_SETPOINT);
+      queue_button_(btn, BUTTON_STEP_MS, TARGET_SETPOINT, base + toggles_.target_temp_delta);
     }
     toggles_.target_temp_delta = 0;
     toggles_.set_target_temp = false;
   }
 }
 
-void BestwaySpa::update_climate_state_() {
-  // Update current temperature
-  this->current_temperature = state_.current_temp;
-  this->target_temperature = state_.target_temp;
+void BestwaySpa::publish_changes_(uint32_t now) {
+  // One snapshot per pass; everything below works out changes from it
+  SpaSnapshot cur = shown_.snapshot();
+  uint16_t changed = changed_fields_(cur);
+  if (changed != 0)
+    ESP_LOGV(tag_, "Changed fields: %04X", changed);
+
+  if (!published_once_ || (heartbeat_interval_ > 0 && now - last_heartbeat_ > heartbeat_interval_)) {
+    // Periodic full republish so Home Assistant recovers from missed updates
+    update_climate_state_(true);
+    update_sensors_(cur, FIELD_ALL);
+    published_once_ = true;
+    last_heartbeat_ = now;
+    last_state_update_ = now;
+    last_sensor_update_ = now;
+    return;
+  }
+
+  // Critical changes go out immediately, everything else on the regular tick
+  bool critical = (changed & CRITICAL_FIELDS) != 0;
+
+  if (critical || now - last_state_update_ > STATE_UPDATE_INTERVAL_MS) {
+    update_climate_state_(false);
+    last_state_update_ = now;
+  }
+
+  if (changed != 0 && (critical || now - last_sensor_update_ > SENSOR_UPDATE_INTERVAL_MS)) {
+    update_sensors_(cur, changed);
+    last_sensor_update_ = now;
+  }
+}
+
+uint16_t BestwaySpa::changed_fields_(const SpaSnapshot &cur) const {
+  uint16_t fields = cur.diff(published_state_) & FIELD_ALL;
+
+  // Temperature moves smaller than the deadband are held back
+  if ((fields & FIELD_CURRENT_TEMP) &&
+      fabsf((cur.current_x10 - published_state_.current_x10) / 10.0f) <= temperature_deadband_)
+    fields &= ~FIELD_CURRENT_TEMP;
+
+  return fields;
+}
+
+void BestwaySpa::update_climate_state_(bool force) {
+  BESTWAY_PROFILE(PROFILE_CLIMATE);
+  climate::ClimateMode mode;
+  climate::ClimateAction action;
 
   // Determine mode based on state
-  if (!state_.power) {
-    this->mode = climate::CLIMATE_MODE_OFF;
-    this->action = climate::CLIMATE_ACTION_OFF;
-  } else if (state_.heater_enabled) {
-    this->mode = climate::CLIMATE_MODE_HEAT;
-
-    if (state_.heater_red) {
-      this->action = climate::CLIMATE_ACTION_HEATING;
-    } else if (state_.heater_green) {
-      this->action = climate::CLIMATE_ACTION_IDLE;
+  if (!shown_.power) {
+    mode = climate::CLIMATE_MODE_OFF;
+    action = climate::CLIMATE_ACTION_OFF;
+  } else if (shown_.heater_enabled) {
+    mode = climate::CLIMATE_MODE_HEAT;
+
+    if (shown_.heater_red) {
+      action = climate::CLIMATE_ACTION_HEATING;
     } else {
-      this->action = climate::CLIMATE_ACTION_IDLE;
+      action = climate::CLIMATE_ACTION_IDLE;
     }
-  } else if (state_.filter_pump) {
-    this->mode = climate::CLIMATE_MODE_FAN_ONLY;
-    this->action = climate::CLIMATE_ACTION_FAN;
+  } else if (shown_.filter_pump) {
+    mode = climate::CLIMATE_MODE_FAN_ONLY;
+    action = climate::CLIMATE_ACTION_FAN;
   } else {
-    this->mode = climate::CLIMATE_MODE_OFF;
-    this->action = climate::CLIMATE_ACTION_IDLE;
+    mode = climate::CLIMATE_MODE_OFF;
+    action = climate::CLIMATE_ACTION_IDLE;
+  }
+
+  // The entity fields hold what was last published
+  if (!force && mode == this->mode && action == this->action && shown_.target_temp() == this->target_temperature &&
+      fabsf(shown_.current_temp() - this->current_temperature) <= temperature_deadband_) {
+    return;
   }
 
+  this->mode = mode;
+  this->action = action;
+  this->current_temperature = shown_.current_temp();
+  this->target_temperature = shown_.target_temp();
   this->publish_state();
 }
 
-void BestwaySpa::update_sensors_() {
-  if (current_temp_sensor_ != nullptr) {
-    current_temp_sensor_->publish_state(state_.current_temp);
+void BestwaySpa::update_sensors_(const SpaSnapshot &cur, uint16_t fields) {
+  BESTWAY_PROFILE(PROFILE_SENSORS);
+  published_state_.merge(cur, fields);
+
+  if (fields & FIELD_CURRENT_TEMP) {
+    if (current_temp_sensor_ != nullptr)
+      current_temp_sensor_->publish_state(shown_.current_temp());
+  }
+
+  if (fields & FIELD_TARGET_TEMP) {
+    if (target_temp_sensor_ != nullptr)
+      target_temp_sensor_->publish_state(shown_.target_temp());
   }
 
-  if (target_temp_sensor_ != nullptr) {
-    target_temp_sensor_->publish_state(state_.target_temp);
+  if (fields & FIELD_HEATING) {
+    if (heating_sensor_ != nullptr)
+      heating_sensor_->publish_state(shown_.heater_red);
   }
 
-  if (heating_sensor_ != nullptr) {
-    heating_sensor_->publish_state(state_.heater_red);
+  if (fields & FIELD_FILTER) {
+    if (filter_sensor_ != nullptr)
+      filter_sensor_->publish_state(shown_.filter_pump);
   }
 
-  if (filter_sensor_ != nullptr) {
-    filter_sensor_->publish_state(state_.filter_pump);
+  if (fields & FIELD_BUBBLES) {
+    if (bubbles_sensor_ != nullptr)
+      bubbles_sensor_->publish_state(shown_.bubbles);
   }
 
-  if (bubbles_sensor_ != nullptr) {
-    bubbles_sensor_->publish_state(state_.bubbles);
+  if (fields & FIELD_JETS) {
+    if (jets_sensor_ != nullptr)
+      jets_sensor_->publish_state(shown_.jets);
   }
 
-  if (jets_sensor_ != nullptr) {
-    jets_sensor_->publish_state(state_.jets);
+  if (fields & FIELD_LOCKED) {
+    if (locked_sensor_ != nullptr)
+      locked_sensor_->publish_state(shown_.locked);
   }
 
-  if (locked_sensor_ != nullptr) {
-    locked_sensor_->publish_state(state_.locked);
+  if (fields & FIELD_POWER) {
+    if (power_sensor_ != nullptr)
+      power_sensor_->publish_state(shown_.power);
   }
 
-  if (power_sensor_ != nullptr) {
-    power_sensor_->publish_state(state_.power);
+  if (fields & FIELD_ERROR) {
+    if (error_sensor_ != nullptr)
+      error_sensor_->publish_state(shown_.error_code != 0);
+
+    if (error_text_sensor_ != nullptr) {
+      if (shown_.error_code != 0) {
+        char error_str[8];
+        snprintf(error_str, sizeof(error_str), "E%02d", shown_.error_code);
+        error_text_sensor_->publish_state(error_str);
+      } else {
+        error_text_sensor_->publish_state("OK");
+      }
+    }
   }
 
-  if (error_sensor_ != nullptr) {
-    error_sensor_->publish_state(state_.error_code != 0);
+  if (fields & FIELD_DISPLAY) {
+    if (display_text_sensor_ != nullptr)
+      display_text_sensor_->publish_state(std::string(shown_.display_chars));
   }
+}
 
-  if (error_text_sensor_ != nullptr) {
-    if (state_.error_code != 0) {
-      char error_str[8];
-      snprintf(error_str, sizeof(error_str), "E%02d", state_.error_code);
-      error_text_sensor_->publish_state(error_str);
-    } else {
-      error_text_sensor_->publish_state("OK");
+// =============================================================================
+// HEATING RATE MODEL
+// =============================================================================
+
+RateCondition BestwaySpa::rate_condition_() const {
+  // Bubbles and jets cool the water far faster than anything else; leave them out
+  if (!shown_.power || shown_.error_code != 0 || shown_.bubbles || shown_.jets) {
+    return RATE_NONE;
+  }
+  if (shown_.heater_red) {
+#ifdef USE_BESTWAY_SPA_4WIRE
+    // Staged start-up runs at half power for a few seconds
+    if (get_protocol_type() == PROTOCOL_4WIRE && report_.heater_stage == 1) {
+      return RATE_NONE;
     }
+#endif
+    return RATE_HEATING;
+  }
+  return shown_.filter_pump ? RATE_IDLE_PUMP : RATE_IDLE;
+}
+
+void BestwaySpa::update_rate_model_(uint32_t now) {
+  if (now - last_rate_sample_ < RATE_SAMPLE_INTERVAL_MS) {
+    return;
+  }
+  last_rate_sample_ = now;
+
+  // Nothing to learn from until the CIO has reported a temperature
+  if (last_packet_time_ == 0) {
+    return;
+  }
+
+  // Rates are learned in display units; start over if the unit changes
+  if (shown_.unit_celsius != rate_unit_celsius_) {
+    rate_model_.reset();
+    rate_unit_celsius_ = shown_.unit_celsius;
+  }
+  rate_model_.sample(now, shown_.current_temp(), rate_condition_());
+
+  if (time_to_target_sensor_ != nullptr) {
+    int32_t minutes = rate_model_.minutes_to_target(shown_.current_temp(), shown_.target_temp());
+    time_to_target_sensor_->publish_state(minutes < 0 ? NAN : (float) minutes);
+  }
+  // Rates are learned in the unit the spa shows; the sensors are in °C/h
+  float scale = rate_unit_celsius_ ? 0.01f : 0.01f / 1.8f;
+  if (heating_rate_sensor_ != nullptr && rate_model_.has_rate(RATE_HEATING)) {
+    heating_rate_sensor_->publish_state(rate_model_.rate(RATE_HEATING) * scale);
+  }
+  if (cooling_rate_sensor_ != nullptr) {
+    RateCondition idle = rate_model_.has_rate(RATE_IDLE_PUMP) ? RATE_IDLE_PUMP : RATE_IDLE;
+    if (rate_model_.has_rate(idle))
+      cooling_rate_sensor_->publish_state(rate_model_.rate(idle) * scale);
+  }
+}
+
+// =============================================================================
+// HEATING PLANNER
+// =============================================================================
+
+#ifdef USE_BESTWAY_SPA_PLANNER
+void BestwaySpa::start_heating_plan(float target, uint16_t deadline_minute) {
+  if (time_ == nullptr) {
+    ESP_LOGW(tag_, "Heating plan needs a time source");
+    return;
+  }
+  ESPTime now = time_->now();
+  if (!now.is_valid()) {
+    ESP_LOGW(tag_, "Time not synchronized yet, heating plan not started");
+    return;
+  }
+  // The next time the clock reads deadline_minute, at most a day away
+  int now_minute = now.hour * 60 + now.minute;
+  int delta = ((int) deadline_minute - now_minute + 24 * 60) % (24 * 60);
+  if (delta == 0)
+    delta = 24 * 60;
+
+  plan_active_ = true;
+  plan_target_ = target;
+  plan_deadline_ = now.timestamp - now.second + delta * 60;
+  plan_last_minute_ = -1;
+  plan_heating_ = -1;
+  ESP_LOGI(tag_, "Heating plan: %.1f by %02u:%02u", target, deadline_minute / 60, deadline_minute % 60);
+}
+
+void BestwaySpa::cancel_heating_plan() {
+  if (plan_active_)
+    ESP_LOGI(tag_, "Heating plan cancelled");
+  plan_active_ = false;
+}
+
+void BestwaySpa::update_heating_plan_() {
+  if (!plan_active_) {
+    return;
+  }
+  ESPTime now = time_->now();
+  if (!now.is_valid() || now.minute == plan_last_minute_) {
+    return;
+  }
+  plan_last_minute_ = now.minute;
+
+  if (now.timestamp >= plan_deadline_) {
+    // Leave the heater as it is; the thermostat holds the target from here
+    plan_active_ = false;
+    ESP_LOGI(tag_, "Heating plan finished at %.1f", shown_.current_temp());
+    return;
   }
 
-  if (display_text_sensor_ != nullptr) {
-    display_text_sensor_->publish_state(std::string(state_.display_chars));
+  size_t slots = (size_t) ((plan_deadline_ - now.timestamp + PLAN_SLOT_MINUTES * 60 - 1) / (PLAN_SLOT_MINUTES * 60));
+  if (slots > PLAN_MAX_SLOTS)
+    slots = PLAN_MAX_SLOTS;
+
+  // Until a heating rate has been learned, plan with the configured default
+  // (kept on the slow side) so the cheapest slots are still the ones used.
+  // Rates are in the unit the spa shows.
+  int32_t heat_rate = rate_model_.rate(RATE_HEATING);
+  if (!rate_model_.has_rate(RATE_HEATING)) {
+    float rate = shown_.unit_celsius ? default_heating_rate_ : default_heating_rate_ * 1.8f;
+    heat_rate = (int32_t) lroundf(rate * 100.0f);
+  }
+  int32_t deficit = (int32_t) lroundf((plan_target_ - shown_.current_temp()) * 100.0f);
+  // Idle slots run with heater and pump off
+  RateCondition idle = rate_model_.has_rate(RATE_IDLE) ? RATE_IDLE : RATE_IDLE_PUMP;
+  size_t needed = heat_slots_needed(deficit, heat_rate, rate_model_.rate(idle), slots);
+  if (needed > slots)
+    needed = slots;
+
+  bool plan[PLAN_MAX_SLOTS];
+  plan_cheapest_slots(price_windows_, price_window_count_, default_price_, now.hour * 60 + now.minute, slots,
+                      needed, plan);
+  bool heat = plan[0];
+  // Applied again whenever the tub disagrees, so a dropped press plan or a
+  // change at the panel is put right at the next check
+  bool flipped = (int8_t) heat != plan_heating_;
+  if (!flipped && shown_.heater_enabled == heat && shown_.filter_pump == heat) {
+    return;
+  }
+  plan_heating_ = heat;
+
+  DesiredState desired;
+  desired.set(DESIRED_HEATER, heat);
+  desired.set(DESIRED_FILTER, heat);
+  if (heat)
+    desired.set_target(plan_target_);
+  if (flipped) {
+    ESP_LOGI(tag_, "Heating plan: heater and pump %s, %u of %u slots to heat", heat ? "on" : "off", (unsigned) needed,
+             (unsigned) slots);
+  } else {
+    ESP_LOGW(tag_, "Heating plan: heater and pump should be %s, applying again", heat ? "on" : "off");
   }
+  apply_state(desired);
 }
+#endif  // USE_BESTWAY_SPA_PLANNER
 
 // =============================================================================
 // BUTTON QUEUE FOR 6-WIRE
 // =============================================================================
 
-void BestwaySpa::queue_button_(Buttons button, int duration_ms) {
+void BestwaySpa::queue_button_(Buttons button, int duration_ms, uint8_t target_state, int target_value) {
+  if (passive_mode_) {
+    ESP_LOGW(tag_, "Passive mode is read-only, ignoring button %d", button);
+    return;
+  }
+
   if (!button_enabled_[button]) {
-    ESP_LOGD(TAG, "Button %d is disabled", button);
+    ESP_LOGD(tag_, "Button %d is disabled", button);
+    return;
+  }
+
+  // Merge with what is already queued: opposing toggles cancel, and a new
+  // set-point replaces the pending one
+  if (target_state == TARGET_SETPOINT) {
+    int idx = find_queued_button_(TARGET_SETPOINT);
+    if (idx >= 0) {
+      auto &pending = button_queue_[idx];
+      int current = get_state_value_(TARGET_SETPOINT);
+      if (pending.start_time == 0 && pending.presses == 0 && target_value == current) {
+        button_queue_.erase(idx);
+        ESP_LOGD(tag_, "Set-point change cancelled out");
+        return;
+      }
+      pending.target_value = target_value;
+      pending.button = target_value > current ? UP : DOWN;
+      pending.button_code = get_button_code_(pending.button);
+      pending.max_presses =
+          std::min(255, pending.presses + abs(target_value - current) + 1 + BUTTON_MAX_RETRIES);
+      ESP_LOGD(tag_, "Merged set-point change, target now %d", target_value);
+      return;
+    }
+  } else if (target_state != TARGET_NONE) {
+    int idx = find_queued_button_(target_state);
+    if (idx >= 0) {
+      auto &pending = button_queue_[idx];
+      if (pending.start_time == 0 && pending.presses == 0) {
+        button_queue_.erase(idx);
+        ESP_LOGD(tag_, "Button %d cancelled by opposing press", button);
+        return;
+      }
+      // Already being pressed: toggle back from where that press ends up
+      target_value = !pending.target_value;
+    }
+  }
+
+  ButtonQueueItem item = make_button_item_(button, duration_ms, target_state, target_value);
+  if (!button_queue_.push(item)) {
+    button_queue_overflows_++;
+    ESP_LOGW(tag_, "Button queue full, dropped button %d (%u dropped so far)", button,
+             (unsigned) button_queue_overflows_);
     return;
   }
+  ESP_LOGD(tag_, "Queued button %d (code 0x%04X) for %dms", button, item.button_code, duration_ms);
+}
 
+ButtonQueueItem BestwaySpa::make_button_item_(Buttons button, int duration_ms, uint8_t target_state,
+                                              int target_value) {
   ButtonQueueItem item;
   item.button_code = get_button_code_(button);
+  item.button = button;
   item.duration_ms = duration_ms;
   item.start_time = 0;  // Will be set when processing starts
-  item.target_state = 0xFF;  // Don't wait for state change
-  item.target_value = 0;
-
-  button_queue_.push_back(item);
-  ESP_LOGD(TAG, "Queued button %d (code 0x%04X) for %dms", button, item.button_code, duration_ms);
+  item.start_value = 0;
+  item.target_state = target_state;
+  item.target_value = target_value;
+  item.presses = 0;
+  item.released = false;
+
+  if (target_state == TARGET_NONE) {
+    item.max_presses = 1;
+  } else if (target_state == TARGET_SETPOINT) {
+    // One press per degree plus the press that wakes the set-point display
+    item.max_presses =
+        std::min(255, abs(target_value - get_state_value_(TARGET_SETPOINT)) + 1 + BUTTON_MAX_RETRIES);
+  } else {
+    item.max_presses = 1 + BUTTON_MAX_RETRIES;
+  }
+  return item;
 }
 
 void BestwaySpa::process_button_queue_() {
   if (button_queue_.empty()) {
-    current_button_code_ = get_button_code_(NOBTN);
+    virtual_button_code_ = get_button_code_(NOBTN);
     return;
   }
 
   uint32_t now = millis();
   auto &item = button_queue_.front();
+  bool verified = item.target_state != TARGET_NONE;
 
   if (item.start_time == 0) {
+    // Nothing left to do if the target is already there
+    if (verified && get_state_value_(item.target_state) == item.target_value) {
+      ESP_LOGV(tag_, "Button 0x%04X target reached after %d presses", item.button_code, item.presses);
+      button_queue_.pop();
+      return;
+    }
+    // The CIO ignores everything but LOCK while locked
+    if (state_.locked && item.button != LOCK) {
+      abort_button_queue_();
+      return;
+    }
+    if (item.presses >= item.max_presses) {
+      ESP_LOGW(tag_, "Button 0x%04X did not reach its target after %d presses", item.button_code, item.presses);
+      button_queue_.pop();
+      return;
+    }
+
     // Start pressing this button
     item.start_time = now;
-    current_button_code_ = item.button_code;
-    ESP_LOGV(TAG, "Started pressing button 0x%04X", item.button_code);
+    item.start_value = verified ? get_state_value_(item.target_state) : 0;
+    item.presses++;
+    item.released = false;
+    virtual_button_code_ = item.button_code;
+    ESP_LOGV(tag_, "Started pressing button 0x%04X (press %d)", item.button_code, item.presses);
+    return;
   }
 
+  uint32_t elapsed = now - item.start_time;
+
   // Check if button press duration has elapsed
-  if ((now - item.start_time) >= (uint32_t)item.duration_ms) {
-    ESP_LOGV(TAG, "Finished pressing button 0x%04X", item.button_code);
-    button_queue_.erase(button_queue_.begin());
+  if (!item.released) {
+    if (elapsed < (uint32_t) item.duration_ms) {
+      return;
+    }
+    virtual_button_code_ = get_button_code_(NOBTN);
+    item.released = true;
+    ESP_LOGV(tag_, "Finished pressing button 0x%04X", item.button_code);
+  }
+
+  if (!verified) {
+    button_queue_.pop();
+    return;
+  }
+
+  // Press again straight away while the value is moving, otherwise give the
+  // state time to settle before deciding the press was dropped
+  int value = get_state_value_(item.target_state);
+  if (value == item.target_value || value != item.start_value ||
+      elapsed >= (uint32_t) item.duration_ms + BUTTON_SETTLE_MS) {
+    item.start_time = 0;
   }
 }
 
-uint16_t BestwaySpa::get_button_code_(Buttons button) {
-  if (button >= BTN_COUNT) {
-    return 0x1B1B;
+void BestwaySpa::abort_button_queue_() {
+  // Keep LOCK presses so an unlock that is already queued can still go out
+  size_t dropped = 0;
+  for (size_t i = 0; i < button_queue_.size();) {
+    if (button_queue_[i].button != LOCK) {
+      button_queue_.erase(i);
+      dropped++;
+    } else {
+      i++;
+    }
   }
+  virtual_button_code_ = get_button_code_(NOBTN);
+  ESP_LOGW(tag_, "Spa is locked, dropped %u queued button presses", (unsigned) dropped);
+}
 
-  switch (model_) {
-    case MODEL_PRE2021:
-      return BTN_CODES_PRE2021[button];
-    case MODEL_P05504:
-      return BTN_CODES_P05504[button];
-    case MODEL_54149E:
-      return BTN_CODES_54149E[button];
+int BestwaySpa::find_queued_button_(uint8_t target_state) const {
+  // Latest entry wins, it is the one later presses build on
+  for (int i = (int) button_queue_.size() - 1; i >= 0; i--) {
+    if (button_queue_[i].target_state == target_state)
+      return i;
+  }
+  return -1;
+}
+
+int BestwaySpa::get_state_value_(uint8_t target_state) const {
+  switch (target_state) {
+    case LOCKEDSTATE:
+      return state_.locked;
+    case POWERSTATE:
+      return state_.power;
+    case UNITSTATE:
+      return state_.unit_celsius;
+    case BUBBLESSTATE:
+      return state_.bubbles;
+    case HEATGRNSTATE:
+      return state_.heater_green;
+    case HEATREDSTATE:
+      return state_.heater_red;
+    case HEATSTATE:
+      return state_.heater_enabled;
+    case PUMPSTATE:
+      return state_.filter_pump;
+    case JETSSTATE:
+      return state_.jets;
+    case TIMERSTATE:
+      return state_.timer_active;
+    case TARGET_SETPOINT:
+      return (int) roundf(state_.target_temp());
     default:
-      return BTN_CODES_PRE2021[button];
+      return 0;
+  }
+}
+
+uint16_t BestwaySpa::get_button_code_(Buttons button) {
+  if (button >= BTN_COUNT || btn_codes_ == nullptr) {
+    return 0x1B1B;
   }
+  return btn_codes_[button];
 }
 
 // =============================================================================
-// CHARACTER DECODING
+// DESIRED-STATE TRANSACTIONS
 // =============================================================================
 
-char BestwaySpa::decode_7segment_(uint8_t segments, bool is_type1) {
-  const uint8_t *codes = is_type1 ? CHARCODES_TYPE1 : CHARCODES_TYPE2;
-  size_t code_count = sizeof(CHARCODES_TYPE1) / sizeof(CHARCODES_TYPE1[0]);
+// The transaction field a queued press works towards, 0 if none
+static uint8_t desired_field_for(uint8_t target_state) {
+  switch (target_state) {
+    case POWERSTATE:
+      return DESIRED_POWER;
+    case HEATSTATE:
+      return DESIRED_HEATER;
+    case PUMPSTATE:
+      return DESIRED_FILTER;
+    case BUBBLESSTATE:
+      return DESIRED_BUBBLES;
+    case JETSSTATE:
+      return DESIRED_JETS;
+    case LOCKEDSTATE:
+      return DESIRED_LOCK;
+    case UNITSTATE:
+      return DESIRED_CELSIUS;
+    case TARGET_SETPOINT:
+      return DESIRED_TARGET;
+    default:
+      return 0;
+  }
+}
+
+void BestwaySpa::apply_state(const DesiredState &desired) {
+  if (defer_to_bus_(BusCommand{BUS_CMD_APPLY_STATE, 0, desired})) return;
 
-  for (size_t i = 0; i < code_count; i++) {
-    if (codes[i] == segments) {
-      return CHARS[i];
+  if (get_protocol_type() == PROTOCOL_4WIRE) {
+    apply_state_4wire_(desired);
+    return;
+  }
+  if (passive_mode_) {
+    ESP_LOGW(tag_, "Passive mode is read-only, ignoring state change");
+    return;
+  }
+  if (!state_.confirmed) {
+    ESP_LOGW(tag_, "Spa state not confirmed yet, ignoring state change");
+    return;
+  }
+
+  // Presses that have not started yet and work towards a field this
+  // transaction sets are superseded by it
+  for (size_t i = 0; i < button_queue_.size();) {
+    const auto &item = button_queue_[i];
+    if (item.start_time == 0 && item.presses == 0 && (desired_field_for(item.target_state) & desired.fields)) {
+      button_queue_.erase(i);
+    } else {
+      i++;
+    }
+  }
+
+  // What each field will be once the presses still in progress are done
+  auto expected = [this](uint8_t target_state) {
+    int idx = find_queued_button_(target_state);
+    return idx >= 0 ? button_queue_[idx].target_value : get_state_value_(target_state);
+  };
+
+  bool powered = expected(POWERSTATE);
+  bool power = desired.has(DESIRED_POWER) ? desired.get(DESIRED_POWER) : powered;
+  bool powering_on = power && !powered;
+  // After powering on, the spa's own defaults apply, so every requested field
+  // is planned; presses whose target is already there are skipped when their
+  // turn comes
+  auto needs = [&](DesiredField field, uint8_t target_state) {
+    return desired.has(field) && (powering_on || (int) desired.get(field) != expected(target_state));
+  };
+
+  ButtonQueueItem body[STATE_PLAN_MAX];
+  size_t body_len = 0;
+  auto add = [&](ButtonQueueItem *list, size_t *len, Buttons button, uint8_t target_state, int value) {
+    list[(*len)++] = make_button_item_(button, BUTTON_PRESS_MS, target_state, value);
+  };
+
+  if (power) {
+    // HEAT starts the pump with it and PUMP off stops the heater, so heater
+    // on goes before the pump and heater off after it
+    bool heater_changes = needs(DESIRED_HEATER, HEATSTATE);
+    bool heater = desired.get(DESIRED_HEATER);
+    if (heater_changes && heater)
+      add(body, &body_len, HEAT, HEATSTATE, 1);
+    if (needs(DESIRED_FILTER, PUMPSTATE))
+      add(body, &body_len, PUMP, PUMPSTATE, desired.get(DESIRED_FILTER));
+    if (heater_changes && !heater)
+      add(body, &body_len, HEAT, HEATSTATE, 0);
+    if (needs(DESIRED_BUBBLES, BUBBLESSTATE))
+      add(body, &body_len, BUBBLES, BUBBLESSTATE, desired.get(DESIRED_BUBBLES));
+    if (has_jets() && needs(DESIRED_JETS, JETSSTATE))
+      add(body, &body_len, HYDROJETS, JETSSTATE, desired.get(DESIRED_JETS));
+    if (needs(DESIRED_CELSIUS, UNITSTATE))
+      add(body, &body_len, UNIT, UNITSTATE, desired.get(DESIRED_CELSIUS));
+    if (desired.has(DESIRED_TARGET)) {
+      // The set-point is stepped in the unit the spa shows after a unit change
+      int current = expected(TARGET_SETPOINT);
+      if (desired.has(DESIRED_CELSIUS) && (int) desired.get(DESIRED_CELSIUS) != expected(UNITSTATE)) {
+        current = (int) roundf(desired.get(DESIRED_CELSIUS) ? fahrenheit_to_celsius_(current)
+                                                           : celsius_to_fahrenheit_(current));
+      }
+      int target = (int) roundf(desired.target_x10 / 10.0f);
+      if (target != current) {
+        body[body_len++] = make_button_item_(target > current ? UP : DOWN, BUTTON_STEP_MS, TARGET_SETPOINT, target);
+        body[body_len - 1].max_presses = std::min(255, abs(target - current) + 1 + BUTTON_MAX_RETRIES);
+      }
+    }
+  }
+
+  // Unlock first and lock again afterwards
+  bool locked = expected(LOCKEDSTATE);
+  bool want_locked = desired.has(DESIRED_LOCK) ? desired.get(DESIRED_LOCK) : locked;
+  bool presses = power != powered || body_len > 0;
+  bool unlock = locked && (presses || !want_locked);
+  bool relock = want_locked && (unlock || !locked);
+
+  ButtonQueueItem plan[STATE_PLAN_MAX + 4];  // Unlock, power on/off, relock
+  size_t plan_len = 0;
+  if (unlock)
+    add(plan, &plan_len, LOCK, LOCKEDSTATE, 0);
+  if (powering_on)
+    add(plan, &plan_len, POWER, POWERSTATE, 1);
+  for (size_t i = 0; i < body_len; i++)
+    plan[plan_len++] = body[i];
+  if (!power && powered)
+    add(plan, &plan_len, POWER, POWERSTATE, 0);
+  if (relock)
+    add(plan, &plan_len, LOCK, LOCKEDSTATE, 1);
+
+  for (size_t i = 0; i < plan_len; i++) {
+    if (!button_enabled_[plan[i].button]) {
+      ESP_LOGW(tag_, "Button %d is disabled, state change not applied", plan[i].button);
+      return;
     }
   }
-  return '?';  // Unknown segment pattern
+  if (plan_len > button_queue_.capacity() - button_queue_.size()) {
+    button_queue_overflows_++;
+    ESP_LOGW(tag_, "Button queue too full for a %u-press state change, not applied", (unsigned) plan_len);
+    return;
+  }
+  for (size_t i = 0; i < plan_len; i++) {
+    button_queue_.push(plan[i]);
+  }
+  ESP_LOGD(tag_, "Planned %u presses for state change", (unsigned) plan_len);
+}
+
+void BestwaySpa::apply_state_4wire_(const DesiredState &desired) {
+  // The ESP drives the CIO directly, so each field is simply set. Filter
+  // goes before heater because heater on needs the pump and pump off stops
+  // the heater; unit goes before target, which is in the new unit.
+  if (desired.has(DESIRED_POWER))
+    set_power(desired.get(DESIRED_POWER));
+  if (desired.has(DESIRED_FILTER))
+    set_filter(desired.get(DESIRED_FILTER));
+  if (desired.has(DESIRED_HEATER))
+    set_heater(desired.get(DESIRED_HEATER));
+  if (desired.has(DESIRED_BUBBLES))
+    set_bubbles(desired.get(DESIRED_BUBBLES));
+  if (desired.has(DESIRED_JETS) && has_jets())
+    set_jets(desired.get(DESIRED_JETS));
+  if (desired.has(DESIRED_LOCK))
+    set_lock(desired.get(DESIRED_LOCK));
+  if (desired.has(DESIRED_CELSIUS))
+    set_unit(desired.get(DESIRED_CELSIUS));
+  if (desired.has(DESIRED_TARGET))
+    set_target_temp(desired.target_x10 / 10.0f);
 }
 
 // =============================================================================
@@ -999,20 +2592,24 @@ char BestwaySpa::decode_7segment_(uint8_t segments, bool is_type1) {
 // =============================================================================
 
 void BestwaySpa::set_power(bool state) {
+  if (defer_to_bus_(BUS_CMD_POWER, state)) return;
+
   if (state_.power != state) {
-    if (protocol_type_ == PROTOCOL_4WIRE) {
+    if (get_protocol_type() == PROTOCOL_4WIRE) {
       // 4-wire doesn't have power button - toggle via heater/pump
       state_.power = state;
     } else {
       toggles_.power_pressed = true;
     }
-    ESP_LOGD(TAG, "Requested power %s", state ? "ON" : "OFF");
+    ESP_LOGD(tag_, "Requested power %s", state ? "ON" : "OFF");
   }
 }
 
 void BestwaySpa::set_heater(bool state) {
+  if (defer_to_bus_(BUS_CMD_HEATER, state)) return;
+
   if (state_.heater_enabled != state) {
-    if (protocol_type_ == PROTOCOL_4WIRE) {
+    if (get_protocol_type() == PROTOCOL_4WIRE) {
       state_.heater_enabled = state;
       // For 4-wire, filter must be on for heater
       if (state && !state_.filter_pump) {
@@ -1021,13 +2618,15 @@ void BestwaySpa::set_heater(bool state) {
     } else {
       toggles_.heat_pressed = true;
     }
-    ESP_LOGD(TAG, "Requested heater %s", state ? "ON" : "OFF");
+    ESP_LOGD(tag_, "Requested heater %s", state ? "ON" : "OFF");
   }
 }
 
 void BestwaySpa::set_filter(bool state) {
+  if (defer_to_bus_(BUS_CMD_FILTER, state)) return;
+
   if (state_.filter_pump != state) {
-    if (protocol_type_ == PROTOCOL_4WIRE) {
+    if (get_protocol_type() == PROTOCOL_4WIRE) {
       state_.filter_pump = state;
       // For 4-wire, turning off filter turns off heater
       if (!state && state_.heater_enabled) {
@@ -1036,156 +2635,141 @@ void BestwaySpa::set_filter(bool state) {
     } else {
       toggles_.pump_pressed = true;
     }
-    ESP_LOGD(TAG, "Requested filter %s", state ? "ON" : "OFF");
+    ESP_LOGD(tag_, "Requested filter %s", state ? "ON" : "OFF");
   }
 }
 
 void BestwaySpa::set_bubbles(bool state) {
+  if (defer_to_bus_(BUS_CMD_BUBBLES, state)) return;
+
   if (state_.bubbles != state) {
-    if (protocol_type_ == PROTOCOL_4WIRE) {
+    if (get_protocol_type() == PROTOCOL_4WIRE) {
       state_.bubbles = state;
     } else {
       toggles_.bubbles_pressed = true;
     }
-    ESP_LOGD(TAG, "Requested bubbles %s", state ? "ON" : "OFF");
+    ESP_LOGD(tag_, "Requested bubbles %s", state ? "ON" : "OFF");
   }
 }
 
 void BestwaySpa::set_jets(bool state) {
+  if (defer_to_bus_(BUS_CMD_JETS, state)) return;
+
   if (!has_jets()) {
-    ESP_LOGW(TAG, "This model does not have jets");
+    ESP_LOGW(tag_, "This model does not have jets");
     return;
   }
 
   if (state_.jets != state) {
-    if (protocol_type_ == PROTOCOL_4WIRE) {
+    if (get_protocol_type() == PROTOCOL_4WIRE) {
       state_.jets = state;
     } else {
       toggles_.jets_pressed = true;
     }
-    ESP_LOGD(TAG, "Requested jets %s", state ? "ON" : "OFF");
+    ESP_LOGD(tag_, "Requested jets %s", state ? "ON" : "OFF");
   }
 }
 
 void BestwaySpa::set_lock(bool state) {
+  if (defer_to_bus_(BUS_CMD_LOCK, state)) return;
+
   if (state_.locked != state) {
-    if (protocol_type_ == PROTOCOL_4WIRE) {
+    if (get_protocol_type() == PROTOCOL_4WIRE) {
       state_.locked = state;
     } else {
       toggles_.lock_pressed = true;
     }
-    ESP_LOGD(TAG, "Requested lock %s", state ? "ON" : "OFF");
+    ESP_LOGD(tag_, "Requested lock %s", state ? "ON" : "OFF");
   }
 }
 
 void BestwaySpa::set_unit(bool celsius) {
+  if (defer_to_bus_(BUS_CMD_UNIT, celsius)) return;
+
   if (state_.unit_celsius != celsius) {
-    if (protocol_type_ == PROTOCOL_4WIRE) {
+    if (get_protocol_type() == PROTOCOL_4WIRE) {
       state_.unit_celsius = celsius;
+      temp_filter_.reset();
       // Convert temperatures
       if (celsius) {
-        state_.current_temp = fahrenheit_to_celsius_(state_.current_temp);
-        state_.target_temp = fahrenheit_to_celsius_(state_.target_temp);
+        state_.set_current_temp(fahrenheit_to_celsius_(state_.current_temp()));
+        state_.set_target_temp(fahrenheit_to_celsius_(state_.target_temp()));
       } else {
-        state_.current_temp = celsius_to_fahrenheit_(state_.current_temp);
-        state_.target_temp = celsius_to_fahrenheit_(state_.target_temp);
+        state_.set_current_temp(celsius_to_fahrenheit_(state_.current_temp()));
+        state_.set_target_temp(celsius_to_fahrenheit_(state_.target_temp()));
       }
     } else {
       toggles_.unit_pressed = true;
     }
-    ESP_LOGD(TAG, "Requested unit %s", celsius ? "C" : "F");
+    ESP_LOGD(tag_, "Requested unit %s", celsius ? "C" : "F");
   }
 }
 
 void BestwaySpa::set_target_temp(float temp) {
-  // Calculate delta from current target
-  float delta = temp - state_.target_temp;
-  int8_t steps = (int8_t)roundf(delta);
+  if (defer_to_bus_(BUS_CMD_TARGET, (int16_t) roundf(temp * 10.0f))) return;
 
-  if (steps != 0) {
-    adjust_target_temp(steps);
+  if (get_protocol_type() == PROTOCOL_4WIRE) {
+    // Calculate delta from current target
+    float delta = temp - state_.target_temp();
+    int8_t steps = (int8_t)roundf(delta);
+
+    if (steps != 0) {
+      adjust_target_temp(steps);
+    }
+    return;
   }
+
+  // For 6-wire, press towards the absolute set-point; steps requested
+  // before it in this pass are superseded
+  toggles_.set_target_abs = true;
+  toggles_.target_temp_value = (int16_t) roundf(temp);
+  toggles_.set_target_temp = false;
+  toggles_.target_temp_delta = 0;
+  ESP_LOGD(tag_, "Setting target temperature to %d", toggles_.target_temp_value);
 }
 
 void BestwaySpa::adjust_target_temp(int8_t delta) {
+  if (defer_to_bus_(BUS_CMD_ADJUST_TARGET, delta)) return;
+
   if (delta == 0) return;
 
-  if (protocol_type_ == PROTOCOL_4WIRE) {
+  if (get_protocol_type() == PROTOCOL_4WIRE) {
     // For 4-wire, directly adjust target
-    state_.target_temp += delta;
+    state_.target_x10 += delta * 10;
     if (state_.unit_celsius) {
-      if (state_.target_temp < 20.0f) state_.target_temp = 20.0f;
-      if (state_.target_temp > 40.0f) state_.target_temp = 40.0f;
+      if (state_.target_x10 < 200) state_.target_x10 = 200;
+      if (state_.target_x10 > 400) state_.target_x10 = 400;
     } else {
-      if (state_.target_temp < 68.0f) state_.target_temp = 68.0f;
-      if (state_.target_temp > 104.0f) state_.target_temp = 104.0f;
+      if (state_.target_x10 < 680) state_.target_x10 = 680;
+      if (state_.target_x10 > 1040) state_.target_x10 = 1040;
     }
   } else {
-    // For 6-wire, queue button presses
+    // For 6-wire, queue button presses; steps requested within one pass add up
+    int steps = toggles_.target_temp_delta + delta;
     toggles_.set_target_temp = true;
-    toggles_.target_temp_delta = delta;
+    toggles_.target_temp_delta = (int8_t) std::max(-128, std::min(127, steps));
   }
 
-  ESP_LOGD(TAG, "Adjusting target temperature by %d steps", delta);
+  ESP_LOGD(tag_, "Adjusting target temperature by %d steps", delta);
 }
 
 void BestwaySpa::set_timer(uint8_t hours) {
-  ESP_LOGD(TAG, "Setting timer to %d hours", hours);
+  if (defer_to_bus_(BUS_CMD_TIMER, hours)) return;
+
+  ESP_LOGD(tag_, "Setting timer to %d hours", hours);
   // Timer is typically just toggle on 6-wire
-  if (protocol_type_ != PROTOCOL_4WIRE) {
+  if (get_protocol_type() != PROTOCOL_4WIRE) {
     toggles_.timer_pressed = true;
   }
   state_.timer_hours = hours;
 }
 
 void BestwaySpa::set_brightness(uint8_t level) {
+  if (defer_to_bus_(BUS_CMD_BRIGHTNESS, level)) return;
+
   if (level > 8) level = 8;
   state_.brightness = level;
-  ESP_LOGD(TAG, "Set brightness to %d", level);
-}
-
-// =============================================================================
-// STATE GETTERS
-// =============================================================================
-
-bool BestwaySpa::has_jets() const {
-  switch (model_) {
-    case MODEL_54138:
-    case MODEL_54144:
-    case MODEL_54173:
-      return true;
-    default:
-      return false;
-  }
-}
-
-bool BestwaySpa::has_air() const {
-  switch (model_) {
-    case MODEL_PRE2021:
-    case MODEL_54138:
-    case MODEL_54173:
-    case MODEL_54149E:
-    case MODEL_P05504:
-      return true;
-    case MODEL_54123:
-    case MODEL_54144:
-    case MODEL_54154:
-      return false;
-    default:
-      return true;
-  }
-}
-
-// =============================================================================
-// UTILITIES
-// =============================================================================
-
-uint8_t BestwaySpa::calculate_checksum_(const uint8_t *data, size_t len) {
-  uint8_t sum = 0;
-  for (size_t i = 0; i < len; i++) {
-    sum += data[i];
-  }
-  return sum;
+  ESP_LOGD(tag_, "Set brightness to %d", level);
 }
 
 }  // namespace bestway_spa
@@ -1,195 +1,339 @@
 #pragma once
 
+#include "esphome/core/automation.h"
 #include "esphome/core/component.h"
 #include "esphome/core/hal.h"
+#include "esphome/core/preferences.h"
 #include "esphome/components/uart/uart.h"
 #include "esphome/components/climate/climate.h"
 #include "esphome/components/sensor/sensor.h"
 #include "esphome/components/switch/switch.h"
 #include "esphome/components/binary_sensor/binary_sensor.h"
 #include "esphome/components/text_sensor/text_sensor.h"
-#include <vector>
+#include "bestway_codec.h"
+
+#include <cmath>
+
+#ifdef USE_BESTWAY_SPA_SPI
+#include "esphome/components/spi/spi.h"
+#endif
+
+#ifdef USE_BESTWAY_SPA_PLANNER
+#include "esphome/components/time/real_time_clock.h"
+#endif
+
+#ifdef USE_BESTWAY_SPA_BUS_TASK
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
 
 namespace esphome {
 namespace bestway_spa {
 
 // =============================================================================
-// ENUMERATIONS - Based on VisualApproach firmware
+// DATA STRUCTURES
 // =============================================================================
 
-// Protocol types
-enum ProtocolType {
-  PROTOCOL_4WIRE,     // 2021+ models (UART)
-  PROTOCOL_6WIRE_T1,  // Pre-2021 6-wire TYPE1 (SPI-like)
-  PROTOCOL_6WIRE_T2   // 6-wire TYPE2 (54149E)
-};
-
-// Spa model identifiers
-enum SpaModel {
-  MODEL_PRE2021,    // Pre-2021 (6-wire TYPE1)
-  MODEL_54149E,     // 6-wire TYPE2
-  MODEL_54123,      // 4-wire (NO54123)
-  MODEL_54138,      // 4-wire with jets and air
-  MODEL_54144,      // 4-wire with jets
-  MODEL_54154,      // 4-wire
-  MODEL_54173,      // 4-wire with jets and air
-  MODEL_P05504,     // 6-wire TYPE1 variant
-  MODEL_UNKNOWN
-};
-
-// Button indices - matches VisualApproach
-enum Buttons : uint8_t {
-  NOBTN = 0,
-  LOCK,
-  TIMER,
-  BUBBLES,
-  UNIT,
-  HEAT,
-  PUMP,
-  DOWN,
-  UP,
-  POWER,
-  HYDROJETS,
-  BTN_COUNT
+// Fields of SpaState, used for change tracking. The published ones come
+// first; the flag fields share their bit with SpaSnapshot::flags.
+enum SpaField : uint16_t {
+  FIELD_CURRENT_TEMP = 1 << 0,
+  FIELD_TARGET_TEMP = 1 << 1,
+  FIELD_HEATING = 1 << 2,
+  FIELD_FILTER = 1 << 3,
+  FIELD_BUBBLES = 1 << 4,
+  FIELD_JETS = 1 << 5,
+  FIELD_LOCKED = 1 << 6,
+  FIELD_POWER = 1 << 7,
+  FIELD_ERROR = 1 << 8,
+  FIELD_DISPLAY = 1 << 9,
+  FIELD_ALL = 0x03FF,  // Everything that is published
+  FIELD_HEATER_ENABLED = 1 << 10,
+  FIELD_HEATER_GREEN = 1 << 11,
+  FIELD_UNIT = 1 << 12,
+  FIELD_TIMER = 1 << 13,
+  FIELD_BRIGHTNESS = 1 << 14,
+  FIELD_CONFIRMED = 1 << 15,
 };
 
-// State indices - matches VisualApproach
-enum States : uint8_t {
-  LOCKEDSTATE = 0,
-  POWERSTATE,
-  UNITSTATE,
-  BUBBLESSTATE,
-  HEATGRNSTATE,
-  HEATREDSTATE,
-  HEATSTATE,
-  PUMPSTATE,
-  CHAR1,
-  CHAR2,
-  CHAR3,
-  JETSSTATE,
-  GODSTATE,
-  TIMERSTATE,
-  STATE_COUNT
+// Fields held as a single bit in SpaSnapshot::flags
+static const uint16_t FLAG_FIELDS = FIELD_HEATING | FIELD_FILTER | FIELD_BUBBLES | FIELD_JETS | FIELD_LOCKED |
+                                    FIELD_POWER | FIELD_HEATER_ENABLED | FIELD_HEATER_GREEN | FIELD_UNIT |
+                                    FIELD_TIMER | FIELD_CONFIRMED;
+
+// Changes to these fields are published immediately instead of on the next tick
+static const uint16_t CRITICAL_FIELDS = FIELD_POWER | FIELD_ERROR | FIELD_HEATING;
+
+// Fields kept in flash across reboots. Fields that change on every frame
+// (display digits, heating LED) are left out so that writes only happen
+// when a setting or the temperature moves.
+static const uint16_t SAVED_FIELDS = FIELD_POWER | FIELD_HEATER_ENABLED | FIELD_FILTER | FIELD_BUBBLES |
+                                     FIELD_JETS | FIELD_LOCKED | FIELD_UNIT | FIELD_BRIGHTNESS |
+                                     FIELD_CURRENT_TEMP | FIELD_TARGET_TEMP;
+
+// Packed copy of a SpaState: every flag in one word, so finding what
+// changed between two copies is an XOR plus a few compares
+struct SpaSnapshot {
+  uint16_t flags{0};  // FLAG_FIELDS bits
+  int16_t current_x10{0};
+  int16_t target_x10{0};
+  uint8_t error_code{0};
+  uint8_t timer_hours{0};
+  uint8_t brightness{0};
+  char display_chars[3]{};
+
+  // SpaField bits of the fields that differ from other
+  uint16_t diff(const SpaSnapshot &other) const;
+  // Takes the given fields from src, leaving the others as they are
+  void merge(const SpaSnapshot &src, uint16_t fields);
 };
 
-// =============================================================================
-// DATA STRUCTURES
-// =============================================================================
-
-// Spa state tracking
+// Spa state tracking. Flags are single bits and temperatures tenths of a
+// degree in the unit the spa shows.
 struct SpaState {
-  bool locked = false;
-  bool power = true;
-  bool heater_enabled = false;
-  bool heater_green = false;     // Ready to heat
-  bool heater_red = false;       // Actively heating
-  bool filter_pump = false;
-  bool bubbles = false;
-  bool jets = false;
-  bool unit_celsius = true;
-  bool timer_active = false;
-  uint8_t timer_hours = 0;
-  uint8_t error_code = 0;
-
-  float current_temp = 20.0;
-  float target_temp = 37.0;
-
-  uint8_t brightness = 8;
+  bool locked : 1;
+  bool power : 1;
+  bool heater_enabled : 1;
+  bool heater_green : 1;     // Ready to heat
+  bool heater_red : 1;       // Actively heating
+  bool filter_pump : 1;
+  bool bubbles : 1;
+  bool jets : 1;
+  bool unit_celsius : 1;
+  bool timer_active : 1;
+  // Set once the bus has delivered a frame; until then the state is the
+  // restored snapshot (or the defaults) and may be stale
+  bool confirmed : 1;
+
+  uint8_t timer_hours{0};
+  uint8_t error_code{0};
+  uint8_t brightness{8};
+
+  int16_t current_x10{200};
+  int16_t target_x10{370};
 
   // Raw display characters
   char display_chars[4] = {' ', ' ', ' ', '\0'};
+
+  SpaState()
+      : locked(false), power(true), heater_enabled(false), heater_green(false), heater_red(false),
+        filter_pump(false), bubbles(false), jets(false), unit_celsius(true), timer_active(false),
+        confirmed(false) {}
+
+  float current_temp() const { return current_x10 / 10.0f; }
+  float target_temp() const { return target_x10 / 10.0f; }
+  void set_current_temp(float temp) { current_x10 = (int16_t) lroundf(temp * 10.0f); }
+  void set_target_temp(float temp) { target_x10 = (int16_t) lroundf(temp * 10.0f); }
+
+  SpaSnapshot snapshot() const;
+  // Sets the flag fields in mask from a SpaSnapshot::flags word
+  void set_flags(uint16_t flags, uint16_t mask);
+};
+
+// Part of SpaState kept in flash across reboots: the SAVED_FIELDS of a
+// snapshot
+struct SavedSpaState {
+  uint16_t flags;
+  int16_t current_x10;
+  int16_t target_x10;
+  uint8_t brightness;
+  uint8_t reserved;
+};
+
+// Protocol and model found by detection, kept in flash so that later
+// boots start the bus straight away
+struct DetectedSpa {
+  uint8_t protocol;
+  uint8_t model;
 };
 
 // Toggle requests
 struct SpaToggles {
-  bool power_pressed = false;
-  bool lock_pressed = false;
-  bool timer_pressed = false;
-  bool bubbles_pressed = false;
-  bool jets_pressed = false;
-  bool heat_pressed = false;
-  bool pump_pressed = false;
-  bool up_pressed = false;
-  bool down_pressed = false;
-  bool unit_pressed = false;
-
-  bool set_target_temp = false;
-  int8_t target_temp_delta = 0;
+  bool power_pressed : 1;
+  bool lock_pressed : 1;
+  bool timer_pressed : 1;
+  bool bubbles_pressed : 1;
+  bool jets_pressed : 1;
+  bool heat_pressed : 1;
+  bool pump_pressed : 1;
+  bool up_pressed : 1;
+  bool down_pressed : 1;
+  bool unit_pressed : 1;
+  bool set_target_temp : 1;  // Step target_temp_delta on from the pending set-point
+  bool set_target_abs : 1;   // Press until the set-point reads target_temp_value
+
+  int8_t target_temp_delta{0};
+  int16_t target_temp_value{0};
+
+  SpaToggles()
+      : power_pressed(false), lock_pressed(false), timer_pressed(false), bubbles_pressed(false),
+        jets_pressed(false), heat_pressed(false), pump_pressed(false), up_pressed(false), down_pressed(false),
+        unit_pressed(false), set_target_temp(false), set_target_abs(false) {}
 };
 
+// Button press verification targets (besides the States indices)
+static const uint8_t TARGET_NONE = 0xFF;      // Blind press, no verification
+static const uint8_t TARGET_SETPOINT = 0xFE;  // Press until target_temp == target_value
+
 // Button queue item for 6-wire protocol
 struct ButtonQueueItem {
   uint16_t button_code;
-  uint8_t target_state;
+  Buttons button;
+  uint8_t target_state;   // States index to verify, or TARGET_NONE / TARGET_SETPOINT
   int target_value;
   int duration_ms;
-  uint32_t start_time;
+  uint32_t start_time;    // Start of the current press, 0 = not pressed yet
+  int start_value;        // Verified value when the current press started
+  uint8_t presses;        // Presses made so far
+  uint8_t max_presses;
+  bool released;
 };
 
-// =============================================================================
-// 7-SEGMENT DISPLAY CHARACTER CODES
-// =============================================================================
-
-// 7-segment character codes for TYPE1 (38 characters)
-static const uint8_t CHARCODES_TYPE1[] = {
-  0x7F, 0x0D, 0xB7, 0x9F, 0xCD, 0xDB, 0xFB, 0x0F, 0xFF, 0xDF,  // 0-9
-  0xEF, 0xF9, 0x73, 0xBD, 0xF3, 0xE3, 0x7B, 0xE9, 0x09, 0x3D,  // A-J
-  0xE1, 0x71, 0x49, 0xA9, 0xB9, 0xE7, 0xCF, 0xA1, 0xDB, 0xF1,  // K-T
-  0x7D, 0x7D, 0x7D, 0xED, 0xDD, 0xB7, 0x00, 0x80              // U-Z, space, dash
+static const size_t RX_BUFFER_SIZE = 128;
+
+// Fields of a DesiredState transaction
+enum DesiredField : uint8_t {
+  DESIRED_POWER = 1 << 0,
+  DESIRED_HEATER = 1 << 1,
+  DESIRED_FILTER = 1 << 2,
+  DESIRED_BUBBLES = 1 << 3,
+  DESIRED_JETS = 1 << 4,
+  DESIRED_LOCK = 1 << 5,
+  DESIRED_CELSIUS = 1 << 6,
+  DESIRED_TARGET = 1 << 7,
 };
 
-// 7-segment character codes for TYPE2
-static const uint8_t CHARCODES_TYPE2[] = {
-  0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F,  // 0-9
-  0x77, 0x7C, 0x39, 0x5E, 0x79, 0x71, 0x3D, 0x76, 0x06, 0x0E,  // A-J
-  0x70, 0x38, 0x15, 0x54, 0x5C, 0x73, 0x67, 0x50, 0x6D, 0x78,  // K-T
-  0x3E, 0x3E, 0x3E, 0x76, 0x6E, 0x5B, 0x00, 0x40              // U-Z, space, dash
+// A complete or partial state to reach in one go. Fields that are not set
+// are left as they are.
+struct DesiredState {
+  uint8_t fields{0};      // DesiredField bits that are set
+  uint8_t values{0};      // On/off for the boolean fields
+  int16_t target_x10{0};  // Target * 10, in the unit the spa shows afterwards
+
+  void set(DesiredField field, bool on) {
+    fields |= field;
+    values = on ? (values | field) : (values & ~field);
+  }
+  void set_target(float temp) {
+    fields |= DESIRED_TARGET;
+    target_x10 = (int16_t) roundf(temp * 10.0f);
+  }
+  bool has(DesiredField field) const { return (fields & field) != 0; }
+  bool get(DesiredField field) const { return (values & field) != 0; }
 };
 
-// Character lookup table
-static const char CHARS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ -";
+// Control calls forwarded from loop() to the bus task
+enum BusCommandType : uint8_t {
+  BUS_CMD_POWER = 0,
+  BUS_CMD_HEATER,
+  BUS_CMD_FILTER,
+  BUS_CMD_BUBBLES,
+  BUS_CMD_JETS,
+  BUS_CMD_LOCK,
+  BUS_CMD_UNIT,
+  BUS_CMD_TARGET,         // value = temperature * 10
+  BUS_CMD_ADJUST_TARGET,
+  BUS_CMD_TIMER,
+  BUS_CMD_BRIGHTNESS,
+  BUS_CMD_DUMP_CAPTURE,
+  BUS_CMD_APPLY_STATE,    // desired holds the transaction
+};
 
-// =============================================================================
-// BUTTON CODES BY MODEL
-// =============================================================================
+struct BusCommand {
+  BusCommandType type;
+  int16_t value;
+  DesiredState desired;
+};
 
-// Button codes for PRE2021 (6-wire TYPE1)
-// Index: NOBTN, LOCK, TIMER, BUBBLES, UNIT, HEAT, PUMP, DOWN, UP, POWER, JETS
-static const uint16_t BTN_CODES_PRE2021[] = {
-  0x1B1B, 0x0200, 0x0100, 0x0300, 0x1012, 0x1212, 0x1112, 0x1312, 0x0809, 0x0000, 0x0000
+static const size_t BUS_COMMAND_QUEUE_SIZE = 16;
+static const size_t BUS_STATE_QUEUE_SIZE = 4;
+
+// Records kept by the frame capture ring (capture_size in YAML)
+#ifndef BESTWAY_SPA_CAPTURE_SIZE
+#define BESTWAY_SPA_CAPTURE_SIZE 64
+#endif
+static const size_t BUTTON_QUEUE_SIZE = 16;
+
+// Largest CS-framed transfer captured in passive mode (TYPE1 payload is 11 bytes)
+static const uint8_t SNIFF_FRAME_MAX = 16;
+// Completed frames held between the CS interrupt and loop(). Each display
+// refresh is followed within milliseconds by the brightness or button-read
+// frame while loop() may run only every ~16 ms, so this holds a few cycles.
+static const size_t SNIFF_QUEUE_SIZE = 16;
+
+struct SniffedFrame {
+  uint32_t time_us;  // When CS rose
+  uint8_t len;
+  uint8_t data[SNIFF_FRAME_MAX];
 };
 
-// Button codes for P05504 (6-wire TYPE1 variant)
-static const uint16_t BTN_CODES_P05504[] = {
-  0x1B1B, 0x0210, 0x0110, 0x0310, 0x1022, 0x1222, 0x1122, 0x1322, 0x081A, 0x0000, 0x0000
+// Interrupt-side storage for passive 6-wire capture. The ISRs shift bits from
+// the DATA line on each CLK edge while CS is low and hand the completed frame
+// to loop() through a queue when CS rises again. Bytes are kept in wire order (first bit is
+// the MSB); TYPE2 payload and button bytes go LSB first and are reversed by
+// the decoder, its command bytes are MSB first like the sender's.
+struct SnifferStore {
+  static void gpio_intr_clk(SnifferStore *arg);
+  static void gpio_intr_cs(SnifferStore *arg);
+
+  ISRInternalGPIOPin data_pin;
+  ISRInternalGPIOPin cs_pin;
+
+  // Frame being shifted in (ISR only)
+  SniffedFrame shift{};
+  uint8_t shift_byte{0};
+  uint8_t shift_bits{0};
+  bool shift_overflow{false};
+
+  // Completed frames: the CS interrupt produces, loop() drains them all
+  SpscQueue<SniffedFrame, SNIFF_QUEUE_SIZE> frames;
+  volatile uint32_t frames_dropped{0};  // Queue was full
 };
 
-// Button codes for MODEL54149E (6-wire TYPE2)
-static const uint16_t BTN_CODES_54149E[] = {
-  0x0000, 0x0080, 0x0040, 0x0020, 0x0010, 0x0008, 0x0004, 0x0002, 0x0001, 0x0100, 0x0200
+#ifdef USE_BESTWAY_SPA_PROFILING
+// Stages of loop() that are timed when profiling is enabled
+enum ProfileStage : uint8_t {
+  PROFILE_LOOP = 0,
+  PROFILE_PROTOCOL,
+  PROFILE_BUTTONS,
+  PROFILE_TOGGLES,
+  PROFILE_CLIMATE,
+  PROFILE_SENSORS,
+  PROFILE_STAGE_COUNT,
+};
+#endif
+
+// Bus-side counters as handed to loop(). The bus side copies its own and
+// restarts the windows; loop() reports from the copy only, so nothing is
+// read or reset on one core while the other writes it.
+struct BusReport {
+  LinkStats link;
+  uint32_t reply_latency_max_us{0};
+  uint32_t reply_latency_window_us{0};  // Worst reply since the last report
+  uint8_t heater_stage{0};              // 4-wire elements on: 0, 1 or 2
+  uint32_t temp_rejected{0};            // 4-wire readings the temperature filter dropped
+#ifdef USE_BESTWAY_SPA_PROFILING
+  StageStats profile[PROFILE_STAGE_COUNT];  // Bus stages only
+#endif
 };
 
-// =============================================================================
-// 4-WIRE MODEL CONFIGURATIONS
-// =============================================================================
+static const size_t BUS_REPORT_QUEUE_SIZE = 2;
 
-// Heater bitmasks for 4-wire models
-struct ModelConfig4W {
-  uint8_t heat_bitmask1;
-  uint8_t heat_bitmask2;
-  uint8_t pump_bitmask;
-  uint8_t bubbles_bitmask;
-  uint8_t jets_bitmask;
-  bool has_jets;
-  bool has_air;
+#ifdef USE_BESTWAY_SPA_ENERGY
+// Loads whose energy use is integrated on the device
+enum EnergyLoad : uint8_t {
+  ENERGY_HEATER = 0,
+  ENERGY_PUMP,
+  ENERGY_BUBBLES,
+  ENERGY_JETS,
+  ENERGY_LOAD_COUNT,
 };
 
-// Model configurations
-static const ModelConfig4W CONFIG_54123 = {0x02, 0x08, 0x04, 0x10, 0x00, false, false};
-static const ModelConfig4W CONFIG_54138 = {0x30, 0x40, 0x04, 0x08, 0x80, true, true};
-static const ModelConfig4W CONFIG_54144 = {0x30, 0x40, 0x04, 0x08, 0x80, true, false};
-static const ModelConfig4W CONFIG_54154 = {0x02, 0x08, 0x04, 0x10, 0x00, false, false};
-static const ModelConfig4W CONFIG_54173 = {0x30, 0x40, 0x04, 0x08, 0x80, true, true};
+// Persisted energy totals, in watt-milliseconds so integration stays exact
+struct EnergyTotals {
+  uint64_t watt_ms[ENERGY_LOAD_COUNT];
+};
+#endif
 
 // =============================================================================
 // MAIN SPA CLASS
@@ -205,11 +349,71 @@ class BestwaySpaJetsSwitch;
 class BestwaySpaLockSwitch;
 class BestwaySpaPowerSwitch;
 
+#ifdef USE_BESTWAY_SPA_6WIRE
+// Drives the 6-wire lines from GPIOs. Each bit is a 50 us clock half-period
+// on each side, so a TYPE1 refresh holds the CPU for close to 10 ms.
+class BitBangTransport : public SixWireTransport {
+ public:
+  void set_pins(InternalGPIOPin *clk, InternalGPIOPin *data, InternalGPIOPin *cs) {
+    clk_pin_ = clk;
+    data_pin_ = data;
+    cs_pin_ = cs;
+  }
+  void setup() override;
+  void begin() override;
+  void end() override;
+  void write(const uint8_t *data, size_t len, BitOrder order) override;
+  void read(uint8_t *data, size_t len, BitOrder order) override;
+  bool is_blocking() const override { return true; }
+
+ protected:
+  void set_output_(bool output);
+  void pulse_clock_();
+
+  InternalGPIOPin *clk_pin_{nullptr};
+  InternalGPIOPin *data_pin_{nullptr};
+  InternalGPIOPin *cs_pin_{nullptr};
+  bool output_{true};
+};
+#endif
+
+#ifdef USE_BESTWAY_SPA_SPI
+// Hardware SPI backend. DATA is a single bidirectional line, so MOSI and
+// MISO are both tied to it (MOSI through a resistor). The peripheral runs
+// MSB first; LSB-first transfers are bit-reversed per byte.
+class SpiTransport : public SixWireTransport,
+                     public spi::SPIDevice<spi::BIT_ORDER_MSB_FIRST, spi::CLOCK_POLARITY_LOW,
+                                           spi::CLOCK_PHASE_LEADING, spi::DATA_RATE_200KHZ> {
+ public:
+  void setup() override { this->spi_setup(); }
+  void begin() override;
+  void end() override { this->disable(); }
+  void write(const uint8_t *data, size_t len, BitOrder order) override;
+  void read(uint8_t *data, size_t len, BitOrder order) override;
+};
+#endif
+
+// Spreads the blocking bit-banged transfers of several 6-wire spas over the
+// display refresh period. Each transfer holds loop() for milliseconds, so
+// granting one per slot keeps one tub from delaying another tub's frames.
+// Atomic because each spa with a bus task asks from its own task.
+class BusScheduler {
+ public:
+  static void add_bitbang_instance() { bitbang_count_.fetch_add(1, std::memory_order_relaxed); }
+  static bool acquire(uint32_t now);
+
+ protected:
+  static std::atomic<uint8_t> bitbang_count_;
+  static std::atomic<uint32_t> last_grant_ms_;
+};
+
 class BestwaySpa : public climate::Climate, public uart::UARTDevice, public Component {
  public:
+  BestwaySpa();
   void setup() override;
   void loop() override;
   void dump_config() override;
+  void on_shutdown() override;
   float get_setup_priority() const override { return setup_priority::DATA; }
 
   // Climate interface
@@ -225,10 +429,69 @@ class BestwaySpa : public climate::Climate, public uart::UARTDevice, public Comp
   void set_data_pin(InternalGPIOPin *pin) { data_pin_ = pin; }
   void set_cs_pin(InternalGPIOPin *pin) { cs_pin_ = pin; }
   void set_audio_pin(InternalGPIOPin *pin) { audio_pin_ = pin; }
+#ifdef USE_BESTWAY_SPA_6WIRE
+  // Replaces the bit-banged transport built from the pins above
+  void set_transport(SixWireTransport *transport) { transport_ = transport; }
+#endif
+  void set_passive_mode(bool passive) { passive_mode_ = passive; }
+#ifdef USE_BESTWAY_SPA_DETECT
+  // Listen at boot to find protocol and model; the configured ones are the
+  // fallback and the hint within a model family
+  void set_detect(bool detect) { detect_ = detect; }
+  void set_detect_timeout(uint32_t timeout_ms) { detect_timeout_ = timeout_ms; }
+  void set_save_detected(bool save) { save_detected_ = save; }
+#endif
+  void set_bus_task(bool enabled) { bus_task_enabled_ = enabled; }
+
+  // Publishing
+  void set_temperature_deadband(float deadband) { temperature_deadband_ = deadband; }
+  void set_temperature_filter(uint8_t window, uint8_t ema_shift, uint8_t max_jump, uint16_t hysteresis) {
+    temp_filter_.configure({window, ema_shift, max_jump, hysteresis});
+  }
+  void set_heartbeat_interval(uint32_t interval_ms) { heartbeat_interval_ = interval_ms; }
+  void set_restore_state(bool restore) { restore_state_ = restore; }
+  void set_restore_timeout(uint32_t timeout_ms) { restore_timeout_ = timeout_ms; }
+
+  // Link quality
+  void set_link_sensor(LinkCounter counter, sensor::Sensor *sensor) { link_sensors_[counter] = sensor; }
+  void set_frame_period_sensor(sensor::Sensor *sensor) { frame_period_sensor_ = sensor; }
+  void set_link_interval(uint32_t interval_ms) { link_interval_ = interval_ms; }
+  // As of the last bus report loop() took
+  const LinkStats &get_link_stats() const { return report_.link; }
+
+#ifdef USE_BESTWAY_SPA_PROFILING
+  // Profiling
+  void set_profile_sensor(ProfileStage stage, sensor::Sensor *sensor) { profile_sensors_[stage] = sensor; }
+  void set_profile_interval(uint32_t interval_ms) { profile_interval_ = interval_ms; }
+#endif
+
+#ifdef USE_BESTWAY_SPA_ENERGY
+  // Energy accounting
+  void set_load_power(EnergyLoad load, uint32_t watts) { load_power_[load] = watts; }
+  void set_energy_sensor(EnergyLoad load, sensor::Sensor *sensor) { energy_sensors_[load] = sensor; }
+  void set_total_energy_sensor(sensor::Sensor *sensor) { total_energy_sensor_ = sensor; }
+  void set_energy_save_interval(uint32_t interval_ms) { energy_save_interval_ = interval_ms; }
+#endif
+
+#ifdef USE_BESTWAY_SPA_PLANNER
+  // Tariff-aware heating planner
+  void set_time(time::RealTimeClock *time) { time_ = time; }
+  void set_default_price(float price) { default_price_ = price; }
+  // Heating rate in degrees C per hour to plan with until one is learned
+  void set_default_heating_rate(float rate) { default_heating_rate_ = rate; }
+  void add_price_window(uint16_t start_minute, uint16_t end_minute, float price) {
+    if (price_window_count_ < PRICE_WINDOW_MAX)
+      price_windows_[price_window_count_++] = {start_minute, end_minute, price};
+  }
+#endif
 
   // Sensors
   void set_current_temperature_sensor(sensor::Sensor *sensor) { current_temp_sensor_ = sensor; }
   void set_target_temperature_sensor(sensor::Sensor *sensor) { target_temp_sensor_ = sensor; }
+  void set_time_to_target_sensor(sensor::Sensor *sensor) { time_to_target_sensor_ = sensor; }
+  void set_heating_rate_sensor(sensor::Sensor *sensor) { heating_rate_sensor_ = sensor; }
+  void set_cooling_rate_sensor(sensor::Sensor *sensor) { cooling_rate_sensor_ = sensor; }
+  void set_reply_latency_sensor(sensor::Sensor *sensor) { reply_latency_sensor_ = sensor; }
 
   // Binary sensors
   void set_heating_sensor(binary_sensor::BinarySensor *sensor) { heating_sensor_ = sensor; }
@@ -256,22 +519,79 @@ class BestwaySpa : public climate::Climate, public uart::UARTDevice, public Comp
   void set_timer(uint8_t hours);
   void set_brightness(uint8_t level);
 
-  // State getters
-  const SpaState& get_state() const { return state_; }
-  bool has_jets() const;
-  bool has_air() const;
-  SpaModel get_model() const { return model_; }
+  // Reach a desired state in one transaction: the presses are planned from
+  // the confirmed state and queued together, or not at all
+  void apply_state(const DesiredState &desired);
+
+#ifdef USE_BESTWAY_SPA_PLANNER
+  // Reach target by the next deadline_minute of the day, heating in the
+  // cheapest quarter hours the learned heating rate allows
+  void start_heating_plan(float target, uint16_t deadline_minute);
+  void cancel_heating_plan();
+#endif
+
+  // Log the frame capture ring as hex lines for tools/bestway_replay.cpp
+  void dump_capture();
+
+  // State getters (the last state loop() published from)
+  const SpaState& get_state() const { return shown_; }
+  bool has_jets() const { return model_has_jets(get_model()); }
+  bool has_air() const { return model_has_air(get_model()); }
+
+  // When every spa in the YAML uses the same protocol/model, codegen pins it
+  // at compile time so protocol dispatch and model checks fold away
+  ProtocolType get_protocol_type() const {
+#ifdef BESTWAY_SPA_FIXED_PROTOCOL
+    return BESTWAY_SPA_FIXED_PROTOCOL;
+#else
+    return protocol_type_;
+#endif
+  }
+  SpaModel get_model() const {
+#ifdef BESTWAY_SPA_FIXED_MODEL
+    return BESTWAY_SPA_FIXED_MODEL;
+#else
+    return model_;
+#endif
+  }
 
  protected:
+  // Instance numbering, used for the log tag
+  static uint8_t instance_count_;
+  uint8_t instance_index_;
+  char tag_[16];
+
+  // Bus side of loop(): protocol, button queue and toggles. Runs in loop()
+  // or, on ESP32 with bus_task enabled, in its own task.
+  void run_bus_(uint32_t now);
+  bool defer_to_bus_(BusCommandType type, int16_t value);
+  bool defer_to_bus_(const BusCommand &cmd);
+  void apply_bus_command_(const BusCommand &cmd);
+#ifdef USE_BESTWAY_SPA_BUS_TASK
+  void start_bus_task_();
+  static void bus_task_fn_(void *arg);
+#endif
+
+  // Bus setup for the configured or detected protocol
+  void setup_protocol_();
+
+#ifdef USE_BESTWAY_SPA_DETECT
+  // Protocol detection
+  bool load_detection_();
+  void start_detection_();
+  void run_detection_(uint32_t now);
+  void finish_detection_();
+  void check_saved_detection_(uint32_t now);
+#endif
+
   // Protocol handlers
   void handle_4wire_protocol_();
   void handle_6wire_type1_protocol_();
   void handle_6wire_type2_protocol_();
 
-  // 6-wire SPI-like bit-banging
-  void send_bits_to_dsp_(uint32_t data, uint8_t bits);
-  uint16_t receive_bits_from_dsp_(uint8_t bits);
-  void pulse_clock_(uint32_t duration_us = 50);
+  // 6-wire transfers run only when the transport is ready and, for a
+  // blocking transport, the bus scheduler grants a slot
+  bool acquire_transport_(uint32_t now);
 
   // 6-wire packet handling
   void send_dsp_payload_type1_();
@@ -280,28 +600,84 @@ class BestwaySpa : public climate::Climate, public uart::UARTDevice, public Comp
   void receive_cio_payload_type2_();
   uint16_t get_pressed_button_();
 
+  // 6-wire passive capture
+  void setup_passive_capture_();
+  void start_sniffer_();
+  void stop_sniffer_();
+  void handle_6wire_passive_();
+  void decode_sniffed_frame_(const SniffedFrame &frame);
+  void update_states_from_display_(const DisplayStatus &status);
+
   // 4-wire packet handling
-  void parse_4wire_packet_(const std::vector<uint8_t> &packet);
+  size_t process_4wire_frames_();
+  void parse_4wire_packet_(const FrameView &packet);
+  void refresh_4wire_response_(uint32_t now);
   void send_4wire_response_();
+  void publish_reply_latency_(uint32_t now);
+  void publish_link_quality_(uint32_t now);
+  void make_bus_report_(BusReport *report);
+  void take_bus_report_(const BusReport &report);
 
   // State management
   void update_states_from_payload_();
   void handle_toggles_();
-  void update_climate_state_();
-  void update_sensors_();
+  void publish_changes_(uint32_t now);
+  uint16_t changed_fields_(const SpaSnapshot &cur) const;
+  void update_climate_state_(bool force);
+  void update_sensors_(const SpaSnapshot &cur, uint16_t fields);
+  bool publish_ready_(uint32_t now);
+  RateCondition rate_condition_() const;
+  void update_rate_model_(uint32_t now);
+
+#ifdef USE_BESTWAY_SPA_PROFILING
+  void publish_profile_(uint32_t now);
+  void dump_profile_();
+#endif
+
+  // Last-known state persistence
+  void restore_state_from_flash_();
+  void save_state_(uint32_t now, bool force);
+
+#ifdef USE_BESTWAY_SPA_PLANNER
+  void update_heating_plan_();
+#endif
+
+#ifdef USE_BESTWAY_SPA_ENERGY
+  void setup_energy_();
+  void update_energy_(uint32_t now);
+  void publish_energy_();
+  void save_energy_();
+#endif
+
+  // Frame capture, compiled out unless capture_size is set
+  void capture_frame_(CaptureKind kind, const uint8_t *data, size_t len) {
+#ifdef USE_BESTWAY_SPA_CAPTURE
+    capture_.push(kind, millis(), data, len);
+#else
+    (void) kind;
+    (void) data;
+    (void) len;
+#endif
+  }
+  void capture_button_(uint16_t code) {
+    uint8_t data[2] = {(uint8_t) (code >> 8), (uint8_t) (code & 0xFF)};
+    capture_frame_(CAPTURE_BUTTON, data, sizeof(data));
+  }
 
   // Button queue for 6-wire
-  void queue_button_(Buttons button, int duration_ms = 300);
+  void queue_button_(Buttons button, int duration_ms = 300, uint8_t target_state = TARGET_NONE,
+                     int target_value = 0);
   void process_button_queue_();
+  void abort_button_queue_();
+  int find_queued_button_(uint8_t target_state) const;
+  ButtonQueueItem make_button_item_(Buttons button, int duration_ms, uint8_t target_state, int target_value);
+  void apply_state_4wire_(const DesiredState &desired);
+  int get_state_value_(uint8_t target_state) const;
   uint16_t get_button_code_(Buttons button);
 
-  // Character decoding
-  char decode_7segment_(uint8_t segments, bool is_type1);
-
   // Utilities
   float celsius_to_fahrenheit_(float c) { return c * 9.0f / 5.0f + 32.0f; }
   float fahrenheit_to_celsius_(float f) { return (f - 32.0f) * 5.0f / 9.0f; }
-  uint8_t calculate_checksum_(const uint8_t *data, size_t len);
 
   // Configuration
   ProtocolType protocol_type_{PROTOCOL_4WIRE};
@@ -312,14 +688,118 @@ class BestwaySpa : public climate::Climate, public uart::UARTDevice, public Comp
   InternalGPIOPin *data_pin_{nullptr};
   InternalGPIOPin *cs_pin_{nullptr};
   InternalGPIOPin *audio_pin_{nullptr};
-
-  // State
+#ifdef USE_BESTWAY_SPA_6WIRE
+  SixWireTransport *transport_{nullptr};
+  BitBangTransport bitbang_;
+#endif
+
+  // Passive capture (6-wire)
+  bool passive_mode_{false};
+#ifdef USE_BESTWAY_SPA_6WIRE
+  // Allocated only while the spa listens in (passive mode or detection)
+  SnifferStore *sniffer_{nullptr};
+#endif
+
+  // State. state_ and toggles_ belong to the bus side; publishing works
+  // from shown_, a copy taken each loop() or received from the bus task.
   SpaState state_;
   SpaToggles toggles_;
+  SpaState shown_;
+
+  bool bus_task_enabled_{false};
+#ifdef USE_BESTWAY_SPA_BUS_TASK
+  TaskHandle_t bus_task_{nullptr};
+  SpscQueue<BusCommand, BUS_COMMAND_QUEUE_SIZE> bus_commands_;
+  SpscQueue<SpaState, BUS_STATE_QUEUE_SIZE> bus_states_;
+  SpscQueue<BusReport, BUS_REPORT_QUEUE_SIZE> bus_reports_;
+#endif
+  // loop()'s copy of the bus-side counters
+  BusReport report_;
+
+  // Last values sent to the sensors (the climate entity keeps its own)
+  SpaSnapshot published_state_;
+  float temperature_deadband_{0.5f};
+  uint32_t heartbeat_interval_{300000};
+  uint32_t last_heartbeat_{0};
+  bool published_once_{false};
+
+  // Last-known state persistence. Publishing waits up to restore_timeout_
+  // for the bus to confirm the restored state.
+  bool restore_state_{true};
+  uint32_t restore_timeout_{30000};
+  uint32_t setup_time_{0};
+  bool stale_published_{false};
+  ESPPreferenceObject state_pref_;
+  SpaSnapshot saved_state_;
+  uint32_t last_state_save_{0};
+
+#ifdef USE_BESTWAY_SPA_DETECT
+  // Protocol detection. While detecting_ only the UART and the 6-wire
+  // lines are listened to; the bus is set up when it ends.
+  bool detect_{false};
+  uint32_t detect_timeout_{15000};
+  bool save_detected_{true};
+  bool detecting_{false};
+  bool detect_sniffing_{false};
+  bool detection_from_flash_{false};
+  uint32_t detect_start_{0};
+  ProtocolDetector detector_;
+  ESPPreferenceObject detect_pref_;
+#endif
+
+  // Learned heating/cooling rates
+  HeatRateModel rate_model_;
+  uint32_t last_rate_sample_{0};
+  bool rate_unit_celsius_{true};
+
+#ifdef USE_BESTWAY_SPA_PLANNER
+  // Heating plan, re-planned every minute from the confirmed temperature
+  time::RealTimeClock *time_{nullptr};
+  PriceWindow price_windows_[PRICE_WINDOW_MAX];
+  size_t price_window_count_{0};
+  float default_price_{1.0f};
+  float default_heating_rate_{1.0f};
+  bool plan_active_{false};
+  float plan_target_{0.0f};
+  time_t plan_deadline_{0};
+  int plan_last_minute_{-1};
+  int8_t plan_heating_{-1};  // Last decision applied, -1 before the first
+#endif
+
+#ifdef USE_BESTWAY_SPA_PROFILING
+  // Per-stage timing. The bus stages are the bus side's; loop() reads
+  // those from report_.profile.
+  StageStats profile_[PROFILE_STAGE_COUNT];
+  sensor::Sensor *profile_sensors_[PROFILE_STAGE_COUNT]{nullptr};
+  uint32_t profile_interval_{60000};
+  uint32_t last_profile_publish_{0};
+#endif
+
+#ifdef USE_BESTWAY_SPA_CAPTURE
+  CaptureRing<BESTWAY_SPA_CAPTURE_SIZE> capture_;
+#endif
+
+#ifdef USE_BESTWAY_SPA_ENERGY
+  // Energy accounting
+  uint32_t load_power_[ENERGY_LOAD_COUNT]{2000, 60, 800, 600};
+  sensor::Sensor *energy_sensors_[ENERGY_LOAD_COUNT]{nullptr};
+  sensor::Sensor *total_energy_sensor_{nullptr};
+  EnergyTotals energy_{};
+  EnergyTotals energy_saved_{};
+  ESPPreferenceObject energy_pref_;
+  uint32_t energy_save_interval_{900000};
+  uint32_t last_energy_update_{0};
+  uint32_t last_energy_publish_{0};
+  uint32_t last_energy_save_{0};
+#endif
 
   // Sensors
   sensor::Sensor *current_temp_sensor_{nullptr};
   sensor::Sensor *target_temp_sensor_{nullptr};
+  sensor::Sensor *time_to_target_sensor_{nullptr};
+  sensor::Sensor *heating_rate_sensor_{nullptr};
+  sensor::Sensor *cooling_rate_sensor_{nullptr};
+  sensor::Sensor *reply_latency_sensor_{nullptr};
   binary_sensor::BinarySensor *heating_sensor_{nullptr};
   binary_sensor::BinarySensor *filter_sensor_{nullptr};
   binary_sensor::BinarySensor *bubbles_sensor_{nullptr};
@@ -331,7 +811,7 @@ class BestwaySpa : public climate::Climate, public uart::UARTDevice, public Comp
   text_sensor::TextSensor *display_text_sensor_{nullptr};
 
   // Packet buffers
-  std::vector<uint8_t> rx_buffer_;
+  RxBuffer<RX_BUFFER_SIZE> rx_buffer_;
   uint8_t cio_payload_[16]{0};
   uint8_t dsp_payload_[16]{0};
   size_t cio_payload_len_{0};
@@ -345,13 +825,15 @@ class BestwaySpa : public climate::Climate, public uart::UARTDevice, public Comp
   uint32_t last_button_poll_{0};
 
   // Button queue
-  std::vector<ButtonQueueItem> button_queue_;
+  RingQueue<ButtonQueueItem, BUTTON_QUEUE_SIZE> button_queue_;
+  uint32_t button_queue_overflows_{0};
   uint16_t current_button_code_{0};
+  uint16_t virtual_button_code_{0};  // Code held by the press engine, merged with the DSP reading
+  Buttons last_pressed_{NOBTN};
   bool button_enabled_[BTN_COUNT]{true, true, true, true, true, true, true, true, true, true, true};
 
   // Protocol state
   bool paused_{false};
-  bool new_packet_available_{false};
   uint8_t bit_counter_{0};
   uint8_t byte_buffer_{0};
 
@@ -360,8 +842,29 @@ class BestwaySpa : public climate::Climate, public uart::UARTDevice, public Comp
   uint8_t heater_stage_{0};
   uint32_t stage_start_time_{0};
 
+  // 4-wire reply, re-encoded only when the commanded outputs change
+  CioCommand4W response_cmd_{};
+  uint8_t response_frame_[FRAME_4W_LEN]{0};
+  bool response_valid_{false};
+  uint32_t rx_idle_us_{0};
+  uint32_t reply_latency_max_us_{0};
+  uint32_t reply_latency_window_us_{0};
+  uint32_t last_latency_publish_{0};
+
+  // Link quality, written by whichever side runs the bus; loop() reads
+  // report_.link
+  LinkStats link_;
+  sensor::Sensor *link_sensors_[LINK_COUNTER_COUNT]{nullptr};
+  sensor::Sensor *frame_period_sensor_{nullptr};
+  uint32_t link_interval_{60000};
+  uint32_t last_link_publish_{0};
+
+  // Raw CIO temperature readings, filtered before they reach state_
+  TempFilter temp_filter_;
+
   // Model config
   const ModelConfig4W *model_config_{&CONFIG_54154};
+  const uint16_t *btn_codes_{nullptr};
 };
 
 // =============================================================================
@@ -436,5 +939,77 @@ class BestwaySpaPowerSwitch : public switch_::Switch, public Component {
   BestwaySpa *parent_{nullptr};
 };
 
+// =============================================================================
+// ACTIONS
+// =============================================================================
+
+template<typename... Ts> class DumpCaptureAction : public Action<Ts...> {
+ public:
+  void set_parent(BestwaySpa *parent) { parent_ = parent; }
+  void play(Ts... x) override { parent_->dump_capture(); }
+ protected:
+  BestwaySpa *parent_{nullptr};
+};
+
+template<typename... Ts> class ApplyStateAction : public Action<Ts...> {
+ public:
+  void set_parent(BestwaySpa *parent) { parent_ = parent; }
+  TEMPLATABLE_VALUE(bool, power)
+  TEMPLATABLE_VALUE(bool, heater)
+  TEMPLATABLE_VALUE(bool, filter)
+  TEMPLATABLE_VALUE(bool, bubbles)
+  TEMPLATABLE_VALUE(bool, jets)
+  TEMPLATABLE_VALUE(bool, locked)
+  TEMPLATABLE_VALUE(bool, celsius)
+  TEMPLATABLE_VALUE(float, target_temperature)
+
+  void play(Ts... x) override {
+    DesiredState desired;
+    if (power_.has_value())
+      desired.set(DESIRED_POWER, power_.value(x...));
+    if (heater_.has_value())
+      desired.set(DESIRED_HEATER, heater_.value(x...));
+    if (filter_.has_value())
+      desired.set(DESIRED_FILTER, filter_.value(x...));
+    if (bubbles_.has_value())
+      desired.set(DESIRED_BUBBLES, bubbles_.value(x...));
+    if (jets_.has_value())
+      desired.set(DESIRED_JETS, jets_.value(x...));
+    if (locked_.has_value())
+      desired.set(DESIRED_LOCK, locked_.value(x...));
+    if (celsius_.has_value())
+      desired.set(DESIRED_CELSIUS, celsius_.value(x...));
+    if (target_temperature_.has_value())
+      desired.set_target(target_temperature_.value(x...));
+    parent_->apply_state(desired);
+  }
+
+ protected:
+  BestwaySpa *parent_{nullptr};
+};
+
+#ifdef USE_BESTWAY_SPA_PLANNER
+template<typename... Ts> class StartHeatingPlanAction : public Action<Ts...> {
+ public:
+  void set_parent(BestwaySpa *parent) { parent_ = parent; }
+  void set_deadline(uint16_t minute) { deadline_ = minute; }
+  TEMPLATABLE_VALUE(float, target_temperature)
+
+  void play(Ts... x) override { parent_->start_heating_plan(target_temperature_.value(x...), deadline_); }
+
+ protected:
+  BestwaySpa *parent_{nullptr};
+  uint16_t deadline_{0};
+};
+
+template<typename... Ts> class CancelHeatingPlanAction : public Action<Ts...> {
+ public:
+  void set_parent(BestwaySpa *parent) { parent_ = parent; }
+  void play(Ts... x) override { parent_->cancel_heating_plan(); }
+ protected:
+  BestwaySpa *parent_{nullptr};
+};
+#endif
+
 }  // namespace bestway_spa
 }  // namespace esphome
@@ -0,0 +1,724 @@
+// Unit tests for the protocol codec: 4-wire framing, 6-wire payloads, the
+// button and 7-segment tables, the temperature filter, the heating rate
+// model and the tariff planner.
+
+#include "bestway_codec.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace esphome::bestway_spa;
+
+namespace {
+
+const ModelConfig4W *const CONFIGS_4W[] = {&CONFIG_54123, &CONFIG_54138, &CONFIG_54144, &CONFIG_54154,
+                                           &CONFIG_54173};
+
+// Splits a byte stream into frames the way process_4wire_frames_() does
+struct FrameScan {
+  int ok{0};
+  int bad_checksum{0};
+  size_t discarded{0};
+  std::vector<uint8_t> temps;
+};
+
+FrameScan scan_4wire(const std::vector<uint8_t> &stream) {
+  FrameScan scan;
+  size_t pos = 0;
+  while (stream.size() - pos >= FRAME_4W_LEN) {
+    FrameView frame{stream.data() + pos, FRAME_4W_LEN};
+    FrameCheck check = check_4wire_frame(frame);
+    if (check == FRAME_BAD_MARKER) {
+      size_t skip = find_4wire_resync(stream.data() + pos, stream.size() - pos);
+      scan.discarded += skip;
+      pos += skip;
+      continue;
+    }
+    if (check == FRAME_OK) {
+      scan.ok++;
+      scan.temps.push_back(frame[2]);
+    } else {
+      scan.bad_checksum++;
+    }
+    pos += FRAME_4W_LEN;
+  }
+  return scan;
+}
+
+void append_status(std::vector<uint8_t> *stream, uint8_t command, uint8_t temp) {
+  CioStatus4W status{};
+  status.temperature = temp;
+  status.filter_pump = (command & CONFIG_54154.pump_bitmask) != 0;
+  uint8_t frame[FRAME_4W_LEN];
+  encode_4wire_status(status, CONFIG_54154, frame);
+  stream->insert(stream->end(), frame, frame + FRAME_4W_LEN);
+}
+
+}  // namespace
+
+// -----------------------------------------------------------------------------
+// 4-wire
+// -----------------------------------------------------------------------------
+
+TEST(Checksum, SumsBytesModulo256) {
+  const uint8_t none[1] = {0};
+  EXPECT_EQ(calculate_checksum(none, 0), 0);
+  const uint8_t data[4] = {0x12, 0x34, 0x56, 0x78};
+  EXPECT_EQ(calculate_checksum(data, 4), 0x14);  // 0x114 wraps
+  const uint8_t ones[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+  EXPECT_EQ(calculate_checksum(ones, 4), 0xFC);
+}
+
+TEST(FourWire, ResponseFrameLayout) {
+  CioCommand4W cmd{2, true, false, false, 38};
+  uint8_t frame[FRAME_4W_LEN];
+  encode_4wire_response(cmd, CONFIG_54154, frame);
+  EXPECT_EQ(frame[0], FRAME_4W_MARKER);
+  EXPECT_EQ(frame[6], FRAME_4W_MARKER);
+  EXPECT_EQ(frame[1], CONFIG_54154.heat_bitmask1 | CONFIG_54154.heat_bitmask2 | CONFIG_54154.pump_bitmask);
+  EXPECT_EQ(frame[2], 38);
+  EXPECT_EQ(frame[5], calculate_checksum(frame + 1, 4));
+  EXPECT_EQ(check_4wire_frame(FrameView{frame, FRAME_4W_LEN}), FRAME_OK);
+}
+
+TEST(FourWire, HeaterStagesAddElements) {
+  uint8_t frame[FRAME_4W_LEN];
+  encode_4wire_response(CioCommand4W{1, false, false, false, 30}, CONFIG_54154, frame);
+  EXPECT_EQ(frame[1], CONFIG_54154.heat_bitmask1);
+  encode_4wire_response(CioCommand4W{0, false, false, false, 30}, CONFIG_54154, frame);
+  EXPECT_EQ(frame[1], 0);
+}
+
+TEST(FourWire, JetsOnlyOnModelsWithJets) {
+  uint8_t frame[FRAME_4W_LEN];
+  encode_4wire_response(CioCommand4W{0, false, false, true, 30}, CONFIG_54154, frame);
+  EXPECT_EQ(frame[1], 0);
+  encode_4wire_response(CioCommand4W{0, false, false, true, 30}, CONFIG_54144, frame);
+  EXPECT_EQ(frame[1], CONFIG_54144.jets_bitmask);
+}
+
+TEST(FourWire, StatusRoundTripsForEveryModel) {
+  for (const ModelConfig4W *config : CONFIGS_4W) {
+    for (int bits = 0; bits < 16; bits++) {
+      CioStatus4W in{};
+      in.temperature = 20 + bits;
+      in.error_code = bits == 15 ? 3 : 0;
+      in.filter_pump = bits & 1;
+      in.bubbles = bits & 2;
+      in.jets = (bits & 4) && config->has_jets;
+      in.heater_red = bits & 8;
+
+      uint8_t frame[FRAME_4W_LEN];
+      encode_4wire_status(in, *config, frame);
+      ASSERT_EQ(check_4wire_frame(FrameView{frame, FRAME_4W_LEN}), FRAME_OK);
+
+      CioStatus4W out{};
+      decode_4wire_frame(FrameView{frame, FRAME_4W_LEN}, *config, &out);
+      EXPECT_EQ(out.temperature, in.temperature);
+      EXPECT_EQ(out.error_code, in.error_code);
+      EXPECT_EQ(out.filter_pump, in.filter_pump);
+      EXPECT_EQ(out.bubbles, in.bubbles);
+      EXPECT_EQ(out.jets, in.jets);
+      EXPECT_EQ(out.heater_red, in.heater_red);
+    }
+  }
+}
+
+TEST(FourWire, RejectsBadMarkersAndChecksums) {
+  uint8_t frame[FRAME_4W_LEN];
+  encode_4wire_response(CioCommand4W{0, true, false, false, 35}, CONFIG_54154, frame);
+
+  uint8_t bad[FRAME_4W_LEN];
+  memcpy(bad, frame, sizeof(bad));
+  bad[0] = 0x00;
+  EXPECT_EQ(check_4wire_frame(FrameView{bad, FRAME_4W_LEN}), FRAME_BAD_MARKER);
+  memcpy(bad, frame, sizeof(bad));
+  bad[6] = 0x7F;
+  EXPECT_EQ(check_4wire_frame(FrameView{bad, FRAME_4W_LEN}), FRAME_BAD_MARKER);
+  memcpy(bad, frame, sizeof(bad));
+  bad[2] ^= 0x01;
+  EXPECT_EQ(check_4wire_frame(FrameView{bad, FRAME_4W_LEN}), FRAME_BAD_CHECKSUM);
+  EXPECT_EQ(check_4wire_frame(FrameView{frame, FRAME_4W_LEN - 1}), FRAME_BAD_MARKER);
+}
+
+TEST(FourWire, ResyncSkipsToNextMarker) {
+  const uint8_t data[] = {0x12, 0x34, 0xFF, 0x00};
+  EXPECT_EQ(find_4wire_resync(data, sizeof(data)), 2u);
+  // Always drops at least one byte, even when the first is a marker
+  const uint8_t marker_first[] = {0xFF, 0xFF, 0x00};
+  EXPECT_EQ(find_4wire_resync(marker_first, sizeof(marker_first)), 1u);
+  const uint8_t no_marker[] = {0x01, 0x02, 0x03};
+  EXPECT_EQ(find_4wire_resync(no_marker, sizeof(no_marker)), 3u);
+}
+
+TEST(FourWire, StreamRecoversFromLeadingNoise) {
+  std::vector<uint8_t> stream = {0x00, 0x13, 0x37};
+  append_status(&stream, CONFIG_54154.pump_bitmask, 30);
+  append_status(&stream, 0, 31);
+
+  FrameScan scan = scan_4wire(stream);
+  EXPECT_EQ(scan.ok, 2);
+  EXPECT_EQ(scan.bad_checksum, 0);
+  EXPECT_EQ(scan.discarded, 3u);
+}
+
+TEST(FourWire, StreamRecoversFromCorruptedBytes) {
+  std::vector<uint8_t> stream;
+  append_status(&stream, 0, 30);
+  append_status(&stream, 0, 31);
+  stream.push_back(0x55);  // Line noise between frames
+  append_status(&stream, 0, 32);
+  stream[FRAME_4W_LEN + 2] ^= 0x40;  // Corrupt the second frame's temperature
+
+  FrameScan scan = scan_4wire(stream);
+  EXPECT_EQ(scan.ok, 2);
+  EXPECT_EQ(scan.bad_checksum, 1);
+  EXPECT_EQ(scan.discarded, 1u);
+  EXPECT_EQ(scan.temps, (std::vector<uint8_t>{30, 32}));
+}
+
+TEST(FourWire, LostEndMarkerCostsOnlyTheNextFrame) {
+  std::vector<uint8_t> stream;
+  append_status(&stream, 0, 30);
+  append_status(&stream, 0, 31);
+  append_status(&stream, 0, 32);
+  // The second frame's start marker closes the first; the second is lost
+  stream.erase(stream.begin() + FRAME_4W_LEN - 1);
+
+  FrameScan scan = scan_4wire(stream);
+  EXPECT_EQ(scan.temps, (std::vector<uint8_t>{30, 32}));
+  EXPECT_EQ(scan.discarded, FRAME_4W_LEN - 1);
+}
+
+TEST(FourWire, ChecksumFailureConsumesOneFrame) {
+  std::vector<uint8_t> stream;
+  append_status(&stream, 0, 30);
+  append_status(&stream, 0, 31);
+  stream[3] ^= 0x01;
+
+  FrameScan scan = scan_4wire(stream);
+  EXPECT_EQ(scan.bad_checksum, 1);
+  EXPECT_EQ(scan.ok, 1);
+  EXPECT_EQ(scan.discarded, 0u);
+}
+
+// -----------------------------------------------------------------------------
+// 6-wire payloads
+// -----------------------------------------------------------------------------
+
+namespace {
+
+DisplayStatus status_from_bits(int bits) {
+  DisplayStatus s{};
+  s.locked = bits & 0x001;
+  s.timer = bits & 0x002;
+  s.heater_green = bits & 0x004;
+  s.heater_red = bits & 0x008;
+  s.bubbles = bits & 0x010;
+  s.filter_pump = bits & 0x020;
+  s.celsius = bits & 0x040;
+  s.fahrenheit = bits & 0x080;
+  s.power = bits & 0x100;
+  s.jets = bits & 0x200;
+  return s;
+}
+
+void expect_same_status(const DisplayStatus &a, const DisplayStatus &b) {
+  EXPECT_EQ(a.locked, b.locked);
+  EXPECT_EQ(a.timer, b.timer);
+  EXPECT_EQ(a.heater_green, b.heater_green);
+  EXPECT_EQ(a.heater_red, b.heater_red);
+  EXPECT_EQ(a.bubbles, b.bubbles);
+  EXPECT_EQ(a.filter_pump, b.filter_pump);
+  EXPECT_EQ(a.celsius, b.celsius);
+  EXPECT_EQ(a.fahrenheit, b.fahrenheit);
+  EXPECT_EQ(a.power, b.power);
+  EXPECT_EQ(a.jets, b.jets);
+}
+
+}  // namespace
+
+class DisplayPayload : public ::testing::TestWithParam<bool> {};
+
+TEST_P(DisplayPayload, StatusRoundTripsEveryLedCombination) {
+  const bool is_type1 = GetParam();
+  for (int bits = 0; bits < 0x400; bits++) {
+    DisplayStatus in = status_from_bits(bits);
+    uint8_t payload[T1_PAYLOAD_LEN] = {DSP_CMD1_MODE6_11_7};
+    encode_display_payload(in, "38C", is_type1, payload);
+    DisplayStatus out{};
+    decode_display_status(payload, is_type1, &out);
+    expect_same_status(in, out);
+    if (HasFailure()) {
+      FAIL() << "LED bits 0x" << std::hex << bits;
+    }
+  }
+}
+
+TEST_P(DisplayPayload, DigitsRoundTrip) {
+  const bool is_type1 = GetParam();
+  const char *const texts[] = {"38C", "104", "E02", " - ", "OFF", "LO "};
+  for (const char *text : texts) {
+    uint8_t payload[T1_PAYLOAD_LEN] = {DSP_CMD1_MODE6_11_7};
+    encode_display_payload(DisplayStatus{}, text, is_type1, payload);
+    char digits[3];
+    decode_display_digits(payload, is_type1, digits);
+    EXPECT_EQ(std::string(digits, 3), std::string(text)) << (is_type1 ? "TYPE1" : "TYPE2");
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Types, DisplayPayload, ::testing::Values(true, false),
+                         [](const ::testing::TestParamInfo<bool> &info) { return info.param ? "Type1" : "Type2"; });
+
+TEST(DisplayPayload, Type1KeepsCommandByte) {
+  uint8_t payload[T1_PAYLOAD_LEN];
+  memset(payload, 0xAA, sizeof(payload));
+  payload[0] = DSP_CMD1_MODE6_11_7_P05504;
+  encode_display_payload(status_from_bits(0x3FF), "888", true, payload);
+  EXPECT_EQ(payload[0], DSP_CMD1_MODE6_11_7_P05504);
+}
+
+TEST(DisplayPayload, Type2LedBitsLandInTheirBytes) {
+  uint8_t payload[T2_PAYLOAD_LEN];
+  DisplayStatus s{};
+  s.power = true;
+  encode_display_payload(s, "   ", false, payload);
+  EXPECT_EQ(payload[T2_POWER_IDX], 1 << T2_POWER_BIT);
+  EXPECT_EQ(payload[T2_TIMER_IDX], 0);
+}
+
+// -----------------------------------------------------------------------------
+// Tables
+// -----------------------------------------------------------------------------
+
+TEST(SevenSegment, EveryCharacterRoundTripsToItsFirstMatch) {
+  for (bool is_type1 : {true, false}) {
+    const uint8_t *codes = is_type1 ? CHARCODES_TYPE1 : CHARCODES_TYPE2;
+    for (size_t i = 0; i < CHARCODE_COUNT; i++) {
+      uint8_t segments = encode_7segment(CHARS[i], is_type1);
+      EXPECT_EQ(segments, codes[i]);
+      // Characters sharing a pattern (5/S, U/V/W) decode to the first one
+      size_t first = i;
+      for (size_t j = 0; j < i; j++) {
+        if (codes[j] == codes[i]) {
+          first = j;
+          break;
+        }
+      }
+      EXPECT_EQ(decode_7segment(segments, is_type1), CHARS[first]) << "char " << CHARS[i];
+    }
+  }
+}
+
+TEST(SevenSegment, LowercaseEncodesAsUppercase) {
+  EXPECT_EQ(encode_7segment('e', true), encode_7segment('E', true));
+  EXPECT_EQ(encode_7segment('h', false), encode_7segment('H', false));
+}
+
+TEST(SevenSegment, UnknownInputs) {
+  EXPECT_EQ(encode_7segment('#', true), 0x00);
+  EXPECT_EQ(encode_7segment('#', false), 0x00);
+  // 0x01 is not the pattern of any character in either table
+  EXPECT_EQ(decode_7segment(0x01, true), '?');
+  EXPECT_EQ(decode_7segment(0x01, false), '?');
+}
+
+TEST(SevenSegment, LookupMatchesLinearScanForEveryByte) {
+  for (bool is_type1 : {true, false}) {
+    const uint8_t *codes = is_type1 ? CHARCODES_TYPE1 : CHARCODES_TYPE2;
+    for (int b = 0; b < 256; b++) {
+      char expected = '?';
+      for (size_t i = 0; i < CHARCODE_COUNT; i++) {
+        if (codes[i] == b) {
+          expected = CHARS[i];
+          break;
+        }
+      }
+      EXPECT_EQ(decode_7segment((uint8_t) b, is_type1), expected) << "byte " << b;
+    }
+  }
+}
+
+TEST(Buttons, EveryCodeDecodesToItsButton) {
+  const SpaModel models[] = {MODEL_PRE2021, MODEL_P05504, MODEL_54149E};
+  for (SpaModel model : models) {
+    const uint16_t *codes = get_button_codes(model);
+    ASSERT_NE(codes, nullptr) << model_name(model);
+    for (uint8_t b = NOBTN + 1; b < BTN_COUNT; b++) {
+      if (codes[b] == 0x0000) continue;  // Not on this model
+      EXPECT_EQ(decode_button_code(codes, codes[b]), b) << model_name(model) << " button " << (int) b;
+    }
+  }
+}
+
+TEST(Buttons, IdleAndUnknownCodesAreNoButton) {
+  EXPECT_EQ(decode_button_code(BTN_CODES_PRE2021, BTN_CODES_PRE2021[NOBTN]), NOBTN);
+  EXPECT_EQ(decode_button_code(BTN_CODES_PRE2021, 0xFFFF), NOBTN);
+  // TYPE1 tables fill missing buttons with 0x0000; a read of 0 is not POWER
+  EXPECT_EQ(decode_button_code(BTN_CODES_PRE2021, 0x0000), NOBTN);
+  EXPECT_EQ(decode_button_code(BTN_CODES_P05504, 0x0000), NOBTN);
+  EXPECT_EQ(decode_button_code(BTN_CODES_54149E, 0x0000), NOBTN);
+  EXPECT_EQ(decode_button_code(BTN_CODES_54149E, 0xFFFF), NOBTN);
+}
+
+TEST(Buttons, ModelTables) {
+  EXPECT_EQ(get_button_codes(MODEL_PRE2021), BTN_CODES_PRE2021);
+  EXPECT_EQ(get_button_codes(MODEL_P05504), BTN_CODES_P05504);
+  EXPECT_EQ(get_button_codes(MODEL_54149E), BTN_CODES_54149E);
+  EXPECT_EQ(get_model_config_4w(MODEL_54144), &CONFIG_54144);
+  EXPECT_EQ(get_model_config_4w(MODEL_54173), &CONFIG_54173);
+}
+
+TEST(BitOrder, ReverseBits) {
+  EXPECT_EQ(reverse_bits(0x01), 0x80);
+  EXPECT_EQ(reverse_bits(0x40), 0x02);
+  EXPECT_EQ(reverse_bits(0xC0), 0x03);
+  for (int b = 0; b < 256; b++) {
+    EXPECT_EQ(reverse_bits(reverse_bits((uint8_t) b)), b);
+  }
+}
+
+TEST(MemoryTransport, StoresWritesInWireOrder) {
+  MemoryTransport bus;
+  const uint8_t data[2] = {0x01, 0xC0};
+  bus.begin();
+  bus.write(data, 2, BIT_ORDER_MSB);
+  bus.write(data, 2, BIT_ORDER_LSB);
+  bus.end();
+
+  const uint8_t expected[4] = {0x01, 0xC0, 0x80, 0x03};
+  ASSERT_EQ(bus.written_len(), 4u);
+  EXPECT_EQ(memcmp(bus.written(), expected, 4), 0);
+  EXPECT_EQ(bus.transactions(), 1u);
+  EXPECT_FALSE(bus.in_transaction());
+}
+
+TEST(MemoryTransport, ReadsScriptThenIdleHigh) {
+  MemoryTransport bus;
+  const uint8_t script[2] = {0x80, 0x12};
+  bus.set_read_data(script, 2);
+
+  uint8_t out[3];
+  bus.read(out, 1, BIT_ORDER_LSB);
+  bus.read(out + 1, 2, BIT_ORDER_MSB);
+  EXPECT_EQ(out[0], 0x01);
+  EXPECT_EQ(out[1], 0x12);
+  EXPECT_EQ(out[2], 0xFF);
+}
+
+// =============================================================================
+// QUEUES
+// =============================================================================
+
+TEST(SpscQueue, FifoUntilFull) {
+  SpscQueue<int, 4> queue;
+  EXPECT_TRUE(queue.empty());
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(queue.push(i));
+  }
+  EXPECT_FALSE(queue.push(4));
+  EXPECT_EQ(queue.size(), 4u);
+
+  int out = -1;
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(queue.pop(out));
+    EXPECT_EQ(out, i);
+  }
+  EXPECT_FALSE(queue.pop(out));
+  EXPECT_TRUE(queue.empty());
+}
+
+// The bus task and loop() on two cores: one thread pushes, one pops, and a
+// third watches size() the way the bus task checks bus_reports_
+TEST(SpscQueue, ThreadedProducerAndConsumer) {
+  struct Item {
+    uint32_t seq;
+    uint32_t check;  // ~seq, catches an item read while half written
+  };
+  static const uint32_t ITEMS = 50000;
+  SpscQueue<Item, 8> queue;
+  std::atomic<bool> done{false};
+  std::atomic<uint32_t> bad_sizes{0};
+
+  std::thread producer([&] {
+    for (uint32_t seq = 0; seq < ITEMS;) {
+      if (queue.push(Item{seq, ~seq})) {
+        seq++;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+  std::thread observer([&] {
+    while (!done.load()) {
+      if (queue.size() > queue.capacity())
+        bad_sizes++;
+      std::this_thread::yield();
+    }
+  });
+
+  uint32_t expected = 0;
+  uint32_t out_of_order = 0;
+  while (expected < ITEMS) {
+    Item item;
+    if (!queue.pop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (item.seq != expected || item.check != ~expected)
+      out_of_order++;
+    expected++;
+  }
+  done = true;
+  producer.join();
+  observer.join();
+
+  EXPECT_EQ(out_of_order, 0u);
+  EXPECT_EQ(bad_sizes.load(), 0u);
+  EXPECT_TRUE(queue.empty());
+}
+
+// =============================================================================
+// TEMPERATURE FILTER
+// =============================================================================
+
+TEST(TempFilter, FirstReadingSeedsTheOutput) {
+  TempFilter filter;
+  filter.configure(TempFilterConfig{});
+  EXPECT_FALSE(filter.has_value());
+  EXPECT_TRUE(filter.push(30));
+  EXPECT_TRUE(filter.has_value());
+  EXPECT_EQ(filter.value(), 30);
+  EXPECT_EQ(filter.rejected(), 0u);
+}
+
+TEST(TempFilter, DropsASpikeRightAfterStartUp) {
+  TempFilter filter;
+  filter.configure(TempFilterConfig{});
+  filter.push(30);
+  EXPECT_FALSE(filter.push(99));
+  EXPECT_FALSE(filter.push(0));
+  EXPECT_EQ(filter.value(), 30);
+  EXPECT_EQ(filter.rejected(), 2u);
+  // Back in range, the readings are taken again
+  EXPECT_FALSE(filter.push(31));
+  EXPECT_EQ(filter.rejected(), 2u);
+}
+
+TEST(TempFilter, RecoversFromABadFirstReading) {
+  // A garbage seed makes every real reading look like an outlier; after a
+  // window's worth in a row the filter starts over from them
+  TempFilter filter;
+  filter.configure(TempFilterConfig{});
+  filter.push(0);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_FALSE(filter.push(38)) << "reading " << i;
+    EXPECT_EQ(filter.value(), 0);
+  }
+  EXPECT_TRUE(filter.push(38));
+  EXPECT_EQ(filter.value(), 38);
+  EXPECT_EQ(filter.rejected(), 5u);
+  EXPECT_FALSE(filter.push(38));
+}
+
+TEST(TempFilter, InRangeReadingRestartsTheOutlierCount) {
+  TempFilter filter;
+  filter.configure(TempFilterConfig{});
+  filter.push(30);
+  for (int i = 0; i < 4; i++) filter.push(60);
+  filter.push(30);
+  // Four more outliers are not yet a window in a row
+  for (int i = 0; i < 4; i++) {
+    EXPECT_FALSE(filter.push(60));
+  }
+  EXPECT_EQ(filter.value(), 30);
+}
+
+TEST(TempFilter, ZeroMaxJumpAcceptsEverything) {
+  TempFilterConfig config;
+  config.max_jump = 0;
+  config.window = 1;
+  config.ema_shift = 0;
+  TempFilter filter;
+  filter.configure(config);
+  filter.push(30);
+  EXPECT_TRUE(filter.push(99));
+  EXPECT_EQ(filter.value(), 99);
+  EXPECT_EQ(filter.rejected(), 0u);
+}
+
+TEST(TempFilter, ResetReseedsFromTheNextReading) {
+  TempFilter filter;
+  filter.configure(TempFilterConfig{});
+  filter.push(30);
+  filter.reset();
+  EXPECT_FALSE(filter.has_value());
+  EXPECT_TRUE(filter.push(40));
+  EXPECT_EQ(filter.value(), 40);
+  EXPECT_EQ(filter.rejected(), 0u);
+}
+
+// =============================================================================
+// HEATING RATE MODEL
+// =============================================================================
+
+TEST(RunningFit, NoSlopeBelowTwoDistinctX) {
+  RunningFit fit;
+  int32_t slope = -1;
+  EXPECT_FALSE(fit.slope(1, 1, &slope));
+  fit.add(0, 10);
+  EXPECT_FALSE(fit.slope(1, 1, &slope));
+  // Two samples at the same x are still not a line
+  fit.add(0, 20);
+  EXPECT_FALSE(fit.slope(1, 1, &slope));
+  EXPECT_EQ(slope, -1);
+
+  fit.add(10, 40);
+  ASSERT_TRUE(fit.slope(1, 1, &slope));
+  EXPECT_EQ(slope, 2);
+  fit.clear();
+  EXPECT_FALSE(fit.slope(1, 1, &slope));
+}
+
+namespace {
+
+// Heating at 0.3 degrees a minute, i.e. 1800 centidegrees per hour
+void feed_heating(HeatRateModel *model, int samples) {
+  for (int i = 0; i < samples; i++) {
+    model->sample(i * 60000, 30.0f + 0.3f * i, RATE_HEATING);
+  }
+}
+
+}  // namespace
+
+TEST(HeatRateModel, TooFewSamplesLearnNothing) {
+  HeatRateModel model;
+  feed_heating(&model, HeatRateModel::MIN_SAMPLES - 1);
+  // Neither the run in progress nor the finished run gives a rate
+  EXPECT_EQ(model.minutes_to_target(30.0f, 38.0f), -1);
+  model.end_segment();
+  EXPECT_FALSE(model.has_rate(RATE_HEATING));
+  EXPECT_EQ(model.rate(RATE_HEATING), 0);
+  EXPECT_EQ(model.minutes_to_target(30.0f, 38.0f), -1);
+}
+
+TEST(HeatRateModel, TooLittleRiseLearnsNothing) {
+  // Plenty of samples, but inside one whole-degree step
+  HeatRateModel model;
+  for (int i = 0; i < 30; i++) {
+    model.sample(i * 60000, 30.0f + 0.05f * i, RATE_HEATING);
+  }
+  model.end_segment();
+  EXPECT_FALSE(model.has_rate(RATE_HEATING));
+}
+
+TEST(HeatRateModel, LearnsOnceThereAreEnoughSamples) {
+  HeatRateModel model;
+  feed_heating(&model, HeatRateModel::MIN_SAMPLES);
+  // The run in progress already answers before it is folded in
+  EXPECT_GT(model.minutes_to_target(30.0f, 39.0f), 0);
+  model.end_segment();
+  ASSERT_TRUE(model.has_rate(RATE_HEATING));
+  EXPECT_NEAR(model.rate(RATE_HEATING), 1800, 50);
+  EXPECT_NEAR(model.minutes_to_target(30.0f, 39.0f), 30, 1);
+  EXPECT_EQ(model.minutes_to_target(39.0f, 38.0f), 0);
+  EXPECT_FALSE(model.has_rate(RATE_IDLE));
+}
+
+TEST(HeatRateModel, ConditionChangeEndsTheRun) {
+  HeatRateModel model;
+  feed_heating(&model, HeatRateModel::MIN_SAMPLES);
+  model.sample(HeatRateModel::MIN_SAMPLES * 60000, 33.0f, RATE_IDLE);
+  EXPECT_TRUE(model.has_rate(RATE_HEATING));
+  // A single idle sample is not a rate
+  model.end_segment();
+  EXPECT_FALSE(model.has_rate(RATE_IDLE));
+}
+
+TEST(HeatRateModel, FallingWhileHeatingIsNotARate) {
+  HeatRateModel model;
+  for (int i = 0; i < 20; i++) {
+    model.sample(i * 60000, 38.0f - 0.3f * i, RATE_HEATING);
+  }
+  model.end_segment();
+  EXPECT_FALSE(model.has_rate(RATE_HEATING));
+}
+
+// =============================================================================
+// TARIFF PLANNER
+// =============================================================================
+
+TEST(Planner, SlotsNeededForTheDeficit) {
+  // 2 degrees at 4 degrees/h with no drift: half an hour of heat
+  EXPECT_EQ(heat_slots_needed(200, 400, 0, 8), 2u);
+  // Cooling while idle has to be made up as well
+  EXPECT_EQ(heat_slots_needed(200, 400, -100, 8), 4u);
+  // Already warm enough
+  EXPECT_EQ(heat_slots_needed(0, 400, 0, 8), 0u);
+  EXPECT_EQ(heat_slots_needed(-50, 400, -10, 8), 0u);
+}
+
+TEST(Planner, UnreachableTargetNeedsMoreThanEverySlot) {
+  EXPECT_EQ(heat_slots_needed(1000, 400, 0, 8), 9u);
+  // A heater no faster than the idle drift never gets there
+  EXPECT_EQ(heat_slots_needed(100, 100, 100, 8), 9u);
+  EXPECT_EQ(heat_slots_needed(100, 0, 0, 8), 9u);
+}
+
+TEST(Planner, DeadlineAlreadyPassed) {
+  // No slots left: anything still to gain is out of reach, nothing is marked
+  EXPECT_EQ(heat_slots_needed(200, 400, -50, 0), 1u);
+  EXPECT_EQ(heat_slots_needed(0, 400, -50, 0), 0u);
+
+  bool plan[4] = {true, true, true, true};
+  plan_cheapest_slots(nullptr, 0, 0.30f, 600, 0, 3, plan);
+  for (bool slot : plan) {
+    EXPECT_TRUE(slot);
+  }
+}
+
+TEST(Planner, EmptyTariffHeatsLatestSlots) {
+  // No windows: every slot costs the default price, so the later ones win
+  bool plan[8];
+  plan_cheapest_slots(nullptr, 0, 0.30f, 23 * 60, 8, 3, plan);
+  for (size_t i = 0; i < 8; i++) {
+    EXPECT_EQ(plan[i], i >= 5) << "slot " << i;
+  }
+  EXPECT_FLOAT_EQ(price_at(nullptr, 0, 0.30f, 0), 0.30f);
+}
+
+TEST(Planner, EqualPricesHeatLatestSlots) {
+  // Two windows at the same price as the default cover the whole day
+  const PriceWindow windows[] = {{0, 12 * 60, 0.25f}, {12 * 60, 0, 0.25f}};
+  bool plan[8];
+  plan_cheapest_slots(windows, 2, 0.25f, 11 * 60, 8, 2, plan);
+  for (size_t i = 0; i < 8; i++) {
+    EXPECT_EQ(plan[i], i >= 6) << "slot " << i;
+  }
+}
+
+TEST(Planner, CheapWindowAcrossMidnight) {
+  const PriceWindow windows[] = {{23 * 60 + 30, 30, 0.10f}};
+  EXPECT_FLOAT_EQ(price_at(windows, 1, 0.30f, 23 * 60 + 45), 0.10f);
+  EXPECT_FLOAT_EQ(price_at(windows, 1, 0.30f, 15), 0.10f);
+  EXPECT_FLOAT_EQ(price_at(windows, 1, 0.30f, 30), 0.30f);
+
+  // 23:00 to 01:00: the four cheap slots are 23:30 to 00:30
+  bool plan[8];
+  plan_cheapest_slots(windows, 1, 0.30f, 23 * 60, 8, 4, plan);
+  for (size_t i = 0; i < 8; i++) {
+    EXPECT_EQ(plan[i], i >= 2 && i < 6) << "slot " << i;
+  }
+}
+
+TEST(Planner, MoreHeatThanSlotsMarksEverySlot) {
+  bool plan[4];
+  plan_cheapest_slots(nullptr, 0, 0.30f, 0, 4, 10, plan);
+  for (bool slot : plan) {
+    EXPECT_TRUE(slot);
+  }
+}
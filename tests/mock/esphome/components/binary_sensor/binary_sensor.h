@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+namespace binary_sensor {
+
+class BinarySensor {
+ public:
+  void publish_state(bool state) {
+    state_ = state;
+    publish_count_++;
+  }
+  bool state() const { return state_; }
+  bool has_state() const { return publish_count_ != 0; }
+  uint32_t publish_count() const { return publish_count_; }
+
+ protected:
+  bool state_{false};
+  uint32_t publish_count_{0};
+};
+
+}  // namespace binary_sensor
+}  // namespace esphome
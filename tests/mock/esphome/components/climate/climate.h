@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+
+#include "esphome/core/optional.h"
+
+namespace esphome {
+namespace climate {
+
+enum ClimateMode : uint8_t {
+  CLIMATE_MODE_OFF = 0,
+  CLIMATE_MODE_HEAT_COOL,
+  CLIMATE_MODE_COOL,
+  CLIMATE_MODE_HEAT,
+  CLIMATE_MODE_FAN_ONLY,
+  CLIMATE_MODE_DRY,
+  CLIMATE_MODE_AUTO,
+};
+
+enum ClimateAction : uint8_t {
+  CLIMATE_ACTION_OFF = 0,
+  CLIMATE_ACTION_COOLING = 2,
+  CLIMATE_ACTION_HEATING = 3,
+  CLIMATE_ACTION_IDLE = 4,
+  CLIMATE_ACTION_DRYING = 5,
+  CLIMATE_ACTION_FAN = 6,
+};
+
+class ClimateTraits {
+ public:
+  void set_supports_current_temperature(bool supports) { supports_current_temperature_ = supports; }
+  void set_supports_two_point_target_temperature(bool supports) { supports_two_point_ = supports; }
+  void set_visual_min_temperature(float temp) { visual_min_temperature_ = temp; }
+  void set_visual_max_temperature(float temp) { visual_max_temperature_ = temp; }
+  void set_visual_temperature_step(float step) { visual_temperature_step_ = step; }
+  void set_supported_modes(std::set<ClimateMode> modes) { supported_modes_ = std::move(modes); }
+
+  bool get_supports_current_temperature() const { return supports_current_temperature_; }
+  float get_visual_min_temperature() const { return visual_min_temperature_; }
+  float get_visual_max_temperature() const { return visual_max_temperature_; }
+  const std::set<ClimateMode> &get_supported_modes() const { return supported_modes_; }
+
+ protected:
+  bool supports_current_temperature_{false};
+  bool supports_two_point_{false};
+  float visual_min_temperature_{10.0f};
+  float visual_max_temperature_{30.0f};
+  float visual_temperature_step_{0.1f};
+  std::set<ClimateMode> supported_modes_;
+};
+
+class ClimateCall {
+ public:
+  ClimateCall &set_mode(ClimateMode mode) {
+    mode_ = mode;
+    return *this;
+  }
+  ClimateCall &set_target_temperature(float temp) {
+    target_temperature_ = temp;
+    return *this;
+  }
+  const optional<ClimateMode> &get_mode() const { return mode_; }
+  const optional<float> &get_target_temperature() const { return target_temperature_; }
+
+ protected:
+  optional<ClimateMode> mode_;
+  optional<float> target_temperature_;
+};
+
+class Climate {
+ public:
+  virtual ~Climate() = default;
+
+  void publish_state() { publish_count_++; }
+  uint32_t publish_count() const { return publish_count_; }
+
+  ClimateMode mode{CLIMATE_MODE_OFF};
+  ClimateAction action{CLIMATE_ACTION_OFF};
+  float current_temperature{0.0f};
+  float target_temperature{0.0f};
+
+ protected:
+  virtual ClimateTraits traits() = 0;
+  virtual void control(const ClimateCall &call) = 0;
+
+  uint32_t publish_count_{0};
+};
+
+}  // namespace climate
+}  // namespace esphome
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+namespace esphome {
+namespace sensor {
+
+class Sensor {
+ public:
+  void publish_state(float state) {
+    state_ = state;
+    publish_count_++;
+  }
+  float state() const { return state_; }
+  bool has_state() const { return publish_count_ != 0; }
+  uint32_t publish_count() const { return publish_count_; }
+
+ protected:
+  float state_{NAN};
+  uint32_t publish_count_{0};
+};
+
+}  // namespace sensor
+}  // namespace esphome
@@ -0,0 +1,20 @@
+#pragma once
+
+namespace esphome {
+namespace switch_ {
+
+class Switch {
+ public:
+  virtual ~Switch() = default;
+
+  void publish_state(bool state) { state_ = state; }
+  bool state() const { return state_; }
+
+ protected:
+  virtual void write_state(bool state) = 0;
+
+  bool state_{false};
+};
+
+}  // namespace switch_
+}  // namespace esphome
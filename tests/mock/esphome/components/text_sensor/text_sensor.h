@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace esphome {
+namespace text_sensor {
+
+class TextSensor {
+ public:
+  void publish_state(const std::string &state) {
+    state_ = state;
+    publish_count_++;
+  }
+  const std::string &state() const { return state_; }
+  bool has_state() const { return publish_count_ != 0; }
+  uint32_t publish_count() const { return publish_count_; }
+
+ protected:
+  std::string state_;
+  uint32_t publish_count_{0};
+};
+
+}  // namespace text_sensor
+}  // namespace esphome
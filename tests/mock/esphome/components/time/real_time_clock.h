@@ -0,0 +1,39 @@
+#pragma once
+
+// Wall clock on top of the simulated millis(): a test sets the epoch time
+// at which the simulation started and the clock runs from there (UTC).
+
+#include <cstdint>
+#include <ctime>
+
+namespace esphome {
+
+struct ESPTime {
+  uint8_t second;
+  uint8_t minute;
+  uint8_t hour;
+  uint8_t day_of_week;
+  uint8_t day_of_month;
+  uint16_t day_of_year;
+  uint8_t month;
+  uint16_t year;
+  time_t timestamp;
+
+  bool is_valid() const { return year >= 2019; }
+  static ESPTime from_epoch_utc(time_t epoch);
+};
+
+namespace time {
+
+class RealTimeClock {
+ public:
+  ESPTime now();
+  // 0 leaves the clock unsynchronized
+  void set_epoch_at_boot(time_t epoch) { epoch_at_boot_ = epoch; }
+
+ protected:
+  time_t epoch_at_boot_{0};
+};
+
+}  // namespace time
+}  // namespace esphome
@@ -0,0 +1,64 @@
+#pragma once
+
+// Fake UART. The bus owns two byte streams: what the device on the other
+// end sent (read by the component) and what the component wrote (taken by
+// the device on the other end).
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace esphome {
+namespace uart {
+
+class UARTComponent {
+ public:
+  // Device side
+  void inject(const uint8_t *data, size_t len) { rx_.insert(rx_.end(), data, data + len); }
+  void inject(const std::vector<uint8_t> &data) { inject(data.data(), data.size()); }
+  std::vector<uint8_t> take_written() {
+    std::vector<uint8_t> out;
+    out.swap(tx_);
+    return out;
+  }
+  size_t pending() const { return rx_.size(); }
+
+  // Component side
+  int available() const { return (int) rx_.size(); }
+  bool read_array(uint8_t *data, size_t len) {
+    if (len > rx_.size())
+      return false;
+    for (size_t i = 0; i < len; i++) {
+      data[i] = rx_.front();
+      rx_.pop_front();
+    }
+    return true;
+  }
+  void write_array(const uint8_t *data, size_t len) { tx_.insert(tx_.end(), data, data + len); }
+
+ protected:
+  std::deque<uint8_t> rx_;
+  std::vector<uint8_t> tx_;
+};
+
+class UARTDevice {
+ public:
+  UARTDevice() = default;
+  explicit UARTDevice(UARTComponent *parent) : parent_(parent) {}
+  void set_uart_parent(UARTComponent *parent) { parent_ = parent; }
+
+  int available() { return parent_ != nullptr ? parent_->available() : 0; }
+  bool read_array(uint8_t *data, size_t len) { return parent_ != nullptr && parent_->read_array(data, len); }
+  void write_array(const uint8_t *data, size_t len) {
+    if (parent_ != nullptr)
+      parent_->write_array(data, len);
+  }
+  void flush() {}
+
+ protected:
+  UARTComponent *parent_{nullptr};
+};
+
+}  // namespace uart
+}  // namespace esphome
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+#include "esphome/core/hal.h"
+
+namespace esphome {
+
+namespace setup_priority {
+extern const float DATA;
+}  // namespace setup_priority
+
+class Component {
+ public:
+  virtual ~Component() = default;
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual void on_shutdown() {}
+  virtual float get_setup_priority() const { return 0.0f; }
+
+  // Preferences are keyed by this; tests give each instance its own
+  uint32_t get_object_id_hash() { return object_id_hash_; }
+  void set_object_id_hash(uint32_t hash) { object_id_hash_ = hash; }
+
+ protected:
+  uint32_t object_id_hash_{0};
+};
+
+}  // namespace esphome
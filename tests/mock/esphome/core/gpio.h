@@ -0,0 +1,112 @@
+#pragma once
+
+// Fake GPIO pins. A pin holds one line level that both the component
+// (digital_write) and the simulated device on the other end (drive) can
+// set. Every level change fires the attached interrupt for a matching edge
+// and then the test-side listener, which is how a simulated device clocks
+// data in and out of a bit-banged transfer.
+
+#include <cstdint>
+#include <functional>
+
+namespace esphome {
+
+namespace gpio {
+
+enum Flags : uint8_t {
+  FLAG_NONE = 0x00,
+  FLAG_INPUT = 0x01,
+  FLAG_OUTPUT = 0x02,
+  FLAG_OPEN_DRAIN = 0x04,
+  FLAG_PULLUP = 0x08,
+  FLAG_PULLDOWN = 0x10,
+};
+
+enum InterruptType : uint8_t {
+  INTERRUPT_RISING_EDGE = 1,
+  INTERRUPT_FALLING_EDGE = 2,
+  INTERRUPT_ANY_EDGE = 3,
+  INTERRUPT_LOW_LEVEL = 4,
+  INTERRUPT_HIGH_LEVEL = 5,
+};
+
+}  // namespace gpio
+
+class InternalGPIOPin;
+
+// Copy of a pin that interrupt handlers read from
+class ISRInternalGPIOPin {
+ public:
+  ISRInternalGPIOPin() = default;
+  explicit ISRInternalGPIOPin(const InternalGPIOPin *pin) : pin_(pin) {}
+  bool digital_read();
+  void digital_write(bool value);
+
+ protected:
+  const InternalGPIOPin *pin_{nullptr};
+};
+
+class InternalGPIOPin {
+ public:
+  explicit InternalGPIOPin(uint8_t pin = 0) : pin_(pin) {}
+  virtual ~InternalGPIOPin() = default;
+
+  void setup() {}
+  void pin_mode(gpio::Flags flags) { flags_ = flags; }
+  void digital_write(bool value) { set_level_(value); }
+  bool digital_read() { return level_; }
+  uint8_t get_pin() const { return pin_; }
+  ISRInternalGPIOPin to_isr() const { return ISRInternalGPIOPin(this); }
+
+  template<typename T> void attach_interrupt(void (*func)(T *), T *arg, gpio::InterruptType type) const {
+    isr_ = reinterpret_cast<void (*)(void *)>(func);
+    isr_arg_ = arg;
+    isr_type_ = type;
+  }
+  void detach_interrupt() const { isr_ = nullptr; }
+
+  // Test side
+  void drive(bool level) { set_level_(level); }
+  bool level() const { return level_; }
+  gpio::Flags get_flags() const { return flags_; }
+  bool is_output() const { return (flags_ & gpio::FLAG_OUTPUT) != 0; }
+  bool has_interrupt() const { return isr_ != nullptr; }
+  // Called after every level change with the new level
+  void set_listener(std::function<void(bool)> listener) { listener_ = std::move(listener); }
+
+ protected:
+  friend class ISRInternalGPIOPin;
+
+  void set_level_(bool level);
+
+  uint8_t pin_;
+  gpio::Flags flags_{gpio::FLAG_NONE};
+  bool level_{false};
+  mutable void (*isr_)(void *){nullptr};
+  mutable void *isr_arg_{nullptr};
+  mutable gpio::InterruptType isr_type_{gpio::INTERRUPT_ANY_EDGE};
+  std::function<void(bool)> listener_;
+};
+
+inline bool ISRInternalGPIOPin::digital_read() { return pin_ != nullptr && pin_->level_; }
+inline void ISRInternalGPIOPin::digital_write(bool value) {
+  if (pin_ != nullptr)
+    const_cast<InternalGPIOPin *>(pin_)->set_level_(value);
+}
+
+inline void InternalGPIOPin::set_level_(bool level) {
+  if (level == level_) {
+    return;
+  }
+  level_ = level;
+  if (isr_ != nullptr) {
+    bool fire = isr_type_ == gpio::INTERRUPT_ANY_EDGE || (level && isr_type_ == gpio::INTERRUPT_RISING_EDGE) ||
+                (!level && isr_type_ == gpio::INTERRUPT_FALLING_EDGE);
+    if (fire)
+      isr_(isr_arg_);
+  }
+  if (listener_)
+    listener_(level);
+}
+
+}  // namespace esphome
@@ -0,0 +1,29 @@
+#pragma once
+
+// Host stand-in for ESPHome's HAL. Time only moves when the test moves it:
+// delayMicroseconds() advances the clock instead of sleeping, so a
+// bit-banged transfer costs simulated time and no wall-clock time.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esphome/core/gpio.h"
+
+#define IRAM_ATTR
+
+namespace esphome {
+
+uint32_t millis();
+uint32_t micros();
+void delayMicroseconds(uint32_t us);
+void delay(uint32_t ms);
+
+namespace mock {
+
+uint64_t now_us();
+void set_now_us(uint64_t us);
+void advance_us(uint64_t us);
+inline void advance_ms(uint64_t ms) { advance_us(ms * 1000); }
+
+}  // namespace mock
+}  // namespace esphome
@@ -0,0 +1,37 @@
+#pragma once
+
+// Log calls go through a printf-checked function that counts warnings and
+// errors, so tests can assert a run was clean, and only prints at or above
+// mock::log_level (errors by default).
+
+#include <cstdint>
+
+namespace esphome {
+namespace mock {
+
+enum LogLevel : uint8_t {
+  LOG_LEVEL_NONE = 0,
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_CONFIG,
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_VERBOSE,
+};
+
+extern LogLevel log_level;
+extern uint32_t log_warnings;
+extern uint32_t log_errors;
+
+void log(LogLevel level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+}  // namespace mock
+}  // namespace esphome
+
+#define ESP_LOGE(tag, ...) ::esphome::mock::log(::esphome::mock::LOG_LEVEL_ERROR, tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) ::esphome::mock::log(::esphome::mock::LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) ::esphome::mock::log(::esphome::mock::LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) ::esphome::mock::log(::esphome::mock::LOG_LEVEL_CONFIG, tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) ::esphome::mock::log(::esphome::mock::LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) ::esphome::mock::log(::esphome::mock::LOG_LEVEL_VERBOSE, tag, __VA_ARGS__)
+#define LOG_CLIMATE(prefix, type, obj) (void) (obj)
@@ -0,0 +1,53 @@
+#pragma once
+
+// In-memory flash. Values survive as long as the process, so a test can
+// tear a component down and build a new one to simulate a reboot.
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+namespace esphome {
+
+class ESPPreferenceObject {
+ public:
+  ESPPreferenceObject() = default;
+  ESPPreferenceObject(std::vector<uint8_t> *slot, size_t size) : slot_(slot), size_(size) {}
+
+  template<typename T> bool save(const T *src) {
+    if (slot_ == nullptr || sizeof(T) != size_)
+      return false;
+    slot_->assign(reinterpret_cast<const uint8_t *>(src), reinterpret_cast<const uint8_t *>(src) + sizeof(T));
+    saves_++;
+    return true;
+  }
+  template<typename T> bool load(T *dest) {
+    if (slot_ == nullptr || slot_->size() != sizeof(T))
+      return false;
+    memcpy(dest, slot_->data(), sizeof(T));
+    return true;
+  }
+  uint32_t saves() const { return saves_; }
+
+ protected:
+  std::vector<uint8_t> *slot_{nullptr};
+  size_t size_{0};
+  uint32_t saves_{0};
+};
+
+class ESPPreferences {
+ public:
+  template<typename T> ESPPreferenceObject make_preference(uint32_t type) {
+    return ESPPreferenceObject(&slots_[type], sizeof(T));
+  }
+  void reset() { slots_.clear(); }
+  size_t size() const { return slots_.size(); }
+
+ protected:
+  std::map<uint32_t, std::vector<uint8_t>> slots_;
+};
+
+extern ESPPreferences *global_preferences;
+
+}  // namespace esphome
@@ -0,0 +1,107 @@
+// Definitions behind the mocked ESPHome headers
+
+#include "esphome/components/time/real_time_clock.h"
+#include "esphome/core/component.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+namespace esphome {
+
+namespace setup_priority {
+const float DATA = 600.0f;
+}  // namespace setup_priority
+
+// =============================================================================
+// CLOCK
+// =============================================================================
+
+static uint64_t now_us_ = 0;
+
+uint32_t millis() { return (uint32_t) (now_us_ / 1000); }
+uint32_t micros() { return (uint32_t) now_us_; }
+void delayMicroseconds(uint32_t us) { now_us_ += us; }
+void delay(uint32_t ms) { now_us_ += (uint64_t) ms * 1000; }
+
+namespace mock {
+uint64_t now_us() { return now_us_; }
+void set_now_us(uint64_t us) { now_us_ = us; }
+void advance_us(uint64_t us) { now_us_ += us; }
+}  // namespace mock
+
+// =============================================================================
+// PREFERENCES, LOGGING, HELPERS
+// =============================================================================
+
+static ESPPreferences preferences_;
+ESPPreferences *global_preferences = &preferences_;
+
+namespace mock {
+
+LogLevel log_level = LOG_LEVEL_ERROR;
+uint32_t log_warnings = 0;
+uint32_t log_errors = 0;
+
+void log(LogLevel level, const char *tag, const char *format, ...) {
+  if (level == LOG_LEVEL_WARN)
+    log_warnings++;
+  if (level == LOG_LEVEL_ERROR)
+    log_errors++;
+  if (level > log_level)
+    return;
+  static const char LETTERS[] = "NEWICDV";
+  printf("[%c][%s] ", LETTERS[level], tag);
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  printf("\n");
+}
+
+}  // namespace mock
+
+std::string format_hex(const uint8_t *data, size_t length) {
+  static const char HEX_CHARS[] = "0123456789abcdef";
+  std::string out;
+  out.reserve(length * 2);
+  for (size_t i = 0; i < length; i++) {
+    out += HEX_CHARS[data[i] >> 4];
+    out += HEX_CHARS[data[i] & 0x0F];
+  }
+  return out;
+}
+
+// =============================================================================
+// TIME
+// =============================================================================
+
+ESPTime ESPTime::from_epoch_utc(time_t epoch) {
+  struct tm t;
+  gmtime_r(&epoch, &t);
+  ESPTime out{};
+  out.second = t.tm_sec;
+  out.minute = t.tm_min;
+  out.hour = t.tm_hour;
+  out.day_of_week = t.tm_wday + 1;
+  out.day_of_month = t.tm_mday;
+  out.day_of_year = t.tm_yday + 1;
+  out.month = t.tm_mon + 1;
+  out.year = t.tm_year + 1900;
+  out.timestamp = epoch;
+  return out;
+}
+
+namespace time {
+
+ESPTime RealTimeClock::now() {
+  if (epoch_at_boot_ == 0)
+    return ESPTime{};
+  return ESPTime::from_epoch_utc(epoch_at_boot_ + (time_t) (mock::now_us() / 1000000));
+}
+
+}  // namespace time
+}  // namespace esphome
@@ -0,0 +1,280 @@
+#include "spa_simulator.h"
+
+#include "esphome/core/hal.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace esphome {
+namespace bestway_spa {
+namespace sim {
+
+// Bit timing of the simulated 6-wire CIO, as BitBangTransport clocks it
+static const uint32_t HALF_PERIOD_US = 50;
+static const uint32_t CS_SETUP_US = 10;
+
+static bool fault_due(uint32_t every, uint32_t count) { return every != 0 && count % every == 0; }
+
+// =============================================================================
+// 4-WIRE CIO
+// =============================================================================
+
+void CioSim4W::step() {
+  uint32_t now = millis();
+  if (!started_) {
+    started_ = true;
+    last_step_ms_ = now;
+    next_frame_ms_ = now;
+  }
+
+  // The outputs follow the last reply
+  read_replies_();
+
+  float rate = stage_ == 2 ? heat_per_hour_ : stage_ == 1 ? heat_per_hour_ / 2 : idle_per_hour_;
+  water_temp_ += rate * (now - last_step_ms_) / 3600000.0f;
+  last_step_ms_ = now;
+
+  while ((int32_t) (now - next_frame_ms_) >= 0) {
+    send_frame_();
+    next_frame_ms_ += frame_period_ms_;
+  }
+}
+
+void CioSim4W::send_frame_() {
+  frames_sent_++;
+
+  if (fault_due(faults_.noise_every, frames_sent_)) {
+    // Anything but a start marker, so the component has to resync past it
+    std::uniform_int_distribution<int> byte(0x00, 0xFE);
+    for (uint8_t i = 0; i < faults_.noise_len; i++) {
+      uint8_t noise = (uint8_t) byte(rng_);
+      uart_->inject(&noise, 1);
+    }
+    noise_bytes_ += faults_.noise_len;
+  }
+
+  CioStatus4W status{};
+  status.temperature = (uint8_t) lroundf(water_temp_);
+  status.error_code = error_code_;
+  status.filter_pump = command_.filter_pump;
+  status.bubbles = command_.bubbles;
+  status.jets = command_.jets;
+  status.heater_red = stage_ >= 1;
+
+  uint8_t frame[FRAME_4W_LEN];
+  encode_4wire_status(status, config_, frame);
+  if (fault_due(faults_.corrupt_every, frames_sent_)) {
+    frame[2] ^= 0x01;
+    frames_corrupted_++;
+  }
+  uart_->inject(frame, FRAME_4W_LEN);
+}
+
+void CioSim4W::read_replies_() {
+  std::vector<uint8_t> written = uart_->take_written();
+  tx_.insert(tx_.end(), written.begin(), written.end());
+
+  size_t pos = 0;
+  while (tx_.size() - pos >= FRAME_4W_LEN) {
+    FrameView frame{tx_.data() + pos, FRAME_4W_LEN};
+    FrameCheck check = check_4wire_frame(frame);
+    if (check == FRAME_BAD_MARKER) {
+      pos += find_4wire_resync(tx_.data() + pos, tx_.size() - pos);
+      bad_replies_++;
+      continue;
+    }
+    pos += FRAME_4W_LEN;
+    if (check != FRAME_OK) {
+      bad_replies_++;
+      continue;
+    }
+    replies_++;
+
+    uint8_t cmd = frame[1];
+    command_.heater_stage = (cmd & config_.heat_bitmask2) ? 2 : (cmd & config_.heat_bitmask1) ? 1 : 0;
+    command_.filter_pump = (cmd & config_.pump_bitmask) != 0;
+    command_.bubbles = (cmd & config_.bubbles_bitmask) != 0;
+    command_.jets = config_.has_jets && (cmd & config_.jets_bitmask) != 0;
+    command_.target_temp = frame[2];
+
+    stage_ = command_.heater_stage;
+    if (stage_ != 0 && stage_started_ms_[stage_] == 0)
+      stage_started_ms_[stage_] = millis();
+  }
+  tx_.erase(tx_.begin(), tx_.begin() + pos);
+}
+
+// =============================================================================
+// 6-WIRE DISPLAY (ACTIVE MODE)
+// =============================================================================
+
+DisplaySim6W::DisplaySim6W(SpaModel model, InternalGPIOPin *clk, InternalGPIOPin *data, InternalGPIOPin *cs)
+    : type1_(model_protocol(model) == PROTOCOL_6WIRE_T1),
+      codes_(get_button_codes(model)),
+      clk_(clk),
+      data_(data),
+      cs_(cs) {
+  cs_->set_listener([this](bool level) { on_cs_(level); });
+  clk_->set_listener([this](bool level) { on_clk_(level); });
+}
+
+void DisplaySim6W::on_cs_(bool level) {
+  if (!level) {
+    selected_ = true;
+    shift_ = 0;
+    shift_bits_ = 0;
+    frame_.clear();
+    answer_.clear();
+    return;
+  }
+  if (selected_)
+    end_frame_();
+  selected_ = false;
+}
+
+void DisplaySim6W::on_clk_(bool level) {
+  if (!selected_ || !level) {
+    return;
+  }
+  if (data_->is_output()) {
+    // Component drives DATA: sample it on the rising edge
+    shift_ = (shift_ << 1) | (data_->level() ? 1 : 0);
+    if (++shift_bits_ == 8) {
+      frame_.push_back(shift_);
+      shift_ = 0;
+      shift_bits_ = 0;
+      queue_answer_();
+    }
+    return;
+  }
+  // Display drives DATA; an idle line floats high
+  bool bit = true;
+  if (!answer_.empty()) {
+    bit = answer_.front();
+    answer_.pop_front();
+  }
+  data_->drive(bit);
+}
+
+void DisplaySim6W::queue_answer_() {
+  bool read = type1_ ? frame_.size() == 2 && frame_[1] == DSP_CMD2_DATAREAD
+                     : frame_.size() == 1 && frame_[0] == TYPE2_CMD2;
+  if (!read) {
+    return;
+  }
+  uint16_t code = codes_[held_];
+  if (type1_) {
+    // MSB first, high byte first
+    for (int bit = 15; bit >= 0; bit--)
+      answer_.push_back((code >> bit) & 1);
+  } else {
+    // LSB first, low byte first
+    for (int bit = 0; bit < 16; bit++)
+      answer_.push_back((code >> bit) & 1);
+  }
+}
+
+void DisplaySim6W::end_frame_() {
+  if (frame_.empty() && shift_bits_ == 0) {
+    return;  // CS pulsed with nothing clocked
+  }
+  if (shift_bits_ != 0) {
+    bad_frames_++;
+    return;
+  }
+
+  if (type1_) {
+    if (frame_.size() == T1_PAYLOAD_LEN) {
+      memcpy(payload_, frame_.data(), T1_PAYLOAD_LEN);
+      decode_display_status(payload_, true, &status_);
+      decode_display_digits(payload_, true, digits_);
+      payloads_++;
+    } else if (frame_.size() == 2 && frame_[1] == DSP_CMD2_DATAREAD) {
+      button_reads_++;
+    } else {
+      bad_frames_++;
+    }
+    return;
+  }
+
+  if (frame_.size() == T2_PAYLOAD_LEN + 1 && frame_[0] == TYPE2_CMD1) {
+    for (size_t i = 0; i < T2_PAYLOAD_LEN; i++)
+      payload_[i] = reverse_bits(frame_[1 + i]);
+    decode_display_status(payload_, false, &status_);
+    decode_display_digits(payload_, false, digits_);
+    payloads_++;
+  } else if (frame_.size() == 1 && (frame_[0] & 0xF8) == TYPE2_CMD3) {
+    brightness_ = frame_[0] & 0x07;
+    brightness_commands_++;
+  } else if (frame_.size() == 1 && frame_[0] == TYPE2_CMD2) {
+    button_reads_++;
+  } else {
+    bad_frames_++;
+  }
+}
+
+// =============================================================================
+// 6-WIRE CIO (PASSIVE MODE)
+// =============================================================================
+
+CioDriver6W::CioDriver6W(SpaModel model, InternalGPIOPin *clk, InternalGPIOPin *data, InternalGPIOPin *cs)
+    : type1_(model_protocol(model) == PROTOCOL_6WIRE_T1), model_(model), clk_(clk), data_(data), cs_(cs) {
+  // Bus idle: not selected, clock low
+  cs_->drive(true);
+  clk_->drive(false);
+}
+
+void CioDriver6W::send_display(const DisplayStatus &status, const char *digits) {
+  uint8_t payload[T1_PAYLOAD_LEN];
+  encode_display_payload(status, digits, type1_, payload);
+  if (type1_) {
+    payload[0] = model_ == MODEL_P05504 ? DSP_CMD1_MODE6_11_7_P05504 : DSP_CMD1_MODE6_11_7;
+    send_frame_(payload, T1_PAYLOAD_LEN);
+    return;
+  }
+  uint8_t wire[T2_PAYLOAD_LEN + 1];
+  wire[0] = TYPE2_CMD1;
+  for (size_t i = 0; i < T2_PAYLOAD_LEN; i++)
+    wire[1 + i] = reverse_bits(payload[i]);
+  send_frame_(wire, sizeof(wire));
+}
+
+void CioDriver6W::send_button_read(uint16_t code) {
+  if (type1_) {
+    uint8_t cmd1 = model_ == MODEL_P05504 ? DSP_CMD1_MODE6_11_7_P05504 : DSP_CMD1_MODE6_11_7;
+    uint8_t wire[4] = {cmd1, DSP_CMD2_DATAREAD, (uint8_t) (code >> 8), (uint8_t) (code & 0xFF)};
+    send_frame_(wire, sizeof(wire));
+    return;
+  }
+  uint8_t wire[3] = {TYPE2_CMD2, reverse_bits(code & 0xFF), reverse_bits(code >> 8)};
+  send_frame_(wire, sizeof(wire));
+}
+
+void CioDriver6W::send_brightness(uint8_t level) {
+  uint8_t cmd = (uint8_t) ((type1_ ? DSP_DIM_BASE | DSP_DIM_ON : TYPE2_CMD3) | (level & 0x07));
+  send_frame_(&cmd, 1);
+}
+
+void CioDriver6W::send_frame_(const uint8_t *wire, size_t len) {
+  frames_sent_++;
+  size_t bits = len * 8;
+  if (fault_due(faults_.truncate_every, frames_sent_)) {
+    bits--;
+    frames_truncated_++;
+  }
+
+  cs_->drive(false);
+  mock::advance_us(CS_SETUP_US);
+  for (size_t i = 0; i < bits; i++) {
+    data_->drive((wire[i / 8] >> (7 - i % 8)) & 1);
+    clk_->drive(true);
+    mock::advance_us(HALF_PERIOD_US);
+    clk_->drive(false);
+    mock::advance_us(HALF_PERIOD_US);
+  }
+  cs_->drive(true);
+}
+
+}  // namespace sim
+}  // namespace bestway_spa
+}  // namespace esphome
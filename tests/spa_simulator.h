@@ -0,0 +1,188 @@
+#pragma once
+
+// Host-side simulator for the far end of each spa bus, driving a
+// BestwaySpa through the mocked UART and GPIO pins:
+// - CioSim4W plays the CIO of a 4-wire spa. It sends status frames on a
+//   fixed period, answers to the replies from send_4wire_response_() by
+//   switching its outputs (heater stages included), warms or cools the
+//   water, and can corrupt checksums and put line noise between frames.
+// - DisplaySim6W plays the display of an active 6-wire spa. It clocks in
+//   the payloads from send_dsp_payload_type1_/type2_() and answers button
+//   reads with the code of the button being held.
+// - CioDriver6W plays the CIO on a 6-wire bus that the component only
+//   listens to (passive mode), and can cut frames short.
+
+#include "bestway_codec.h"
+#include "esphome/components/uart/uart.h"
+#include "esphome/core/gpio.h"
+
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <vector>
+
+namespace esphome {
+namespace bestway_spa {
+namespace sim {
+
+// Deterministic faults, applied to every Nth frame (0 = never)
+struct FaultConfig {
+  uint32_t corrupt_every{0};  // Flip a bit in the temperature byte, breaking the checksum
+  uint32_t noise_every{0};    // Send a burst of non-marker bytes before the frame
+  uint8_t noise_len{3};
+  uint32_t truncate_every{0};  // 6-wire: raise CS one bit early
+};
+
+// =============================================================================
+// 4-WIRE CIO
+// =============================================================================
+
+class CioSim4W {
+ public:
+  CioSim4W(uart::UARTComponent *uart, const ModelConfig4W &config) : uart_(uart), config_(config) {}
+
+  void set_frame_period_ms(uint32_t period_ms) { frame_period_ms_ = period_ms; }
+  void set_faults(const FaultConfig &faults) { faults_ = faults; }
+  // Water temperature change per hour with both elements on and with the
+  // heater off (negative: cooling)
+  void set_rates(float heat_per_hour, float idle_per_hour) {
+    heat_per_hour_ = heat_per_hour;
+    idle_per_hour_ = idle_per_hour;
+  }
+  void set_water_temp(float temp) { water_temp_ = temp; }
+  void set_error_code(uint8_t code) { error_code_ = code; }
+
+  // Sends the frames due by now, reads the replies and moves the water
+  // temperature on
+  void step();
+
+  float water_temp() const { return water_temp_; }
+  uint8_t heater_stage() const { return stage_; }
+  const CioCommand4W &last_command() const { return command_; }
+  // When each heater stage was first commanded, 0 if never
+  uint32_t stage_started_ms(uint8_t stage) const { return stage < 3 ? stage_started_ms_[stage] : 0; }
+
+  uint32_t frames_sent() const { return frames_sent_; }
+  uint32_t frames_corrupted() const { return frames_corrupted_; }
+  uint32_t noise_bytes() const { return noise_bytes_; }
+  uint32_t replies() const { return replies_; }
+  uint32_t bad_replies() const { return bad_replies_; }
+
+ protected:
+  void send_frame_();
+  void read_replies_();
+
+  uart::UARTComponent *uart_;
+  const ModelConfig4W &config_;
+  FaultConfig faults_;
+  std::mt19937 rng_{4};
+
+  uint32_t frame_period_ms_{40};
+  uint32_t next_frame_ms_{0};
+  uint32_t last_step_ms_{0};
+  bool started_{false};
+
+  float water_temp_{30.0f};
+  float heat_per_hour_{1.5f};
+  float idle_per_hour_{-0.5f};
+  uint8_t error_code_{0};
+
+  CioCommand4W command_{};
+  uint8_t stage_{0};
+  uint32_t stage_started_ms_[3]{};
+  std::vector<uint8_t> tx_;
+
+  uint32_t frames_sent_{0};
+  uint32_t frames_corrupted_{0};
+  uint32_t noise_bytes_{0};
+  uint32_t replies_{0};
+  uint32_t bad_replies_{0};
+};
+
+// =============================================================================
+// 6-WIRE DISPLAY (ACTIVE MODE)
+// =============================================================================
+
+class DisplaySim6W {
+ public:
+  DisplaySim6W(SpaModel model, InternalGPIOPin *clk, InternalGPIOPin *data, InternalGPIOPin *cs);
+
+  // Button held down on the display, NOBTN to let go
+  void hold(Buttons button) { held_ = button; }
+
+  bool has_payload() const { return payloads_ != 0; }
+  const DisplayStatus &status() const { return status_; }
+  const char *digits() const { return digits_; }
+  const uint8_t *payload() const { return payload_; }
+  uint8_t brightness() const { return brightness_; }
+
+  uint32_t payloads() const { return payloads_; }
+  uint32_t button_reads() const { return button_reads_; }
+  uint32_t brightness_commands() const { return brightness_commands_; }
+  uint32_t bad_frames() const { return bad_frames_; }
+
+ protected:
+  void on_cs_(bool level);
+  void on_clk_(bool level);
+  void queue_answer_();
+  void end_frame_();
+
+  bool type1_;
+  const uint16_t *codes_;
+  InternalGPIOPin *clk_;
+  InternalGPIOPin *data_;
+  InternalGPIOPin *cs_;
+
+  bool selected_{false};
+  uint8_t shift_{0};
+  uint8_t shift_bits_{0};
+  std::vector<uint8_t> frame_;
+  std::deque<bool> answer_;
+
+  Buttons held_{NOBTN};
+  uint8_t payload_[T1_PAYLOAD_LEN]{};
+  DisplayStatus status_{};
+  char digits_[4]{' ', ' ', ' ', '\0'};
+  uint8_t brightness_{0};
+
+  uint32_t payloads_{0};
+  uint32_t button_reads_{0};
+  uint32_t brightness_commands_{0};
+  uint32_t bad_frames_{0};
+};
+
+// =============================================================================
+// 6-WIRE CIO (PASSIVE MODE)
+// =============================================================================
+
+class CioDriver6W {
+ public:
+  CioDriver6W(SpaModel model, InternalGPIOPin *clk, InternalGPIOPin *data, InternalGPIOPin *cs);
+
+  void set_faults(const FaultConfig &faults) { faults_ = faults; }
+
+  // One CS-framed transfer each, as the real CIO clocks them
+  void send_display(const DisplayStatus &status, const char *digits);
+  void send_button_read(uint16_t code);
+  void send_brightness(uint8_t level);
+
+  uint32_t frames_sent() const { return frames_sent_; }
+  uint32_t frames_truncated() const { return frames_truncated_; }
+
+ protected:
+  void send_frame_(const uint8_t *wire, size_t len);
+
+  bool type1_;
+  SpaModel model_;
+  InternalGPIOPin *clk_;
+  InternalGPIOPin *data_;
+  InternalGPIOPin *cs_;
+  FaultConfig faults_;
+
+  uint32_t frames_sent_{0};
+  uint32_t frames_truncated_{0};
+};
+
+}  // namespace sim
+}  // namespace bestway_spa
+}  // namespace esphome
@@ -0,0 +1,618 @@
+// Host runs of BestwaySpa against the bus simulators in spa_simulator.h:
+// the component is set up as in a YAML config and loop() is called on the
+// ESPHome schedule while the simulated far end talks to it.
+
+#include "bestway_spa.h"
+#include "spa_simulator.h"
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+using namespace esphome;
+using namespace esphome::bestway_spa;
+using namespace esphome::bestway_spa::sim;
+
+namespace {
+
+// Start the clock away from 0, which several timers read as "never"
+const uint64_t START_US = 1000000;
+// ESPHome calls loop() about every 16 ms
+const uint64_t LOOP_INTERVAL_US = 16000;
+
+// A spa wired to simulated hardware
+struct SpaRig {
+  explicit SpaRig(SpaModel model, bool passive = false) {
+    spa.set_uart_parent(&uart);
+    spa.set_model(model);
+    spa.set_protocol_type(model_protocol(model));
+    spa.set_clk_pin(&clk);
+    spa.set_data_pin(&data);
+    spa.set_cs_pin(&cs);
+    spa.set_passive_mode(passive);
+  }
+
+  uart::UARTComponent uart;
+  InternalGPIOPin clk{14};
+  InternalGPIOPin data{12};
+  InternalGPIOPin cs{13};
+  BestwaySpa spa;
+};
+
+// Wall time spent in loop()
+struct LoopTiming {
+  uint32_t passes{0};
+  double total_us{0};
+  double max_us{0};
+
+  double mean_us() const { return passes != 0 ? total_us / passes : 0; }
+};
+
+// Runs the main loop for ms of simulated time: far_end() plays the other
+// side of the bus, then loop() runs, and the next pass starts 16 ms after
+// the last one began, or straight away when a pass ran over.
+template<typename FarEnd> LoopTiming run_loop(BestwaySpa &spa, uint32_t ms, FarEnd &&far_end) {
+  LoopTiming timing;
+  uint64_t end = mock::now_us() + (uint64_t) ms * 1000;
+  while (mock::now_us() < end) {
+    uint64_t start = mock::now_us();
+    far_end();
+
+    auto wall = std::chrono::steady_clock::now();
+    spa.loop();
+    double took = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - wall).count();
+    timing.passes++;
+    timing.total_us += took;
+    timing.max_us = std::max(timing.max_us, took);
+
+    uint64_t elapsed = mock::now_us() - start;
+    mock::advance_us(elapsed < LOOP_INTERVAL_US ? LOOP_INTERVAL_US - elapsed : 0);
+  }
+  return timing;
+}
+
+template<typename FarEnd> LoopTiming run_loop(SpaRig &rig, uint32_t ms, FarEnd &&far_end) {
+  return run_loop(rig.spa, ms, far_end);
+}
+
+LoopTiming run_loop(SpaRig &rig, uint32_t ms) {
+  return run_loop(rig.spa, ms, [] {});
+}
+
+// Plays a 6-wire CIO the way the real one paces its transfers: a display
+// payload every 50 ms and a button read every 100 ms
+class PassiveCio {
+ public:
+  PassiveCio(CioDriver6W &driver, bool type1) : driver_(driver), type1_(type1) {}
+
+  void set_display(const DisplayStatus &status, const char *digits) {
+    status_ = status;
+    memcpy(digits_, digits, 3);
+  }
+  void set_button(uint16_t code) { code_ = code; }
+
+  void operator()() {
+    uint32_t now = millis();
+    if (now - last_display_ms_ < 50) {
+      return;
+    }
+    last_display_ms_ = now;
+    driver_.send_display(status_, digits_);
+    if (!type1_) {
+      driver_.send_brightness(7);
+    }
+    if (++frames_ % 2 == 0) {
+      driver_.send_button_read(code_);
+    }
+  }
+
+ protected:
+  CioDriver6W &driver_;
+  bool type1_;
+  DisplayStatus status_{};
+  char digits_[4]{' ', ' ', ' ', '\0'};
+  uint16_t code_{0};
+  uint32_t last_display_ms_{0};
+  uint32_t frames_{0};
+};
+
+// Every BestwaySpa a test sets up registers with the shared scheduler and
+// never leaves it; start each test with no other spa on the bus
+struct SchedulerReset : BusScheduler {
+  static void reset() {
+    bitbang_count_ = 0;
+    last_grant_ms_ = 0;
+  }
+};
+
+class SpaSimTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    SchedulerReset::reset();
+    mock::set_now_us(START_US);
+    mock::log_warnings = 0;
+    mock::log_errors = 0;
+    global_preferences->reset();
+  }
+};
+
+// =============================================================================
+// 4-WIRE
+// =============================================================================
+
+TEST_F(SpaSimTest, FourWireRepliesToEveryFrame) {
+  SpaRig rig(MODEL_54154);
+  CioSim4W cio(&rig.uart, *get_model_config_4w(MODEL_54154));
+  cio.set_water_temp(33.0f);
+  rig.spa.setup();
+
+  run_loop(rig, 10000, [&] { cio.step(); });
+  uint32_t sent = cio.frames_sent();
+  cio.step();  // Collect the last replies
+
+  const LinkStats &link = rig.spa.get_link_stats();
+  EXPECT_TRUE(rig.spa.get_state().confirmed);
+  EXPECT_FLOAT_EQ(rig.spa.get_state().current_temp(), 33.0f);
+  EXPECT_EQ(link.counters[LINK_FRAMES_RX], sent);
+  EXPECT_EQ(link.counters[LINK_FRAMES_TX], cio.replies());
+  EXPECT_EQ(cio.bad_replies(), 0u);
+  EXPECT_EQ(link.counters[LINK_TIMEOUTS], 0u);
+  EXPECT_EQ(mock::log_warnings, 0u);
+}
+
+TEST_F(SpaSimTest, FourWireCountsCorruptionAndNoise) {
+  SpaRig rig(MODEL_54138);
+  CioSim4W cio(&rig.uart, *get_model_config_4w(MODEL_54138));
+  FaultConfig faults;
+  faults.corrupt_every = 7;
+  faults.noise_every = 5;
+  faults.noise_len = 4;
+  cio.set_faults(faults);
+  rig.spa.setup();
+
+  run_loop(rig, 30000, [&] { cio.step(); });
+  uint32_t sent = cio.frames_sent();
+  uint32_t corrupted = cio.frames_corrupted();
+  cio.step();
+
+  const LinkStats &link = rig.spa.get_link_stats();
+  ASSERT_GT(cio.frames_corrupted(), 0u);
+  EXPECT_EQ(link.counters[LINK_CHECKSUM_ERRORS], cio.frames_corrupted());
+  EXPECT_EQ(link.counters[LINK_BYTES_DISCARDED], cio.noise_bytes());
+  EXPECT_EQ(link.counters[LINK_FRAMES_RX], sent - corrupted);
+  EXPECT_EQ(link.counters[LINK_FRAMES_TX], cio.replies());
+  EXPECT_EQ(cio.bad_replies(), 0u);
+  EXPECT_EQ(mock::log_warnings, cio.frames_corrupted());
+  EXPECT_EQ(mock::log_errors, 0u);
+}
+
+TEST_F(SpaSimTest, FourWireHeaterStagesUp) {
+  SpaRig rig(MODEL_54154);
+  CioSim4W cio(&rig.uart, *get_model_config_4w(MODEL_54154));
+  rig.spa.setup();
+  run_loop(rig, 2000, [&] { cio.step(); });
+  ASSERT_TRUE(rig.spa.get_state().confirmed);
+
+  uint32_t requested = millis();
+  rig.spa.set_heater(true);
+  run_loop(rig, 15000, [&] { cio.step(); });
+
+  // Stage 1 straight away, both elements once it has run for 10 s
+  ASSERT_NE(cio.stage_started_ms(1), 0u);
+  ASSERT_NE(cio.stage_started_ms(2), 0u);
+  EXPECT_LT(cio.stage_started_ms(1) - requested, 100u);
+  uint32_t stage1 = cio.stage_started_ms(2) - cio.stage_started_ms(1);
+  EXPECT_GE(stage1, 10000u);
+  EXPECT_LT(stage1, 10100u);
+  EXPECT_EQ(cio.heater_stage(), 2);
+  EXPECT_TRUE(rig.spa.get_state().heater_red);
+  EXPECT_EQ(rig.spa.action, climate::CLIMATE_ACTION_HEATING);
+}
+
+TEST_F(SpaSimTest, FourWireFollowsTheWaterTemperature) {
+  SpaRig rig(MODEL_54154);
+  CioSim4W cio(&rig.uart, *get_model_config_4w(MODEL_54154));
+  cio.set_water_temp(30.0f);
+  cio.set_rates(120.0f, -0.5f);  // 2 degrees a minute
+  rig.spa.setup();
+
+  rig.spa.set_heater(true);
+  run_loop(rig, 180000, [&] { cio.step(); });
+
+  EXPECT_GT(cio.water_temp(), 35.0f);
+  EXPECT_NEAR(rig.spa.get_state().current_temp(), cio.water_temp(), 1.0f);
+  EXPECT_NEAR(rig.spa.current_temperature, cio.water_temp(), 1.0f);
+}
+
+TEST_F(SpaSimTest, EnergyWaitsForAConfirmedState) {
+  // First boot: bubbles on, saved at shutdown
+  {
+    SpaRig rig(MODEL_54149E);
+    DisplaySim6W display(MODEL_54149E, &rig.clk, &rig.data, &rig.cs);
+    rig.spa.setup();
+    rig.spa.set_bubbles(true);
+    run_loop(rig, 2000);
+    ASSERT_TRUE(rig.spa.get_state().bubbles);
+    rig.spa.on_shutdown();
+  }
+
+  // Second boot restores bubbles on, but the CIO stays silent for a minute
+  SpaRig rig(MODEL_54154);
+  CioSim4W cio(&rig.uart, *get_model_config_4w(MODEL_54154));
+  sensor::Sensor bubbles_energy;
+  rig.spa.set_energy_sensor(ENERGY_BUBBLES, &bubbles_energy);
+  rig.spa.setup();
+  run_loop(rig, 60000);
+  ASSERT_TRUE(rig.spa.get_state().bubbles);
+  ASSERT_FALSE(rig.spa.get_state().confirmed);
+  // Totals are first published on the first confirmed pass
+  run_loop(rig, 500, [&] { cio.step(); });
+
+  // The first boot ran them for under 2 s (0.00044 kWh); the silent minute
+  // would have added 0.013 kWh
+  ASSERT_TRUE(rig.spa.get_state().confirmed);
+  ASSERT_EQ(bubbles_energy.publish_count(), 1u);
+  EXPECT_LT(bubbles_energy.state(), 0.001f);
+}
+
+// =============================================================================
+// 6-WIRE ACTIVE
+// =============================================================================
+
+class SixWireActiveTest : public SpaSimTest, public ::testing::WithParamInterface<SpaModel> {};
+
+TEST_P(SixWireActiveTest, RefreshesTheDisplayAndPollsButtons) {
+  SpaRig rig(GetParam());
+  DisplaySim6W display(GetParam(), &rig.clk, &rig.data, &rig.cs);
+  rig.spa.setup();
+
+  run_loop(rig, 10000);
+
+  const LinkStats &link = rig.spa.get_link_stats();
+  EXPECT_TRUE(rig.spa.get_state().confirmed);
+  // 20 Hz refresh and 10 Hz polls, give or take the 16 ms loop granularity
+  EXPECT_GE(display.payloads(), 150u);
+  EXPECT_LE(display.payloads(), 200u);
+  EXPECT_GE(display.button_reads(), 90u);
+  EXPECT_LE(display.button_reads(), 100u);
+  EXPECT_EQ(display.bad_frames(), 0u);
+  EXPECT_EQ(link.counters[LINK_FRAMES_TX], display.payloads());
+  EXPECT_EQ(link.counters[LINK_FRAMES_RX], display.button_reads());
+  EXPECT_EQ(link.counters[LINK_BAD_READS], 0u);
+
+  if (model_protocol(GetParam()) == PROTOCOL_6WIRE_T1) {
+    uint8_t cmd1 = GetParam() == MODEL_P05504 ? DSP_CMD1_MODE6_11_7_P05504 : DSP_CMD1_MODE6_11_7;
+    EXPECT_EQ(display.payload()[0], cmd1);
+  } else {
+    EXPECT_EQ(display.brightness_commands(), display.payloads());
+  }
+}
+
+TEST_P(SixWireActiveTest, PhysicalPressTogglesOnce) {
+  SpaRig rig(GetParam());
+  DisplaySim6W display(GetParam(), &rig.clk, &rig.data, &rig.cs);
+  rig.spa.setup();
+  run_loop(rig, 500);
+  ASSERT_FALSE(rig.spa.get_state().bubbles);
+
+  // Held across several polls, but acted on once
+  display.hold(BUBBLES);
+  run_loop(rig, 500);
+  display.hold(NOBTN);
+  run_loop(rig, 300);
+  EXPECT_TRUE(rig.spa.get_state().bubbles);
+
+  display.hold(BUBBLES);
+  run_loop(rig, 300);
+  display.hold(NOBTN);
+  run_loop(rig, 300);
+  EXPECT_FALSE(rig.spa.get_state().bubbles);
+}
+
+TEST_P(SixWireActiveTest, RequestsGoThroughThePressEngine) {
+  SpaRig rig(GetParam());
+  DisplaySim6W display(GetParam(), &rig.clk, &rig.data, &rig.cs);
+  rig.spa.setup();
+  run_loop(rig, 500);
+
+  rig.spa.set_filter(true);
+  rig.spa.set_bubbles(true);
+  run_loop(rig, 3000);
+  EXPECT_TRUE(rig.spa.get_state().filter_pump);
+  EXPECT_TRUE(rig.spa.get_state().bubbles);
+
+  rig.spa.set_bubbles(false);
+  run_loop(rig, 2000);
+  EXPECT_FALSE(rig.spa.get_state().bubbles);
+  EXPECT_TRUE(rig.spa.get_state().filter_pump);
+  EXPECT_EQ(display.bad_frames(), 0u);
+  EXPECT_EQ(mock::log_warnings, 0u);
+}
+
+TEST_P(SixWireActiveTest, NewSetPointReplacesOneStillBeingPressed) {
+  SpaRig rig(GetParam());
+  DisplaySim6W display(GetParam(), &rig.clk, &rig.data, &rig.cs);
+  rig.spa.setup();
+  run_loop(rig, 500);
+  ASSERT_FLOAT_EQ(rig.spa.get_state().target_temp(), 37.0f);
+
+  rig.spa.set_target_temp(33.0f);
+  run_loop(rig, 400);
+  // Part way down
+  float midway = rig.spa.get_state().target_temp();
+  ASSERT_LT(midway, 37.0f);
+  ASSERT_GT(midway, 33.0f);
+
+  // Absolute, not added to the steps still to go
+  rig.spa.set_target_temp(31.0f);
+  run_loop(rig, 5000);
+  EXPECT_FLOAT_EQ(rig.spa.get_state().target_temp(), 31.0f);
+  EXPECT_EQ(mock::log_warnings, 0u);
+}
+
+TEST_P(SixWireActiveTest, StepsWithinOnePassAddUp) {
+  SpaRig rig(GetParam());
+  DisplaySim6W display(GetParam(), &rig.clk, &rig.data, &rig.cs);
+  rig.spa.setup();
+  run_loop(rig, 500);
+
+  rig.spa.adjust_target_temp(-1);
+  rig.spa.adjust_target_temp(-1);
+  run_loop(rig, 3000);
+  EXPECT_FLOAT_EQ(rig.spa.get_state().target_temp(), 35.0f);
+
+  // Steps after a set-point in the same pass build on it
+  rig.spa.set_target_temp(33.0f);
+  rig.spa.adjust_target_temp(1);
+  run_loop(rig, 3000);
+  EXPECT_FLOAT_EQ(rig.spa.get_state().target_temp(), 34.0f);
+  EXPECT_EQ(mock::log_warnings, 0u);
+}
+
+INSTANTIATE_TEST_SUITE_P(Models, SixWireActiveTest, ::testing::Values(MODEL_PRE2021, MODEL_54149E, MODEL_P05504));
+
+// =============================================================================
+// 6-WIRE FRAMING
+// =============================================================================
+
+// The first pass is due both a display refresh and a button poll; a
+// MemoryTransport records them byte for byte in wire order
+
+TEST_F(SpaSimTest, Type1FramesAreMsbFirst) {
+  const SpaModel models[] = {MODEL_PRE2021, MODEL_P05504};
+  for (SpaModel model : models) {
+    SCOPED_TRACE(model_name(model));
+    MemoryTransport bus;
+    SpaRig rig(model);
+    rig.spa.set_transport(&bus);
+    uint16_t code = get_button_codes(model)[BUBBLES];
+    const uint8_t answer[2] = {(uint8_t) (code >> 8), (uint8_t) (code & 0xFF)};
+    bus.set_read_data(answer, 2);
+    rig.spa.setup();
+    rig.spa.loop();
+
+    // 11-byte payload led by the command byte, then the read command pair
+    uint8_t cmd1 = model == MODEL_P05504 ? DSP_CMD1_MODE6_11_7_P05504 : DSP_CMD1_MODE6_11_7;
+    ASSERT_EQ(bus.written_len(), T1_PAYLOAD_LEN + 2);
+    EXPECT_EQ(bus.written()[0], cmd1);
+    EXPECT_EQ(bus.written()[T1_PAYLOAD_LEN], cmd1);
+    EXPECT_EQ(bus.written()[T1_PAYLOAD_LEN + 1], DSP_CMD2_DATAREAD);
+    EXPECT_EQ(bus.transactions(), 2u);
+    EXPECT_FALSE(bus.in_transaction());
+
+    // High byte first, so the answer decodes to BUBBLES
+    EXPECT_TRUE(rig.spa.get_state().bubbles);
+  }
+}
+
+TEST_F(SpaSimTest, Type2CommandsAreMsbFirstAndDataLsbFirst) {
+  MemoryTransport bus;
+  SpaRig rig(MODEL_54149E);
+  rig.spa.set_transport(&bus);
+  // BUBBLES is 0x0020: the low byte goes first and LSB first on the wire
+  uint16_t code = BTN_CODES_54149E[BUBBLES];
+  const uint8_t answer[2] = {reverse_bits(code & 0xFF), reverse_bits(code >> 8)};
+  bus.set_read_data(answer, 2);
+  rig.spa.setup();
+  rig.spa.loop();
+
+  // 0x40 + 5 payload bytes, the brightness command, the read command
+  const uint8_t *w = bus.written();
+  ASSERT_EQ(bus.written_len(), 1 + T2_PAYLOAD_LEN + 1 + 1);
+  EXPECT_EQ(w[0], TYPE2_CMD1);
+  EXPECT_EQ(w[1 + T2_PAYLOAD_LEN] & 0xF8, TYPE2_CMD3);
+  EXPECT_EQ(w[1 + T2_PAYLOAD_LEN + 1], TYPE2_CMD2);
+  EXPECT_EQ(bus.transactions(), 3u);
+  EXPECT_TRUE(rig.spa.get_state().bubbles);
+
+  // The brightness level rides in the low bits of the command, MSB first
+  bus.clear();
+  rig.spa.set_brightness(5);
+  mock::advance_us(50000);
+  rig.spa.loop();
+  ASSERT_GE(bus.written_len(), 1 + T2_PAYLOAD_LEN + 1);
+  EXPECT_EQ(bus.written()[1 + T2_PAYLOAD_LEN], TYPE2_CMD3 | 5);
+}
+
+// =============================================================================
+// 6-WIRE PASSIVE
+// =============================================================================
+
+class SixWirePassiveTest : public SpaSimTest, public ::testing::WithParamInterface<SpaModel> {};
+
+TEST_P(SixWirePassiveTest, DecodesTheCioTraffic) {
+  SpaRig rig(GetParam(), true);
+  CioDriver6W driver(GetParam(), &rig.clk, &rig.data, &rig.cs);
+  PassiveCio cio(driver, model_protocol(GetParam()) == PROTOCOL_6WIRE_T1);
+  rig.spa.setup();
+
+  DisplayStatus status{};
+  status.power = true;
+  status.filter_pump = true;
+  status.heater_red = true;
+  status.celsius = true;
+  cio.set_display(status, "38C");
+  run_loop(rig, 2000, cio);
+
+  const SpaState &state = rig.spa.get_state();
+  EXPECT_TRUE(state.confirmed);
+  EXPECT_TRUE(state.filter_pump);
+  EXPECT_TRUE(state.heater_red);
+  EXPECT_TRUE(state.heater_enabled);
+  EXPECT_FALSE(state.bubbles);
+  EXPECT_STREQ(state.display_chars, "38C");
+  EXPECT_EQ(state.error_code, 0);
+
+  // The digits carry the error code
+  cio.set_display(status, "E02");
+  run_loop(rig, 500, cio);
+  EXPECT_EQ(rig.spa.get_state().error_code, 2);
+
+  EXPECT_EQ(rig.spa.get_link_stats().counters[LINK_FRAMES_RX], driver.frames_sent());
+}
+
+TEST_P(SixWirePassiveTest, IgnoresTruncatedFrames) {
+  SpaRig rig(GetParam(), true);
+  CioDriver6W driver(GetParam(), &rig.clk, &rig.data, &rig.cs);
+  PassiveCio cio(driver, model_protocol(GetParam()) == PROTOCOL_6WIRE_T1);
+  FaultConfig faults;
+  faults.truncate_every = 3;
+  driver.set_faults(faults);
+  rig.spa.setup();
+
+  DisplayStatus status{};
+  status.power = true;
+  status.bubbles = true;
+  cio.set_display(status, " 40");
+  run_loop(rig, 3000, cio);
+
+  // A cut frame loses its last byte, so it never matches a known length
+  const SpaState &state = rig.spa.get_state();
+  ASSERT_GT(driver.frames_truncated(), 0u);
+  EXPECT_TRUE(state.confirmed);
+  EXPECT_TRUE(state.bubbles);
+  EXPECT_STREQ(state.display_chars, " 40");
+  EXPECT_EQ(mock::log_errors, 0u);
+}
+
+INSTANTIATE_TEST_SUITE_P(Models, SixWirePassiveTest, ::testing::Values(MODEL_PRE2021, MODEL_54149E, MODEL_P05504));
+
+// =============================================================================
+// HEATING PLANNER
+// =============================================================================
+
+// 2026-01-01 00:00:00 UTC
+const time_t PLAN_EPOCH = 1767225600;
+
+TEST_F(SpaSimTest, HeatingPlanPutsBackAHeaterTurnedOffAtThePanel) {
+  SpaRig rig(MODEL_PRE2021);
+  DisplaySim6W display(MODEL_PRE2021, &rig.clk, &rig.data, &rig.cs);
+  time::RealTimeClock rtc;
+  rtc.set_epoch_at_boot(PLAN_EPOCH);
+  rig.spa.set_time(&rtc);
+  rig.spa.setup();
+  run_loop(rig, 500);
+
+  // Every slot costs the same and there is little time: heat straight away
+  rig.spa.start_heating_plan(40.0f, 30);
+  run_loop(rig, 5000);
+  ASSERT_TRUE(rig.spa.get_state().heater_enabled);
+  ASSERT_TRUE(rig.spa.get_state().filter_pump);
+
+  display.hold(HEAT);
+  run_loop(rig, 300);
+  display.hold(NOBTN);
+  run_loop(rig, 300);
+  ASSERT_FALSE(rig.spa.get_state().heater_enabled);
+
+  // Put right at the next minute, with no new decision to trigger it
+  run_loop(rig, 65000);
+  EXPECT_TRUE(rig.spa.get_state().heater_enabled);
+  EXPECT_TRUE(rig.spa.get_state().filter_pump);
+}
+
+TEST_F(SpaSimTest, HeatingPlanUsesTheCheapHoursBeforeARateIsLearned) {
+  SpaRig rig(MODEL_PRE2021);
+  DisplaySim6W display(MODEL_PRE2021, &rig.clk, &rig.data, &rig.cs);
+  time::RealTimeClock rtc;
+  rtc.set_epoch_at_boot(PLAN_EPOCH);
+  rig.spa.set_time(&rtc);
+  rig.spa.set_default_price(0.30f);
+  rig.spa.add_price_window(4 * 60, 6 * 60, 0.10f);
+  rig.spa.set_default_heating_rate(1.0f);
+  rig.spa.setup();
+  run_loop(rig, 500);
+
+  // One degree at the default 1 degree/h fits well inside the cheap window
+  rig.spa.start_heating_plan(rig.spa.get_state().current_temp() + 1.0f, 6 * 60);
+  run_loop(rig, 5000);
+  EXPECT_FALSE(rig.spa.get_state().heater_enabled);
+  EXPECT_FALSE(rig.spa.get_state().filter_pump);
+}
+
+// =============================================================================
+// LOAD RUN
+// =============================================================================
+
+// Two simulated minutes per model with line faults and a button press every
+// few seconds, reporting the wall time loop() takes on this host
+class LoadRunTest : public SpaSimTest, public ::testing::WithParamInterface<SpaModel> {};
+
+TEST_P(LoadRunTest, RunsCleanUnderFaults) {
+  const SpaModel model = GetParam();
+  const uint32_t RUN_MS = 120000;
+  FaultConfig faults;
+  faults.corrupt_every = 25;
+  faults.noise_every = 40;
+  SpaRig rig(model);
+  LoopTiming timing;
+
+  if (model_protocol(model) == PROTOCOL_4WIRE) {
+    CioSim4W cio(&rig.uart, *get_model_config_4w(model));
+    cio.set_faults(faults);
+    rig.spa.setup();
+    rig.spa.set_heater(true);
+    timing = run_loop(rig, RUN_MS, [&] { cio.step(); });
+    cio.step();
+
+    const LinkStats &link = rig.spa.get_link_stats();
+    EXPECT_EQ(link.counters[LINK_CHECKSUM_ERRORS], cio.frames_corrupted());
+    EXPECT_EQ(link.counters[LINK_BYTES_DISCARDED], cio.noise_bytes());
+    EXPECT_EQ(link.counters[LINK_FRAMES_TX], cio.replies());
+    EXPECT_EQ(cio.heater_stage(), 2);
+  } else {
+    DisplaySim6W display(model, &rig.clk, &rig.data, &rig.cs);
+    rig.spa.setup();
+    uint32_t presses = 0;
+    timing = run_loop(rig, RUN_MS, [&] {
+      // Hold BUBBLES for 300 ms out of every 5 s
+      uint32_t phase = millis() % 5000;
+      display.hold(phase < 300 ? BUBBLES : NOBTN);
+      if (phase >= 2500 && phase < 2516 && presses++ % 2 == 0) {
+        rig.spa.set_filter(!rig.spa.get_state().filter_pump);
+      }
+    });
+    EXPECT_EQ(display.bad_frames(), 0u);
+    EXPECT_GE(display.payloads(), RUN_MS / 50 * 3 / 4);
+  }
+
+  EXPECT_TRUE(rig.spa.get_state().confirmed);
+  EXPECT_EQ(mock::log_errors, 0u);
+  printf("[ load     ] %-8s %6u passes, loop() mean %6.2f us, max %7.2f us\n", model_name(model),
+         (unsigned) timing.passes, timing.mean_us(), timing.max_us);
+  RecordProperty("loop_mean_us", (int) timing.mean_us());
+  RecordProperty("loop_max_us", (int) timing.max_us);
+}
+
+INSTANTIATE_TEST_SUITE_P(Models, LoadRunTest,
+                         ::testing::Values(MODEL_PRE2021, MODEL_54149E, MODEL_54123, MODEL_54138, MODEL_54144,
+                                           MODEL_54154, MODEL_54173, MODEL_P05504));
+
+}  // namespace
@@ -0,0 +1,373 @@
+// Micro-benchmarks for the codec hot paths.
+//
+// Build on the host against the protocol codec:
+//   g++ -std=c++17 -O2 -Icomponents/bestway_spa -o bestway_bench
+//       tools/bestway_bench.cpp components/bestway_spa/bestway_codec.cpp
+//
+// Usage:
+//   ./bestway_bench                          print ns/op (and frames/s) per benchmark
+//   ./bestway_bench --save baseline.txt      also store the results as a baseline
+//   ./bestway_bench --check baseline.txt     fail if a benchmark got slower than
+//                    [--tolerance 25]        the baseline by more than the tolerance (%)
+//
+// Each benchmark mirrors a path the component runs on every frame or poll:
+// 4-wire sync/checksum/parse as in process_4wire_frames_(), the reply built
+// by send_4wire_response_(), the temperature filter each 4-wire frame goes
+// through, button and 7-segment decoding for the 6-wire display, and the
+// press queue churn of queue_button_(). 7-segment decoding is timed twice:
+// the table lookup in use (7segment/*) and the linear scan it replaced
+// (7segment_scan/*).
+
+#include "bestway_codec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace esphome::bestway_spa;
+
+struct ModelName {
+  SpaModel model;
+  const char *name;
+};
+
+static const ModelName MODELS_4W[] = {
+    {MODEL_54123, "54123"}, {MODEL_54138, "54138"}, {MODEL_54144, "54144"},
+    {MODEL_54154, "54154"}, {MODEL_54173, "54173"},
+};
+
+static const ModelName MODELS_6W[] = {
+    {MODEL_PRE2021, "PRE2021"},
+    {MODEL_54149E, "54149E"},
+    {MODEL_P05504, "P05504"},
+};
+
+// Keeps results observable so the optimizer cannot drop the work
+static volatile uint32_t sink;
+
+struct Result {
+  std::string name;
+  double ns_per_op;
+  bool frames;  // ops are frames; also report frames/s
+};
+
+// Grows the iteration count until one run of fn(iterations) takes long
+// enough to time, then keeps the fastest of several runs so a busy host
+// does not show up as a regression
+template<typename F> static double time_ns_per_op(F fn, uint32_t ops_per_iteration) {
+  using clock = std::chrono::steady_clock;
+  const int repeats = 5;
+  uint32_t iterations = 16;
+  double best = 0;
+  for (int run = 0; run < repeats;) {
+    auto start = clock::now();
+    fn(iterations);
+    double elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    if (elapsed < 5e7 && iterations < (1u << 30)) {
+      iterations *= 2;
+      continue;
+    }
+    double ns = elapsed / ((double) iterations * ops_per_iteration);
+    if (run++ == 0 || ns < best) best = ns;
+  }
+  return best;
+}
+
+// A stream of valid CIO frames with a stray byte every 16 frames, as seen
+// on a noisy line
+static std::vector<uint8_t> make_4wire_stream(const ModelConfig4W &config, size_t frames) {
+  std::vector<uint8_t> stream;
+  for (size_t i = 0; i < frames; i++) {
+    CioStatus4W st{};
+    st.temperature = (uint8_t) (20 + i % 20);
+    st.filter_pump = i & 1;
+    st.bubbles = i & 2;
+    st.jets = i & 4;
+    st.heater_red = i & 8;
+    uint8_t frame[FRAME_4W_LEN];
+    encode_4wire_status(st, config, frame);
+    stream.insert(stream.end(), frame, frame + FRAME_4W_LEN);
+    if (i % 16 == 15) {
+      stream.push_back(0x5A);
+    }
+  }
+  return stream;
+}
+
+static void bench_4wire_stream(std::vector<Result> *results) {
+  const size_t frames = 256;
+  const size_t chunk = 16;  // Bytes per UART read
+  for (const auto &m : MODELS_4W) {
+    const ModelConfig4W *config = get_model_config_4w(m.model);
+    std::vector<uint8_t> stream = make_4wire_stream(*config, frames);
+    double ns = time_ns_per_op(
+        [&](uint32_t iterations) {
+          RxBuffer<128> rx;
+          uint32_t acc = 0;
+          for (uint32_t it = 0; it < iterations; it++) {
+            for (size_t pos = 0; pos < stream.size();) {
+              if (rx.free_space() == 0) rx.compact();
+              size_t n = std::min(chunk, std::min(stream.size() - pos, rx.free_space()));
+              memcpy(rx.write_ptr(), stream.data() + pos, n);
+              rx.commit(n);
+              pos += n;
+              while (rx.size() >= FRAME_4W_LEN) {
+                FrameView frame = rx.view(0, FRAME_4W_LEN);
+                FrameCheck check = check_4wire_frame(frame);
+                if (check == FRAME_BAD_MARKER) {
+                  rx.consume(find_4wire_resync(rx.data(), rx.size()));
+                  continue;
+                }
+                if (check == FRAME_OK) {
+                  CioStatus4W st;
+                  decode_4wire_frame(frame, *config, &st);
+                  acc += st.temperature;
+                }
+                rx.consume(FRAME_4W_LEN);
+              }
+            }
+          }
+          sink = acc;
+        },
+        frames);
+    results->push_back({std::string("4w_stream/") + m.name, ns, true});
+  }
+}
+
+static void bench_4wire_response(std::vector<Result> *results) {
+  for (const auto &m : MODELS_4W) {
+    const ModelConfig4W *config = get_model_config_4w(m.model);
+    double ns = time_ns_per_op(
+        [&](uint32_t iterations) {
+          uint8_t out[FRAME_4W_LEN];
+          uint32_t acc = 0;
+          for (uint32_t i = 0; i < iterations; i++) {
+            CioCommand4W cmd{(uint8_t) (i % 3), (i & 4) != 0, (i & 8) != 0, (i & 16) != 0, (uint8_t) (20 + i % 20)};
+            encode_4wire_response(cmd, *config, out);
+            acc += out[5];
+          }
+          sink = acc;
+        },
+        1);
+    results->push_back({std::string("4w_response/") + m.name, ns, false});
+  }
+}
+
+static void bench_temp_filter(std::vector<Result> *results) {
+  // A slow warm-up with one glitch every 32 readings
+  int16_t readings[256];
+  for (size_t i = 0; i < 256; i++) readings[i] = (int16_t) (30 + i / 32 + (i % 32 == 31 ? 40 : 0));
+  double ns = time_ns_per_op(
+      [&](uint32_t iterations) {
+        TempFilter filter;
+        filter.configure(TempFilterConfig{});
+        uint32_t acc = 0;
+        for (uint32_t i = 0; i < iterations; i++) {
+          for (int16_t raw : readings) acc += filter.push(raw);
+        }
+        sink = acc + filter.value();
+      },
+      256);
+  results->push_back({"temp_filter", ns, false});
+}
+
+static void bench_button_decode(std::vector<Result> *results) {
+  for (const auto &m : MODELS_6W) {
+    const uint16_t *codes = get_button_codes(m.model);
+    if (codes == nullptr) continue;
+    // Every known code plus one that matches none
+    uint16_t inputs[BTN_COUNT + 1];
+    for (size_t i = 0; i < BTN_COUNT; i++) inputs[i] = codes[i];
+    inputs[BTN_COUNT] = 0x1234;
+    double ns = time_ns_per_op(
+        [&](uint32_t iterations) {
+          uint32_t acc = 0;
+          for (uint32_t i = 0; i < iterations; i++) {
+            for (uint16_t code : inputs) acc += decode_button_code(codes, code);
+          }
+          sink = acc;
+        },
+        BTN_COUNT + 1);
+    results->push_back({std::string("button_decode/") + m.name, ns, false});
+  }
+}
+
+// The linear scan that decode_7segment() replaced with its 256-entry
+// tables, kept so both paths are measured side by side
+static char decode_7segment_scan(uint8_t segments, bool is_type1) {
+  const uint8_t *codes = is_type1 ? CHARCODES_TYPE1 : CHARCODES_TYPE2;
+  for (size_t i = 0; i < CHARCODE_COUNT; i++) {
+    if (codes[i] == segments) {
+      return CHARS[i];
+    }
+  }
+  return '?';
+}
+
+template<typename Decode> static double time_7segment(Decode decode, bool type1) {
+  return time_ns_per_op(
+      [&](uint32_t iterations) {
+        uint32_t acc = 0;
+        for (uint32_t i = 0; i < iterations; i++) {
+          for (uint32_t seg = 0; seg < 256; seg++) acc += decode((uint8_t) seg, type1);
+        }
+        sink = acc;
+      },
+      256);
+}
+
+static void bench_7segment(std::vector<Result> *results) {
+  for (int type1 = 1; type1 >= 0; type1--) {
+    const char *suffix = type1 ? "/T1" : "/T2";
+    results->push_back({std::string("7segment") + suffix, time_7segment(decode_7segment, type1), false});
+    results->push_back(
+        {std::string("7segment_scan") + suffix, time_7segment(decode_7segment_scan, type1), false});
+  }
+}
+
+static void bench_display_decode(std::vector<Result> *results) {
+  for (int type1 = 1; type1 >= 0; type1--) {
+    uint8_t payload[T1_PAYLOAD_LEN] = {0};
+    DisplayStatus st{};
+    st.power = st.filter_pump = st.heater_red = st.celsius = true;
+    encode_display_payload(st, "38C", type1, payload);
+    double ns = time_ns_per_op(
+        [&](uint32_t iterations) {
+          uint32_t acc = 0;
+          for (uint32_t i = 0; i < iterations; i++) {
+            DisplayStatus out;
+            char digits[3];
+            decode_display_status(payload, type1, &out);
+            decode_display_digits(payload, type1, digits);
+            acc += out.heater_red + digits[0];
+          }
+          sink = acc;
+        },
+        1);
+    results->push_back({type1 ? "display_decode/T1" : "display_decode/T2", ns, true});
+  }
+}
+
+// Same size and shape as ButtonQueueItem in bestway_spa.h
+struct QueueItem {
+  uint16_t button_code;
+  Buttons button;
+  uint8_t target_state;
+  int target_value;
+  int duration_ms;
+  uint32_t start_time;
+  int start_value;
+  uint8_t presses;
+  uint8_t max_presses;
+  bool released;
+};
+
+static void bench_button_queue(std::vector<Result> *results) {
+  // Fill the queue, coalesce one entry from the middle, then drain it
+  const uint32_t ops = 16 + 1 + 15;
+  double ns = time_ns_per_op(
+      [&](uint32_t iterations) {
+        RingQueue<QueueItem, 16> queue;
+        uint32_t acc = 0;
+        for (uint32_t i = 0; i < iterations; i++) {
+          QueueItem item{};
+          for (uint16_t n = 0; n < 16; n++) {
+            item.button_code = n;
+            queue.push(item);
+          }
+          queue.erase(queue.size() / 2);
+          while (!queue.empty()) {
+            acc += queue.front().button_code;
+            queue.pop();
+          }
+        }
+        sink = acc;
+      },
+      ops);
+  results->push_back({"button_queue", ns, false});
+}
+
+static bool load_baseline(const char *path, std::map<std::string, double> *baseline) {
+  std::ifstream file(path);
+  if (!file) return false;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream in(line);
+    std::string name;
+    double ns;
+    if (in >> name >> ns) (*baseline)[name] = ns;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *save_path = nullptr;
+  const char *check_path = nullptr;
+  double tolerance = 25.0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+      save_path = argv[++i];
+    } else if (strcmp(argv[i], "--check") == 0 && i + 1 < argc) {
+      check_path = argv[++i];
+    } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--save FILE] [--check FILE [--tolerance PCT]]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  std::map<std::string, double> baseline;
+  if (check_path != nullptr && !load_baseline(check_path, &baseline)) {
+    fprintf(stderr, "cannot open %s\n", check_path);
+    return 2;
+  }
+
+  std::vector<Result> results;
+  bench_4wire_stream(&results);
+  bench_4wire_response(&results);
+  bench_temp_filter(&results);
+  bench_button_decode(&results);
+  bench_7segment(&results);
+  bench_display_decode(&results);
+  bench_button_queue(&results);
+
+  int regressions = 0;
+  for (const auto &r : results) {
+    printf("%-24s %9.2f ns/op", r.name.c_str(), r.ns_per_op);
+    if (r.frames) printf("  %12.0f frames/s", 1e9 / r.ns_per_op);
+    auto it = baseline.find(r.name);
+    if (it != baseline.end()) {
+      double change = (r.ns_per_op / it->second - 1.0) * 100.0;
+      bool slower = change > tolerance;
+      regressions += slower;
+      printf("  %+6.1f%%%s", change, slower ? "  REGRESSION" : "");
+    }
+    printf("\n");
+  }
+
+  if (save_path != nullptr) {
+    FILE *out = fopen(save_path, "w");
+    if (out == nullptr) {
+      fprintf(stderr, "cannot write %s\n", save_path);
+      return 2;
+    }
+    fprintf(out, "# bestway_bench baseline: benchmark ns/op\n");
+    for (const auto &r : results) fprintf(out, "%s %.2f\n", r.name.c_str(), r.ns_per_op);
+    fclose(out);
+  }
+
+  if (regressions > 0) {
+    fprintf(stderr, "%d benchmark(s) slower than the baseline by more than %.0f%%\n", regressions, tolerance);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,169 @@
+// Replay a frame capture dumped by the bestway_spa.dump_capture action.
+//
+// Build on the host against the protocol codec:
+//   g++ -std=c++17 -O2 -Icomponents/bestway_spa -o bestway_replay
+//       tools/bestway_replay.cpp components/bestway_spa/bestway_codec.cpp
+//
+// Usage:
+//   esphome logs bestway-spa.yaml | tee spa.log
+//   ./bestway_replay spa.log      (or pipe the log in on stdin)
+//
+// Every "capture NNN: <hex>" line in the log is collected, the dump is
+// reassembled and each record is fed back through the same decoders the
+// firmware uses.
+
+#include "bestway_codec.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace esphome::bestway_spa;
+
+static const char *const KIND_NAMES[CAPTURE_KIND_COUNT] = {
+    "4W_RX", "4W_RX_BAD", "4W_TX", "DSP_PAYLOAD", "CIO_PAYLOAD", "BUTTON",
+};
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = (char) tolower(c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+// Collect the dump lines by index so out-of-order or repeated lines are harmless
+static bool read_dump(std::istream &in, std::vector<uint8_t> *dump) {
+  std::map<unsigned, std::vector<uint8_t>> lines;
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t pos = line.find("capture ");
+    if (pos == std::string::npos) continue;
+    if (line.compare(pos + 8, 5, "begin") == 0) {
+      lines.clear();  // A later dump replaces an earlier one
+      continue;
+    }
+    unsigned index;
+    int consumed = 0;
+    if (sscanf(line.c_str() + pos, "capture %u: %n", &index, &consumed) != 1 || consumed == 0) continue;
+
+    std::vector<uint8_t> bytes;
+    for (size_t i = pos + consumed; i + 1 < line.size(); i += 2) {
+      int hi = hex_value(line[i]);
+      int lo = hex_value(line[i + 1]);
+      if (hi < 0 || lo < 0) break;
+      bytes.push_back((uint8_t) ((hi << 4) | lo));
+    }
+    lines[index] = bytes;
+  }
+
+  unsigned expected = 0;
+  for (auto &entry : lines) {
+    if (entry.first != expected) {
+      fprintf(stderr, "capture line %u missing\n", expected);
+      return false;
+    }
+    dump->insert(dump->end(), entry.second.begin(), entry.second.end());
+    expected++;
+  }
+  return !dump->empty();
+}
+
+static void print_hex(const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    printf("%02X", data[i]);
+  }
+}
+
+static void print_display(const uint8_t *payload, size_t len) {
+  if (len != T1_PAYLOAD_LEN && len != T2_PAYLOAD_LEN) return;
+  bool is_type1 = len == T1_PAYLOAD_LEN;
+  DisplayStatus st;
+  char digits[3];
+  decode_display_status(payload, is_type1, &st);
+  decode_display_digits(payload, is_type1, digits);
+  printf(" \"%c%c%c\" power=%d lock=%d heat=%d/%d pump=%d bubbles=%d jets=%d %s", digits[0], digits[1],
+         digits[2], st.power, st.locked, st.heater_green, st.heater_red, st.filter_pump, st.bubbles, st.jets,
+         st.celsius ? "C" : (st.fahrenheit ? "F" : "-"));
+}
+
+int main(int argc, char **argv) {
+  std::vector<uint8_t> dump;
+  bool ok;
+  if (argc > 1) {
+    std::ifstream file(argv[1]);
+    if (!file) {
+      fprintf(stderr, "cannot open %s\n", argv[1]);
+      return 1;
+    }
+    ok = read_dump(file, &dump);
+  } else {
+    ok = read_dump(std::cin, &dump);
+  }
+  if (!ok) {
+    fprintf(stderr, "no complete capture dump found\n");
+    return 1;
+  }
+
+  ProtocolType protocol;
+  SpaModel model;
+  size_t pos = decode_capture_header(dump.data(), dump.size(), &protocol, &model);
+  if (pos == 0) {
+    fprintf(stderr, "bad capture header\n");
+    return 1;
+  }
+  const ModelConfig4W *config = get_model_config_4w(model);
+  const uint16_t *btn_codes = get_button_codes(model);
+  printf("protocol %d, model %d\n", protocol, model);
+
+  uint32_t prev_time = 0;
+  uint32_t start_time = 0;
+  size_t records = 0;
+  while (pos < dump.size()) {
+    CaptureRecord rec;
+    size_t used = decode_capture_record(dump.data() + pos, dump.size() - pos, prev_time, &rec);
+    if (used == 0) {
+      fprintf(stderr, "malformed record at byte %u\n", (unsigned) pos);
+      return 1;
+    }
+    pos += used;
+    if (records++ == 0) start_time = rec.time_ms;
+    prev_time = rec.time_ms;
+
+    printf("%9.3f %-11s ", (rec.time_ms - start_time) / 1000.0, KIND_NAMES[rec.kind]);
+    print_hex(rec.data, rec.len);
+
+    FrameView frame{rec.data, rec.len};
+    switch (rec.kind) {
+      case CAPTURE_4W_RX:
+      case CAPTURE_4W_RX_BAD:
+        if (rec.len == FRAME_4W_LEN && check_4wire_frame(frame) == FRAME_OK) {
+          CioStatus4W st;
+          decode_4wire_frame(frame, *config, &st);
+          printf(" temp=%u err=%u pump=%d bubbles=%d jets=%d heat=%d", st.temperature, st.error_code,
+                 st.filter_pump, st.bubbles, st.jets, st.heater_red);
+        } else {
+          printf(" invalid");
+        }
+        break;
+      case CAPTURE_DSP_PAYLOAD:
+      case CAPTURE_CIO_PAYLOAD:
+        print_display(rec.data, rec.len);
+        break;
+      case CAPTURE_BUTTON:
+        if (rec.len == 2 && btn_codes != nullptr) {
+          printf(" button=%d", decode_button_code(btn_codes, (rec.data[0] << 8) | rec.data[1]));
+        }
+        break;
+      default:
+        break;
+    }
+    printf("\n");
+  }
+  printf("%u records\n", (unsigned) records);
+  return 0;
+}